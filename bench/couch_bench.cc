@@ -3,9 +3,11 @@
 #include <string.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <assert.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <sched.h>
 #ifndef __APPLE__
 #include <malloc.h>
 #endif
@@ -14,6 +16,7 @@
 
 #include "couch_common.h"
 #include "couch_db.h"
+#include "couch_engine.h"
 #include "adv_random.h"
 #include "stopwatch.h"
 #include "iniparser.h"
@@ -21,6 +24,8 @@
 #include "arch.h"
 #include "zipfian_random.h"
 #include "keygen.h"
+#include "latency.h"
+#include "affinity.h"
 
 #include "memleak.h"
 
@@ -49,6 +54,12 @@ struct bench_info {
     uint64_t wbs_bench; /* write buffer size for normal benchmark */
     uint64_t fdb_wal; /* WAL size for fdb */
     int wt_type; /* WiredTiger: B+tree or LSM-tree? */
+    uint8_t raw_body; /* store bodies without the docinfo header */
+    uint8_t namespaces; /* files are namespaces of one DB instance */
+    int ckpt_policy; /* checkpoint policy (ENGINE_CKPT_*) */
+    uint64_t ckpt_value; /* checkpoint period (sec) or log size (bytes) */
+    char *stats_filename; /* engine statistics time series ("": off) */
+    char *engine_options; /* native options taken by the DB module */
 
     // # docs, # files, filename
     size_t ndocs;
@@ -66,6 +77,8 @@ struct bench_info {
     // key generation (prefix)
     size_t nlevel;
     size_t nprefixes;
+    keygen_order_t key_order;
+    struct zipf_rnd zipf; /* batch distribution (zipfian only) */
     struct keygen keygen;
 
     // benchmark threads
@@ -73,14 +86,48 @@ struct bench_info {
     size_t nwriters;
     size_t reader_ops;
     size_t writer_ops;
+    size_t nsnapshots;
+    size_t snapshot_ops;
+    size_t snapshot_hold_sec;
+    size_t vclients; // logical clients per bench thread (0: one per thread)
+    size_t think_us; // mean think time of a logical client
+    size_t pregen_threads; // 0: documents are generated by bench threads
+    size_t pregen_depth; // # pre-generated write batches per bench thread
+
+    // open-loop arrivals
+    uint8_t arrival_mode; // 0: closed-loop, 1: poisson, 2: trace
+    size_t arrival_rate;
+    size_t arrival_qlen;
+    char *arrival_trace;
+
+    // saturation search
+    uint8_t search_mode; // 0: none, 1: step, 2: binary
+    size_t search_start;
+    size_t search_step;
+    size_t search_max;
+    size_t search_warmup;
+    size_t search_measure;
+    uint8_t slo_metric; // 0: read, 1: write batch, 2: response time
+    size_t slo_p99_us;
+    double slo_drop;
+
+    // thread/memory placement
+    struct affinity affinity;
+
+    // thread scaling sweep
+    uint8_t scale_mode; // 0: none, 1: readers, 2: writers, 3: both
+    size_t scale_nsteps;
+    size_t scale_threads[64];
 
     // benchmark details
     struct rndinfo keylen;
     struct rndinfo prefixlen;
     struct rndinfo bodylen;
+    size_t bodylen_limit;
     size_t nbatches;
     size_t nops;
     size_t bench_secs;
+    size_t warmup_secs;
     struct rndinfo batch_dist;
     struct rndinfo rbatchsize;
     struct rndinfo wbatchsize;
@@ -91,15 +138,30 @@ struct bench_info {
     // percentage
     size_t write_prob;
     size_t compact_thres;
+    size_t miss_prob;
 
     // synchronous write
     uint8_t sync_write;
+    uint8_t group_commit;
+    size_t group_commit_max; // max writers per commit (0: no limit)
+    uint8_t read_ref; // read values in place (couchstore_open_document_ref)
+
+    // handle ownership of bench threads
+    uint8_t handle_mode;
+    size_t handle_pool_size;
 };
 
+#define HANDLE_PER_THREAD (0)
+#define HANDLE_SHARED (1)
+#define HANDLE_POOL (2)
+
 #define MIN(a,b) (((a)<(b))?(a):(b))
 
+// DB module in use (linked in, or loaded at runtime by the multi-engine binary)
+static struct couch_engine *engine = NULL;
 static uint32_t rnd_seed;
 FILE *log_fp = NULL;
+FILE *stats_fp = NULL; // engine statistics time series
 #define lprintf(...) {   \
     printf(__VA_ARGS__); \
     if (log_fp) fprintf(log_fp, __VA_ARGS__); } \
@@ -161,10 +223,10 @@ int empty_callback(Db *db, DocInfo *docinfo, void *ctx)
     return 0;
 }
 
-#define MAX_KEYLEN (4096)
+#define MAX_KEYLEN KEYGEN_MAX_KEYLEN
 void _create_doc(struct bench_info *binfo, size_t idx, Doc **pdoc, DocInfo **pinfo)
 {
-    int r;
+    int64_t r;
     uint32_t crc;
     Doc *doc = *pdoc;
     DocInfo *info = *pinfo;
@@ -177,6 +239,7 @@ void _create_doc(struct bench_info *binfo, size_t idx, Doc **pdoc, DocInfo **pin
         doc = (Doc *)malloc(sizeof(Doc));
         doc->id.buf = NULL;
         doc->data.buf = NULL;
+        doc->data.size = 0;
     }
 
     doc->id.size = keygen_seed2key(&binfo->keygen, idx, keybuf);
@@ -188,21 +251,18 @@ void _create_doc(struct bench_info *binfo, size_t idx, Doc **pdoc, DocInfo **pin
     BDR_RNG_NEXTPAIR;
     r = get_random(&binfo->bodylen, rngz, rngz2);
     if (r < 8) r = 8;
+    if (r > (int64_t)binfo->bodylen_limit) r = binfo->bodylen_limit;
 
-    doc->data.size = r;
-    // align to 8 bytes (sizeof(uint64_t))
-    doc->data.size = (size_t)((doc->data.size+1) / (sizeof(uint64_t)*1)) *
-                     (sizeof(uint64_t)*1);
-    if (!doc->data.buf) {
-        int max_bodylen;
-        if (binfo->bodylen.type == RND_NORMAL) {
-            max_bodylen = binfo->bodylen.a + binfo->bodylen.b * 6;
-        } else {
-            // uniform
-            max_bodylen = binfo->bodylen.b + 16;
-        }
-        doc->data.buf = (char *)malloc(max_bodylen);
+    if (binfo->bodylen.type == RND_NORMAL ||
+        binfo->bodylen.type == RND_UNIFORM) {
+        // align to 8 bytes (sizeof(uint64_t))
+        r = (size_t)((r+1) / (sizeof(uint64_t)*1)) * (sizeof(uint64_t)*1);
+    }
+    // body buffer is reused by the caller; enlarge it only when needed
+    if (!doc->data.buf || (size_t)r > doc->data.size) {
+        doc->data.buf = (char *)realloc(doc->data.buf, r);
     }
+    doc->data.size = r;
     memset(doc->data.buf, 'x', doc->data.size);
     memcpy(doc->data.buf + doc->data.size - 5, (void*)"<end>", 5);
     snprintf(doc->data.buf, doc->data.size,
@@ -222,10 +282,41 @@ void _create_doc(struct bench_info *binfo, size_t idx, Doc **pdoc, DocInfo **pin
     *pinfo = info;
 }
 
+// a batch of generated documents waiting to be written into a file
+struct pop_batch {
+    int file;
+    size_t begin; // doc index of docs[0]
+    size_t n;
+    Doc **docs;
+    DocInfo **infos;
+    struct pop_batch *next;
+};
+
+struct pop_file {
+    size_t next; // next doc index to be generated
+    size_t end;
+    size_t wnext; // next doc index to be written (if 'ordered')
+    size_t remain; // # docs not written yet
+    int writing; // a thread is writing into this file
+    struct pop_batch *head;
+    struct pop_batch *tail;
+};
+
+// shared by all population threads (protected by 'lock')
+struct pop_queue {
+    mutex_t lock;
+    thread_cond_t cond;
+    struct pop_file *files;
+    struct pop_batch *free_batches;
+    int ordered; // write each file's batches in doc index order
+    uint64_t nsteals; // # key ranges generated for other threads' home files
+};
+
 struct pop_thread_args {
     int n;
     Db **db;
     struct bench_info *binfo;
+    struct pop_queue *queue;
     spin_t *lock;
     uint64_t *counter;
     struct stopwatch *sw;
@@ -239,62 +330,148 @@ struct pop_thread_args {
 #define GET_FILE_NO(ndocs, nfiles, idx) \
     ((idx) / ( ((ndocs) + (nfiles-1)) / (nfiles)))
 
-void * pop_thread(void *voidargs)
+// the head batch of the file can be written now
+static int _pop_ready(struct pop_queue *q, struct pop_file *f)
 {
-    int i, k, c, n;
-    uint64_t counter;
-    struct pop_thread_args *args = (struct pop_thread_args *)voidargs;
-    struct bench_info *binfo = args->binfo;
-    size_t batchsize = args->binfo->pop_batchsize;
-    Db *db;
-    Doc **docs;
-    DocInfo **infos;
+    if (!f->head) return 0;
+    return !q->ordered || f->head->begin == f->wnext;
+}
+
+// queue a generated batch; batches are kept sorted by doc index so that
+// sequential/reverse key orders reach the file in order
+static void _pop_enqueue(struct pop_file *f, struct pop_batch *b)
+{
+    struct pop_batch **pp = &f->head;
 
-    docs = (Doc**)calloc(batchsize, sizeof(Doc*));
-    infos = (DocInfo**)calloc(batchsize, sizeof(DocInfo*));
-    for (i=0;i<batchsize;++i) {
-        docs[i] = NULL;
-        infos[i] = NULL;
-        _create_doc(binfo, i, &docs[i], &infos[i]);
+    while (*pp && (*pp)->begin < b->begin) {
+        pp = &(*pp)->next;
     }
+    b->next = *pp;
+    *pp = b;
+    if (!b->next) f->tail = b;
+}
 
-    for (k=args->n; k<binfo->nfiles; k+=binfo->pop_nthreads) {
-        db = args->db[k];
-        SET_DOC_RANGE(binfo->ndocs, binfo->nfiles, k, c, n);
+// file that has generated batches but no writer (starting from 'home')
+static int _pop_find_write(struct pop_queue *q, size_t nfiles, int home)
+{
+    size_t i;
+    int k;
+    for (i=0;i<nfiles;++i){
+        k = (home + i) % nfiles;
+        if (_pop_ready(q, &q->files[k]) && !q->files[k].writing) return k;
+    }
+    return -1;
+}
 
-        while(c < n) {
-            counter = 0;
-            for (i=c; (i<c+batchsize && i<n); ++i){
-                _create_doc(binfo, i, &docs[i-c], &infos[i-c]);
-                counter++;
-            }
-            spin_lock(args->lock);
-            *(args->counter) += counter;
-            spin_unlock(args->lock);
+// file that still has docs to be generated (starting from 'home')
+static int _pop_find_range(struct pop_queue *q, size_t nfiles, int home)
+{
+    size_t i;
+    int k;
+    for (i=0;i<nfiles;++i){
+        k = (home + i) % nfiles;
+        if (q->files[k].next < q->files[k].end) return k;
+    }
+    return -1;
+}
 
-            couchstore_save_documents(db, docs, infos, i-c, 0x0);
-            if (binfo->pop_commit) {
-                couchstore_commit(db);
+// Each thread either writes (drains the batch queue of a file that has no
+// writer) or generates (fills a free batch with the next key range of a
+// file and queues it). At most one thread writes into a file at a time,
+// while any number of threads can generate documents for the same file.
+// With sequential or reverse key order, a file's batches are written in doc
+// index order: a batch generated ahead of its predecessor waits in the
+// queue until the predecessor has been written.
+// Threads start from their home file and take over other files' key ranges
+// and queued batches when they run out of work.
+void * pop_thread(void *voidargs)
+{
+    int k, home;
+    size_t i, begin, end;
+    struct pop_thread_args *args = (struct pop_thread_args *)voidargs;
+    struct bench_info *binfo = args->binfo;
+    struct pop_queue *q = args->queue;
+    struct pop_file *f;
+    struct pop_batch *b;
+    size_t batchsize = binfo->pop_batchsize;
+
+    home = args->n % binfo->nfiles;
+
+    mutex_lock(&q->lock);
+    while (1) {
+        // write
+        k = _pop_find_write(q, binfo->nfiles, home);
+        if (k >= 0) {
+            f = &q->files[k];
+            f->writing = 1;
+            while (_pop_ready(q, f)) {
+                b = f->head;
+                f->head = b->next;
+                if (!f->head) f->tail = NULL;
+                f->wnext = b->begin + b->n;
+                mutex_unlock(&q->lock);
+
+                couchstore_save_documents(args->db[k], b->docs, b->infos, b->n, 0x0);
+                if (binfo->pop_commit) {
+                    couchstore_commit(args->db[k]);
+                }
+                spin_lock(args->lock);
+                *(args->counter) += b->n;
+                spin_unlock(args->lock);
+
+                mutex_lock(&q->lock);
+                f->remain -= b->n;
+                b->next = q->free_batches;
+                q->free_batches = b;
+                thread_cond_broadcast(&q->cond);
             }
-            c = i;
-        }
-        if (!binfo->pop_commit) {
-            couchstore_commit(db);
+            if (f->remain == 0 && !binfo->pop_commit) {
+                // the last batch of the file has been written
+                mutex_unlock(&q->lock);
+                couchstore_commit(args->db[k]);
+                mutex_lock(&q->lock);
+            }
+            f->writing = 0;
+            thread_cond_broadcast(&q->cond);
+            continue;
         }
 
-    }
+        // generate
+        k = _pop_find_range(q, binfo->nfiles, home);
+        if (k >= 0 && q->free_batches) {
+            f = &q->files[k];
+            b = q->free_batches;
+            q->free_batches = b->next;
+            begin = f->next;
+            end = MIN(begin + batchsize, f->end);
+            f->next = end;
+            if (k != home) q->nsteals++;
+            mutex_unlock(&q->lock);
+
+            for (i=begin;i<end;++i){
+                _create_doc(binfo, i, &b->docs[i-begin], &b->infos[i-begin]);
+            }
+            b->file = k;
+            b->begin = begin;
+            b->n = end - begin;
+
+            mutex_lock(&q->lock);
+            _pop_enqueue(f, b);
+            thread_cond_broadcast(&q->cond);
+            continue;
+        }
 
-    for (i=0;i<batchsize;++i){
-        if (docs[i]) {
-            if (docs[i]->id.buf) free(docs[i]->id.buf);
-            if (docs[i]->data.buf) free(docs[i]->data.buf);
-            free(docs[i]);
+        if (k < 0) {
+            // all ranges are generated; done when all files are written
+            for (i=0;i<binfo->nfiles;++i){
+                if (q->files[i].remain) break;
+            }
+            if (i == binfo->nfiles) break;
         }
-        if (infos[i]) free(infos[i]);
+        thread_cond_wait(&q->cond, &q->lock);
     }
+    mutex_unlock(&q->lock);
 
-    free(docs);
-    free(infos);
     thread_exit(0);
     return NULL;
 }
@@ -338,15 +515,40 @@ void * pop_print_time(void *voidargs)
 
 void population(Db **db, struct bench_info *binfo)
 {
-    int i;
+    size_t i, j, nbatches;
     thread_t tid[binfo->pop_nthreads+1];
     void *ret[binfo->pop_nthreads+1];
     struct pop_thread_args args[binfo->pop_nthreads + 1];
+    struct pop_queue queue;
+    struct pop_batch *batches;
     spin_t lock;
     uint64_t counter;
     struct stopwatch sw, sw_long;
     struct timeval tv;
 
+    // one batch being generated by each thread,
+    // and at most one more queued for each writer
+    nbatches = binfo->pop_nthreads + MIN(binfo->nfiles, binfo->pop_nthreads);
+    batches = (struct pop_batch *)calloc(nbatches, sizeof(struct pop_batch));
+    queue.free_batches = NULL;
+    for (i=0;i<nbatches;++i){
+        batches[i].docs = (Doc**)calloc(binfo->pop_batchsize, sizeof(Doc*));
+        batches[i].infos = (DocInfo**)calloc(binfo->pop_batchsize, sizeof(DocInfo*));
+        batches[i].next = queue.free_batches;
+        queue.free_batches = &batches[i];
+    }
+    queue.files = (struct pop_file *)calloc(binfo->nfiles, sizeof(struct pop_file));
+    for (i=0;i<binfo->nfiles;++i){
+        SET_DOC_RANGE(binfo->ndocs, binfo->nfiles, i,
+                      queue.files[i].next, queue.files[i].end);
+        queue.files[i].remain = queue.files[i].end - queue.files[i].next;
+        queue.files[i].wnext = queue.files[i].next;
+    }
+    queue.ordered = (binfo->key_order != KEYGEN_HASHED);
+    queue.nsteals = 0;
+    mutex_init(&queue.lock);
+    thread_cond_init(&queue.cond);
+
     spin_init(&lock);
     stopwatch_init(&sw);
     stopwatch_start(&sw);
@@ -358,14 +560,17 @@ void population(Db **db, struct bench_info *binfo)
         args[i].n = i;
         args[i].db = db;
         args[i].binfo = binfo;
+        args[i].queue = &queue;
         args[i].lock = &lock;
         args[i].sw = &sw;
         args[i].sw_long = &sw_long;
         args[i].counter = &counter;
         if (i<binfo->pop_nthreads) {
-            thread_create(&tid[i], pop_thread, &args[i]);
+            affinity_thread_create(&binfo->affinity, i,
+                                   &tid[i], pop_thread, &args[i]);
         } else {
-            thread_create(&tid[i], pop_print_time, &args[i]);
+            affinity_thread_create(&binfo->affinity, i,
+                                   &tid[i], pop_print_time, &args[i]);
         }
     }
 
@@ -380,7 +585,27 @@ void population(Db **db, struct bench_info *binfo)
     printf("%"_F64" / %"_F64, counter, (uint64_t)binfo->ndocs);
     printf(" (%d %%)", 100);
     printf(" (-%d s)\n", 0);
+    if (queue.nsteals) {
+        printf("%"_F64" batches generated for other files\n", queue.nsteals);
+    }
     fflush(stdout);
+
+    for (i=0;i<nbatches;++i){
+        for (j=0;j<binfo->pop_batchsize;++j){
+            if (batches[i].docs[j]) {
+                free(batches[i].docs[j]->id.buf);
+                free(batches[i].docs[j]->data.buf);
+                free(batches[i].docs[j]);
+            }
+            if (batches[i].infos[j]) free(batches[i].infos[j]);
+        }
+        free(batches[i].docs);
+        free(batches[i].infos);
+    }
+    free(batches);
+    free(queue.files);
+    thread_cond_destroy(&queue.cond);
+    mutex_destroy(&queue.lock);
 }
 
 #if defined(__linux) && !defined(__ANDROID__)
@@ -553,21 +778,430 @@ void _bench_result_free(struct bench_result *result)
 #define _bench_result_free(a)
 #endif
 
-#define OP_CLOSE (0x01)
-#define OP_CLOSE_OK (0x02)
-#define OP_REOPEN (0x04)
+uint64_t _get_now_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return _timeval_to_us(tv);
+}
+
+// waiting for another thread: spin first (it is usually only a moment
+// behind), then yield, then sleep. usleep(1) alone oversleeps by the
+// timer slack (~50 us) on every call. '*n' is reset when the wait is over.
+#define BACKOFF_SPINS (128)
+#define BACKOFF_SLEEP_US (20)
+void _backoff(int *n)
+{
+    if (*n < BACKOFF_SPINS) {
+        __sync_synchronize();
+    } else if (*n < BACKOFF_SPINS * 2) {
+        sched_yield();
+    } else {
+        usleep(BACKOFF_SLEEP_US);
+    }
+    (*n)++;
+}
+
+// Couchstore cannot write into a file while it is being compacted, so
+// writers park between batches until the compaction is done:
+// - do_bench() raises 'requested' and waits until all writers are parked,
+// - the compactor clears it and bumps 'file_epoch' when the new file is
+//   ready,
+// - every bench thread reopens its handles when 'file_epoch' changes.
+// 'requested' and 'file_epoch' are read without the lock only as hints;
+// all decisions are made under the lock.
+struct quiesce_record {
+    uint64_t drain_us; // until all writers are parked
+    uint64_t pause_us; // until writers are resumed
+};
+
+struct quiesce {
+    mutex_t lock;
+    thread_cond_t cond;
+    volatile int requested;
+    volatile uint32_t file_epoch;
+    int nwriters;
+    int nparked;
+    uint64_t begin_us;
+    uint64_t drain_us;
+    // one record per compaction
+    size_t nrecords;
+    struct quiesce_record *records;
+};
+
+void _quiesce_init(struct quiesce *q, int nwriters)
+{
+    mutex_init(&q->lock);
+    thread_cond_init(&q->cond);
+    q->requested = 0;
+    q->file_epoch = 0;
+    q->nwriters = nwriters;
+    q->nparked = 0;
+    q->nrecords = 0;
+    q->records = NULL;
+}
+
+void _quiesce_free(struct quiesce *q)
+{
+    free(q->records);
+    thread_cond_destroy(&q->cond);
+    mutex_destroy(&q->lock);
+}
+
+// called by do_bench(): returns when no writer is in a batch
+void _quiesce_request(struct quiesce *q)
+{
+    mutex_lock(&q->lock);
+    q->begin_us = _get_now_us();
+    q->requested = 1;
+    while (q->nparked < q->nwriters) {
+        thread_cond_wait(&q->cond, &q->lock);
+    }
+    q->drain_us = _get_now_us() - q->begin_us;
+    mutex_unlock(&q->lock);
+}
+
+// called by the compactor when the compacted file is ready
+void _quiesce_release(struct quiesce *q)
+{
+    mutex_lock(&q->lock);
+    q->records = (struct quiesce_record *)
+                 realloc(q->records, sizeof(struct quiesce_record) * (q->nrecords+1));
+    q->records[q->nrecords].drain_us = q->drain_us;
+    q->records[q->nrecords].pause_us = _get_now_us() - q->begin_us;
+    q->nrecords++;
+    q->file_epoch++;
+    q->requested = 0;
+    thread_cond_broadcast(&q->cond);
+    mutex_unlock(&q->lock);
+}
+
+// called by writers between batches
+void _quiesce_park(struct quiesce *q)
+{
+    mutex_lock(&q->lock);
+    if (q->requested) {
+        q->nparked++;
+        thread_cond_broadcast(&q->cond);
+        while (q->requested) {
+            thread_cond_wait(&q->cond, &q->lock);
+        }
+        q->nparked--;
+    }
+    mutex_unlock(&q->lock);
+}
+
+// called by writers before blocking on a queue: counted as parked until
+// _quiesce_idle_end(), so a compaction does not wait for the next arrival
+void _quiesce_idle_begin(struct quiesce *q)
+{
+    mutex_lock(&q->lock);
+    q->nparked++;
+    thread_cond_broadcast(&q->cond);
+    mutex_unlock(&q->lock);
+}
+
+// returns when the writer may start a batch (after a compaction in progress)
+void _quiesce_idle_end(struct quiesce *q)
+{
+    mutex_lock(&q->lock);
+    while (q->requested) {
+        thread_cond_wait(&q->cond, &q->lock);
+    }
+    q->nparked--;
+    mutex_unlock(&q->lock);
+}
+
+// true if the files were compacted since 'epoch' (and update 'epoch')
+int _quiesce_reopen_needed(struct quiesce *q, uint32_t *epoch)
+{
+    int ret = 0;
+
+    if (*epoch == q->file_epoch) return 0;
+    mutex_lock(&q->lock);
+    if (*epoch != q->file_epoch) {
+        *epoch = q->file_epoch;
+        ret = 1;
+    }
+    mutex_unlock(&q->lock);
+    return ret;
+}
+
+void _reopen_handle(struct bench_info *binfo, Db **db, int file_no,
+                    int *compaction_no)
+{
+    char curfile[256];
+
+    couchstore_close_db(*db);
+    sprintf(curfile, "%s%d.%d", binfo->filename, file_no, compaction_no[file_no]);
+    couchstore_open_db(curfile, 0x0, db);
+}
+
+void _reopen_handles(struct bench_info *binfo, Db **db, int *compaction_no)
+{
+    size_t i;
+
+    for (i=0;i<binfo->nfiles;++i) {
+        _reopen_handle(binfo, &db[i], i, compaction_no);
+    }
+}
+
+// Group commit (group_commit = on): a writer hands its documents for a file
+// to the file's coordinator and waits. A writer finding no leader becomes
+// the leader: it takes all pending requests, writes them through the
+// coordinator's handle with a single commit and wakes their writers, until
+// its own request is done. Requests queued while a commit is in flight
+// form the next group, so the group size adapts to the commit latency.
+#define GC_HIST_NBUCKETS (8) // 1, 2-3, 4-7, ..., 128+ writers per commit
+
+struct gc_request {
+    Doc **docs;
+    DocInfo **infos;
+    size_t n;
+    int done;
+    struct gc_request *next;
+};
+
+struct group_commit {
+    int file_no;
+    Db *db;
+    uint32_t file_epoch; // see struct quiesce
+    struct bench_info *binfo;
+    int *compaction_no;
+    struct quiesce *quiesce;
+    mutex_t lock;
+    thread_cond_t cond;
+    int leader;
+    struct gc_request *head, *tail;
+    // documents of the current group (leader only)
+    Doc **docs;
+    DocInfo **infos;
+    size_t capacity;
+    // stats (leader only)
+    uint64_t ncommits;
+    uint64_t nrequests;
+    uint64_t ndocs;
+    uint64_t hist[GC_HIST_NBUCKETS];
+    struct latency_stat lat_commit;
+};
+
+void _gc_init(struct group_commit *gc, struct bench_info *binfo, int file_no,
+              Db *db, int *compaction_no, struct quiesce *q)
+{
+    memset(gc, 0, sizeof(struct group_commit));
+    gc->file_no = file_no;
+    gc->db = db;
+    gc->file_epoch = q->file_epoch;
+    gc->binfo = binfo;
+    gc->compaction_no = compaction_no;
+    gc->quiesce = q;
+    mutex_init(&gc->lock);
+    thread_cond_init(&gc->cond);
+    latency_init(&gc->lat_commit);
+}
+
+void _gc_free(struct group_commit *gc)
+{
+    free(gc->docs);
+    free(gc->infos);
+    thread_cond_destroy(&gc->cond);
+    mutex_destroy(&gc->lock);
+}
+
+// write and commit 'n' documents gathered from a group
+void _gc_commit(struct group_commit *gc, size_t n)
+{
+    uint64_t begin;
+
+    if (_quiesce_reopen_needed(gc->quiesce, &gc->file_epoch)) {
+        _reopen_handle(gc->binfo, &gc->db, gc->file_no, gc->compaction_no);
+    }
+
+    begin = _get_now_us();
+    couchstore_save_documents(gc->db, gc->docs, gc->infos, n, 0x0);
+    couchstore_commit(gc->db);
+    latency_add(&gc->lat_commit, _get_now_us() - begin);
+}
+
+// returns when 'docs' are committed (by this thread or by another leader)
+void _gc_submit(struct group_commit *gc, Doc **docs, DocInfo **infos, size_t n)
+{
+    int b;
+    size_t i, nreq, ndocs, max = gc->binfo->group_commit_max;
+    struct gc_request req, *first, *r;
+
+    req.docs = docs;
+    req.infos = infos;
+    req.n = n;
+    req.done = 0;
+    req.next = NULL;
+
+    mutex_lock(&gc->lock);
+    if (gc->tail) {
+        gc->tail->next = &req;
+    } else {
+        gc->head = &req;
+    }
+    gc->tail = &req;
+
+    while (!req.done && gc->leader) {
+        thread_cond_wait(&gc->cond, &gc->lock);
+    }
+
+    if (!req.done) {
+        gc->leader = 1;
+        while (!req.done) {
+            // take the pending requests as a group
+            first = gc->head;
+            nreq = ndocs = 0;
+            for (r = first; r && (max == 0 || nreq < max); r = r->next) {
+                nreq++;
+                ndocs += r->n;
+            }
+            gc->head = r;
+            if (!gc->head) gc->tail = NULL;
+            mutex_unlock(&gc->lock);
+
+            if (ndocs > gc->capacity) {
+                gc->capacity = ndocs;
+                gc->docs = (Doc **)realloc(gc->docs, sizeof(Doc*) * ndocs);
+                gc->infos = (DocInfo **)realloc(gc->infos, sizeof(DocInfo*) * ndocs);
+            }
+            ndocs = 0;
+            for (r = first, i = 0; i < nreq; r = r->next, ++i) {
+                memcpy(gc->docs + ndocs, r->docs, sizeof(Doc*) * r->n);
+                memcpy(gc->infos + ndocs, r->infos, sizeof(DocInfo*) * r->n);
+                ndocs += r->n;
+            }
+            _gc_commit(gc, ndocs);
+
+            gc->ncommits++;
+            gc->nrequests += nreq;
+            gc->ndocs += ndocs;
+            for (b = 0; b < GC_HIST_NBUCKETS-1 && (nreq >> (b+1)); ++b);
+            gc->hist[b]++;
+
+            // waiters read 'done' under the lock, so their requests
+            // (on their stacks) stay valid until it is released
+            mutex_lock(&gc->lock);
+            for (r = first, i = 0; i < nreq; r = r->next, ++i) {
+                r->done = 1;
+            }
+            thread_cond_broadcast(&gc->cond);
+        }
+        // hand over to a waiting writer, if any
+        gc->leader = 0;
+        thread_cond_broadcast(&gc->cond);
+    }
+    mutex_unlock(&gc->lock);
+}
+
+// Handle sets shared by bench threads (handles = shared or pool). A thread
+// takes a set for the duration of a batch; if 'exclusive', no other thread
+// uses the set in the meantime.
+struct handle_pool {
+    int nslots;
+    int exclusive;
+    Db ***db; // [slot][file]
+    uint32_t *file_epoch; // see struct quiesce
+    int *free_slots;
+    int nfree;
+    mutex_t lock;
+    thread_cond_t cond;
+};
+
+// returns slot number; 'wait_us' is non-zero if all sets were in use
+int _handle_pool_get(struct handle_pool *pool, uint64_t *wait_us)
+{
+    int slot;
+    uint64_t begin;
+
+    *wait_us = 0;
+    if (!pool->exclusive) return 0;
+
+    mutex_lock(&pool->lock);
+    if (pool->nfree == 0) {
+        begin = _get_now_us();
+        while (pool->nfree == 0) {
+            thread_cond_wait(&pool->cond, &pool->lock);
+        }
+        *wait_us = MAX(_get_now_us() - begin, 1);
+    }
+    slot = pool->free_slots[--pool->nfree];
+    mutex_unlock(&pool->lock);
+    return slot;
+}
+
+void _handle_pool_put(struct handle_pool *pool, int slot)
+{
+    if (!pool->exclusive) return;
+
+    mutex_lock(&pool->lock);
+    pool->free_slots[pool->nfree++] = slot;
+    thread_cond_signal(&pool->cond);
+    mutex_unlock(&pool->lock);
+}
+
+struct bench_shared_stat {
+    uint64_t op_count_read;
+    uint64_t op_count_miss;
+    uint64_t op_count_write;
+    uint64_t op_count_write_pinned;
+    uint64_t batch_count;
+    int snapshot_pinned; // # snapshots currently held
+    uint32_t rate_epoch; // incremented whenever the target rate changes
+    struct stopwatch sw_pinned; // runs while any snapshot is held
+    spin_t lock;
+};
+
+struct arrival_queue;
+struct pregen_ring;
+struct vclient_set;
 struct bench_thread_args {
     int id;
     Db **db;
-    int mode; // 0:reader+writer, 1:writer, 2:reader
+    int mode; // 0:reader+writer, 1:writer, 2:reader, 3:snapshot reader
     int *compaction_no;
     uint32_t rnd_seed;
     struct bench_info *binfo;
     struct bench_result *result;
     struct zipf_rnd *zipf;
     struct bench_shared_stat *b_stat;
+    struct latency_stat lat_read;
+    struct latency_stat lat_read_miss;
+    struct latency_stat lat_write;
+    struct latency_stat lat_write_pinned;
+    // part of the above that overlapped a checkpoint
+    struct latency_stat lat_read_ckpt;
+    struct latency_stat lat_write_ckpt;
+    // handles = shared or pool (db is NULL then)
+    struct handle_pool *pool;
+    uint64_t handle_waits;
+    uint64_t handle_wait_us;
+    uint64_t read_bytes;
+    // pre-generated write batches (writers only)
+    struct pregen_ring *ring;
+    // group commit coordinator of each file (writers only)
+    struct group_commit *gc;
+    // logical clients multiplexed on this thread
+    struct vclient_set *vclients;
+    // open-loop only
+    struct arrival_queue *queue;
+    struct latency_stat lat_queue;
+    struct latency_stat lat_response;
+    // odd while lat_read/lat_write/lat_response are being updated
+    // (see _lat_copy())
+    volatile uint32_t lat_seq;
+    // snapshot reader only
+    uint64_t scan_docs;
+    uint64_t scan_passes;
+    uint64_t scan_us;
+    uint64_t scan_growth; // largest DB growth over a snapshot hold
+    double scan_growth_ratio;
+    uint64_t scan_growth_us; // length of that hold
+    uint64_t scan_growth_writes; // docs written during that hold
+    struct quiesce *quiesce;
     uint8_t terminate_signal;
-    uint8_t op_signal;
 };
 
 struct compactor_args {
@@ -578,12 +1212,11 @@ struct compactor_args {
     struct bench_thread_args *b_args;
     int *cur_compaction;
     int bench_threads;
+    struct quiesce *quiesce;
     uint8_t flag;
     spin_t *lock;
 };
 
-#if defined(__FDB_BENCH) || defined(__COUCH_BENCH)
-
 void * compactor(void *voidargs)
 {
     struct compactor_args *args = (struct compactor_args*)voidargs;
@@ -606,23 +1239,19 @@ void * compactor(void *voidargs)
     spin_lock(args->lock);
     *(args->cur_compaction) = -1;
     if (args->flag & 0x1) {
-        int ret, i;
+        int ret;
         char cmd[256];
         // erase previous db file
         sprintf(cmd, "rm -rf %s 2> errorlog.txt", curfile);
         ret = system(cmd);
 
-        for (i=0; i<args->bench_threads; ++i) {
-            args->b_args[i].op_signal |= OP_REOPEN;
-        }
+        _quiesce_release(args->quiesce);
     }
     spin_unlock(args->lock);
 
     return NULL;
 }
 
-#endif
-
 void (*old_handler)(int);
 int got_signal = 0;
 void signal_handler_confirm(int sig_no)
@@ -686,106 +1315,959 @@ void _dir_scan(struct bench_info *binfo, int *compaction_no)
     }
 }
 
-struct bench_shared_stat {
-    uint64_t op_count_read;
-    uint64_t op_count_write;
-    uint64_t batch_count;
-    spin_t lock;
-};
-
-void * bench_thread(void *voidargs)
+// total size of all DB files (or directories) on disk
+uint64_t _get_path_size(char *path)
 {
-    struct bench_thread_args *args = (struct bench_thread_args *)voidargs;
-    int i, j;
-    int batchsize;
-    int write_mode, write_mode_r;
-    int commit_mask[args->binfo->nfiles];
-    int curfile_no, file_doccount[args->binfo->nfiles], c;
-    double prob, ratio;
-    char curfile[256], keybuf[MAX_KEYLEN];
-    uint64_t r, crc, op_med;
-    uint64_t op_w, op_r, op_w_cum, op_r_cum, op_w_turn, op_r_turn;
-    uint64_t expected_us, elapsed_us, elapsed_sec;
-    Db **db;
-    Doc *rq_doc, **rq_doc_arr[args->binfo->nfiles];
-    DocInfo *rq_info, **rq_info_arr[args->binfo->nfiles];
-    sized_buf rq_id;
-    struct rndinfo write_mode_random, op_dist;
-    struct bench_info *binfo = args->binfo;
-    struct bench_result *result = args->result;
-    struct zipf_rnd *zipf = args->zipf;
-    struct stopwatch sw;
-    struct timeval gap;
-    couchstore_error_t err;
-
-    // uint64_t *offset_arr = (uint64_t*)malloc(sizeof(uint64_t) * args->binfo->ndocs);
-
-    db = args->db;
+    uint64_t size = 0;
+    char subpath[1024];
+    struct stat st;
+    DIR *dir_info;
+    struct dirent *dir_entry;
 
-    op_med = op_w = op_r = op_w_cum = op_r_cum = 0;
-    elapsed_us = 0;
-    write_mode_random.type = RND_UNIFORM;
-    write_mode_random.a = 0;
-    write_mode_random.b = 256 * 256;
+    if (stat(path, &st) != 0) return 0;
+    if (!S_ISDIR(st.st_mode)) return st.st_size;
 
-    crc = args->rnd_seed;
-    crc = MurmurHash64A(&crc, sizeof(crc), 0);
-    BDR_RNG_VARS_SET(crc);
-    BDR_RNG_NEXTPAIR;
-    BDR_RNG_NEXTPAIR;
-    BDR_RNG_NEXTPAIR;
+    dir_info = opendir(path);
+    if (dir_info == NULL) return 0;
+    while ((dir_entry = readdir(dir_info))) {
+        if (!strcmp(dir_entry->d_name, ".") || !strcmp(dir_entry->d_name, "..")) {
+            continue;
+        }
+        sprintf(subpath, "%s/%s", path, dir_entry->d_name);
+        size += _get_path_size(subpath);
+    }
+    closedir(dir_info);
 
-    stopwatch_init_start(&sw);
+    return size;
+}
 
-    // calculate rw_factor and write probability
-    _get_rw_factor(binfo, &prob);
+uint64_t _get_dbsize(struct bench_info *binfo)
+{
+    int i, dirname_len = 0;
+    uint64_t size = 0;
+    char dirname[256], path[1024], *filename;
+    DIR *dir_info;
+    struct dirent *dir_entry;
 
-    while(!args->terminate_signal) {
-        if (args->op_signal & OP_CLOSE) {
-            args->op_signal |= OP_CLOSE_OK; // set ack flag
-            args->op_signal &= ~(OP_CLOSE); // clear flag
-            while (!(args->op_signal & OP_REOPEN)) {
-                usleep(10000); // couchstore cannot write during compaction
-            }
-            if (args->op_signal & OP_CLOSE) {
-                // compaction again
-                continue;
-            }
+    for (i=strlen(binfo->filename)-1; i>=0; --i){
+        if (binfo->filename[i] == '/') {
+            dirname_len = i+1;
+            break;
         }
-        if (args->op_signal & OP_REOPEN) {
-            for (i=0;i<args->binfo->nfiles;++i) {
-                couchstore_close_db(args->db[i]);
-                sprintf(curfile, "%s%d.%d", binfo->filename, i, args->compaction_no[i]);
-                couchstore_open_db(curfile, 0x0, &args->db[i]);
-            }
-            args->op_signal = 0;
+    }
+    if (dirname_len > 0) {
+        strncpy(dirname, binfo->filename, dirname_len);
+        dirname[dirname_len] = 0;
+    } else {
+        strcpy(dirname, "./");
+    }
+    filename = binfo->filename + dirname_len;
+
+    dir_info = opendir(dirname);
+    if (dir_info == NULL) return 0;
+    while ((dir_entry = readdir(dir_info))) {
+        if (!strncmp(dir_entry->d_name, filename, strlen(filename))) {
+            sprintf(path, "%s%s", dirname, dir_entry->d_name);
+            size += _get_path_size(path);
         }
-        gap = stopwatch_get_curtime(&sw);
-        elapsed_us = _timeval_to_us(gap);
-        if (elapsed_us == 0) elapsed_us = 1;
-        elapsed_sec = elapsed_us / 1000000;
+    }
+    closedir(dir_info);
 
-        spin_lock(&args->b_stat->lock);
-        op_w = args->b_stat->op_count_write;
-        op_r = args->b_stat->op_count_read;
-        spin_unlock(&args->b_stat->lock);
+    return size;
+}
 
-        BDR_RNG_NEXTPAIR;
-        switch(args->mode) {
-        case 0: // reader+writer
-            // decide write or read
-            write_mode_r = get_random(&write_mode_random, rngz, rngz2);
-            write_mode = ( (prob * 65536.0) > write_mode_r);
-            break;
+// a read or write batch request for open-loop load generation
+struct arrival {
+    uint64_t time_us; // scheduled arrival time
+    uint8_t write; // 0: read, 1: write, 2: not specified (trace only)
+};
+
+// bounded request queue of a worker thread
+struct arrival_queue {
+    struct arrival *buf;
+    size_t capacity;
+    uint64_t head; // # dequeued
+    uint64_t tail; // # enqueued
+    uint64_t len_sum; // queue length seen by each arrival
+    uint64_t len_max;
+    uint8_t closed;
+    mutex_t lock;
+    thread_cond_t cond;
+};
+
+void _arrival_queue_init(struct arrival_queue *q, size_t capacity)
+{
+    q->buf = (struct arrival *)malloc(sizeof(struct arrival) * capacity);
+    q->capacity = capacity;
+    q->head = q->tail = 0;
+    q->len_sum = q->len_max = 0;
+    q->closed = 0;
+    mutex_init(&q->lock);
+    thread_cond_init(&q->cond);
+}
+
+void _arrival_queue_free(struct arrival_queue *q)
+{
+    mutex_destroy(&q->lock);
+    thread_cond_destroy(&q->cond);
+    free(q->buf);
+}
+
+// returns -1 if the queue is full (i.e., the arrival is dropped)
+int _arrival_queue_push(struct arrival_queue *q, struct arrival *a)
+{
+    uint64_t len;
+
+    mutex_lock(&q->lock);
+    len = q->tail - q->head;
+    q->len_sum += len;
+    if (len > q->len_max) q->len_max = len;
+    if (len >= q->capacity) {
+        mutex_unlock(&q->lock);
+        return -1;
+    }
+    q->buf[q->tail % q->capacity] = *a;
+    q->tail++;
+    thread_cond_signal(&q->cond);
+    mutex_unlock(&q->lock);
+
+    return 0;
+}
+
+// blocks until an arrival is available; returns -1 once the queue is closed.
+// A writer ('quiesce' != NULL) waiting for an empty queue counts as parked.
+int _arrival_queue_pop(struct arrival_queue *q, struct arrival *a,
+                       struct quiesce *quiesce)
+{
+    int ret = 0, idle = 0;
+
+    if (quiesce && q->head == q->tail) {
+        _quiesce_idle_begin(quiesce);
+        idle = 1;
+    }
+    mutex_lock(&q->lock);
+    while (q->head == q->tail && !q->closed) {
+        thread_cond_wait(&q->cond, &q->lock);
+    }
+    if (q->closed) {
+        ret = -1;
+    } else {
+        *a = q->buf[q->head % q->capacity];
+        q->head++;
+    }
+    mutex_unlock(&q->lock);
+    if (idle) {
+        _quiesce_idle_end(quiesce);
+    }
+
+    return ret;
+}
+
+void _arrival_queue_close(struct arrival_queue *q)
+{
+    mutex_lock(&q->lock);
+    q->closed = 1;
+    thread_cond_broadcast(&q->cond);
+    mutex_unlock(&q->lock);
+}
+
+/*
+ * Trace file format (one arrival per line, '#' for comments):
+ *   <time in seconds> [r|w]
+ * Times are relative to the beginning of the benchmark. The trace is
+ * replayed repeatedly until the benchmark ends.
+ */
+size_t _load_arrival_trace(char *filename, struct arrival **trace)
+{
+    size_t n = 0, cap = 1024;
+    int ret;
+    char line[256], op;
+    double time_sec;
+    uint64_t prev_us = 0;
+    FILE *fp;
+
+    fp = fopen(filename, "r");
+    if (!fp) return 0;
+
+    *trace = (struct arrival *)malloc(sizeof(struct arrival) * cap);
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == '#') continue;
+        op = 0;
+        ret = sscanf(line, "%lf %c", &time_sec, &op);
+        if (ret < 1 || time_sec < 0) continue;
+
+        if (n == cap) {
+            cap *= 2;
+            *trace = (struct arrival *)realloc(*trace, sizeof(struct arrival) * cap);
+        }
+        (*trace)[n].time_us = (uint64_t)(time_sec * 1000000);
+        if ((*trace)[n].time_us < prev_us) continue; // not sorted
+        if (op == 'w' || op == 'W') {
+            (*trace)[n].write = 1;
+        } else if (op == 'r' || op == 'R') {
+            (*trace)[n].write = 0;
+        } else {
+            (*trace)[n].write = 2;
+        }
+        prev_us = (*trace)[n].time_us;
+        n++;
+    }
+    fclose(fp);
+
+    if (n == 0) {
+        free(*trace);
+        *trace = NULL;
+    }
+    return n;
+}
+
+// checkpoints are recorded by one thread: the sequence number is odd while
+// a checkpoint is running, so an operation overlapped one if the number was
+// odd when it started or changed before it ended
+static volatile uint32_t ckpt_seq = 0;
+#define CKPT_POLL_US (10000)
+
+static inline int _ckpt_overlap(uint32_t seq)
+{
+    return (seq & 1) || seq != ckpt_seq;
+}
+
+struct checkpoint_args {
+    struct bench_info *binfo;
+    uint64_t *begin_us;
+    uint64_t *end_us;
+    int n;
+    int size;
+    uint8_t terminate_signal;
+};
+
+void _checkpoint_mark(struct checkpoint_args *args, int begin)
+{
+    if (begin) {
+        if (args->n == args->size) {
+            args->size = (args->size)?(args->size * 2):(64);
+            args->begin_us = (uint64_t*)
+                realloc(args->begin_us, sizeof(uint64_t) * args->size);
+            args->end_us = (uint64_t*)
+                realloc(args->end_us, sizeof(uint64_t) * args->size);
+        }
+        args->begin_us[args->n] = _get_now_us();
+    } else {
+        args->end_us[args->n++] = _get_now_us();
+    }
+    ckpt_seq++;
+}
+
+// manual policy: runs a checkpoint 'ckpt_value' seconds after the previous
+// one ended; otherwise watches the checkpoints the engine starts by itself
+void * checkpointer(void *voidargs)
+{
+    struct checkpoint_args *args = (struct checkpoint_args *)voidargs;
+    struct bench_info *binfo = args->binfo;
+    uint64_t next_us = _get_now_us() + binfo->ckpt_value * 1000000;
+    int running;
+
+    while (!args->terminate_signal) {
+        if (binfo->ckpt_policy == ENGINE_CKPT_MANUAL) {
+            if (_get_now_us() >= next_us) {
+                _checkpoint_mark(args, 1);
+                if (engine->checkpoint() != COUCHSTORE_SUCCESS) {
+                    printf("checkpoint failed\n");
+                }
+                _checkpoint_mark(args, 0);
+                next_us = _get_now_us() + binfo->ckpt_value * 1000000;
+            }
+        } else {
+            running = engine->checkpoint_running();
+            if (running != (int)(ckpt_seq & 1)) {
+                _checkpoint_mark(args, running);
+            }
+        }
+        usleep(CKPT_POLL_US);
+    }
+    if (ckpt_seq & 1) {
+        // still running at the end of the benchmark
+        _checkpoint_mark(args, 0);
+    }
+
+    return NULL;
+}
+
+struct dispatcher_args {
+    struct bench_info *binfo;
+    struct bench_thread_args *b_args;
+    int bench_threads;
+    uint32_t rnd_seed;
+    struct arrival *trace;
+    size_t ntrace;
+    uint64_t narrivals;
+    uint64_t ndrops;
+    uint8_t terminate_signal;
+};
+
+// generates arrivals at the target rate regardless of how fast they are
+// served, and hands them over to the worker threads in round-robin order
+void * dispatcher(void *voidargs)
+{
+    struct dispatcher_args *args = (struct dispatcher_args *)voidargs;
+    struct bench_info *binfo = args->binfo;
+    struct bench_thread_args *b_args = args->b_args;
+    int i, nreaders = 0, nwriters = 0, r_turn = 0, w_turn = 0;
+    int readers[args->bench_threads], writers[args->bench_threads];
+    size_t trace_idx = 0;
+    uint64_t start_us, next_us, now_us, trace_base = 0, crc;
+    size_t rate; // may be changed by the search controller
+    double prob, u;
+    struct arrival a;
+    struct bench_thread_args *worker;
+
+    for (i=0;i<args->bench_threads;++i){
+        if (b_args[i].mode == 0 || b_args[i].mode == 2) {
+            readers[nreaders++] = i;
+        }
+        if (b_args[i].mode == 0 || b_args[i].mode == 1) {
+            writers[nwriters++] = i;
+        }
+    }
+
+    // probability of write batch
+    if (binfo->write_prob <= 100) {
+        _get_rw_factor(binfo, &prob);
+        if (prob > 1) prob = 1;
+    } else if (binfo->reader_ops + binfo->writer_ops > 0) {
+        prob = (double)binfo->writer_ops / (binfo->reader_ops + binfo->writer_ops);
+    } else {
+        prob = (double)nwriters / (nreaders + nwriters);
+    }
+
+    crc = args->rnd_seed;
+    crc = MurmurHash64A(&crc, sizeof(crc), 1);
+    BDR_RNG_VARS_SET(crc);
+    BDR_RNG_NEXTPAIR;
+
+    start_us = next_us = _get_now_us();
+    while (!args->terminate_signal) {
+        BDR_RNG_NEXTPAIR;
+        if (args->trace) {
+            if (trace_idx == args->ntrace) {
+                // replay from the beginning
+                trace_base += args->trace[args->ntrace-1].time_us +
+                              args->trace[args->ntrace-1].time_us / args->ntrace;
+                trace_idx = 0;
+            }
+            a = args->trace[trace_idx++];
+            next_us = start_us + trace_base + a.time_us;
+        } else {
+            // exponential inter-arrival time, u in (0, 1]
+            spin_lock(&b_args[0].b_stat->lock);
+            rate = binfo->arrival_rate;
+            spin_unlock(&b_args[0].b_stat->lock);
+            u = ((rngz >> 11) + 1) / 9007199254740992.0;
+            next_us += (uint64_t)(-log(u) * 1000000.0 / rate);
+            a.write = 2;
+        }
+        if (a.write == 2) {
+            a.write = ((rngz2 % 1000000) < prob * 1000000);
+        }
+        a.time_us = next_us;
+
+        now_us = _get_now_us();
+        while (next_us > now_us && !args->terminate_signal) {
+            usleep(MIN(next_us - now_us, 100000));
+            now_us = _get_now_us();
+        }
+        if (args->terminate_signal) break;
+
+        args->narrivals++;
+        if (a.write && nwriters) {
+            worker = &b_args[writers[w_turn]];
+            w_turn = (w_turn + 1) % nwriters;
+        } else if (!a.write && nreaders) {
+            worker = &b_args[readers[r_turn]];
+            r_turn = (r_turn + 1) % nreaders;
+        } else {
+            // no thread can serve this request
+            args->ndrops++;
+            continue;
+        }
+        if (_arrival_queue_push(worker->queue, &a) < 0) {
+            args->ndrops++;
+        }
+    }
+
+    return NULL;
+}
+
+// document number at the center of a batch
+uint64_t _get_op_med(struct bench_info *binfo, struct zipf_rnd_cursor *zipf,
+                     uint64_t rnd1, uint64_t rnd2)
+{
+    uint64_t op_med;
+
+    if (binfo->batch_dist.type == RND_UNIFORM) {
+        // uniform distribution
+        op_med = get_random(&binfo->batch_dist, rnd1, rnd2);
+    }else{
+        // zipfian distribution
+        op_med = zipf_rnd_get(zipf);
+        op_med = op_med * binfo->batch_dist.b + (rnd1 % binfo->batch_dist.b);
+    }
+    if (op_med >= binfo->ndocs) op_med = binfo->ndocs - 1;
+    return op_med;
+}
+
+// distribution of operations in a batch
+void _set_op_dist(struct bench_info *binfo, uint64_t op_med, struct rndinfo *op_dist)
+{
+    if (binfo->op_dist.type == RND_NORMAL){
+        op_dist->type = RND_NORMAL;
+        op_dist->a = op_med;
+        op_dist->b = binfo->batchrange/2;
+    }else {
+        op_dist->type = RND_UNIFORM;
+        op_dist->a = op_med - binfo->batchrange;
+        op_dist->b = op_med + binfo->batchrange;
+        if (op_dist->a < 0) op_dist->a = 0;
+        if (op_dist->b >= (int64_t)binfo->ndocs) op_dist->b = binfo->ndocs;
+    }
+}
+
+// a write batch grouped by file: docs of file i are in
+// [file_off[i], file_off[i+1]). Docs are kept and reused by the next batch.
+struct write_batch {
+    size_t n;
+    size_t capacity;
+    uint64_t *idx;
+    uint64_t *raw_idx;
+    Doc **docs;
+    DocInfo **infos;
+    size_t *file_off;
+};
+
+void _write_batch_init(struct write_batch *b, struct bench_info *binfo)
+{
+    memset(b, 0, sizeof(struct write_batch));
+    b->file_off = (size_t *)calloc(binfo->nfiles + 1, sizeof(size_t));
+}
+
+void _write_batch_free(struct write_batch *b)
+{
+    size_t j;
+
+    for (j=0;j<b->capacity;++j){
+        if (b->docs[j]) {
+            free(b->docs[j]->id.buf);
+            free(b->docs[j]->data.buf);
+            free(b->docs[j]);
+        }
+        free(b->infos[j]);
+    }
+    free(b->idx);
+    free(b->raw_idx);
+    free(b->docs);
+    free(b->infos);
+    free(b->file_off);
+}
+
+void _write_batch_reserve(struct write_batch *b, size_t n)
+{
+    size_t i;
+
+    if (n <= b->capacity) return;
+    b->idx = (uint64_t *)realloc(b->idx, sizeof(uint64_t) * n);
+    b->raw_idx = (uint64_t *)realloc(b->raw_idx, sizeof(uint64_t) * n);
+    b->docs = (Doc **)realloc(b->docs, sizeof(Doc*) * n);
+    b->infos = (DocInfo **)realloc(b->infos, sizeof(DocInfo*) * n);
+    for (i=b->capacity;i<n;++i){
+        b->docs[i] = NULL;
+        b->infos[i] = NULL;
+    }
+    b->capacity = n;
+}
+
+// group the 'n' documents picked in raw_idx[] by file, and create them
+void _write_batch_group(struct bench_info *binfo, struct write_batch *b, size_t n)
+{
+    size_t j, f;
+    uint64_t r;
+
+    memset(b->file_off, 0, sizeof(size_t) * (binfo->nfiles + 1));
+    for (j=0;j<n;++j){
+        b->file_off[GET_FILE_NO(binfo->ndocs, binfo->nfiles, b->raw_idx[j]) + 1]++;
+    }
+    for (f=0;f<binfo->nfiles;++f){
+        b->file_off[f+1] += b->file_off[f];
+    }
+    for (j=0;j<n;++j){
+        r = b->raw_idx[j];
+        f = GET_FILE_NO(binfo->ndocs, binfo->nfiles, r);
+        // file_off[f] is used as a cursor here, and restored below
+        b->idx[b->file_off[f]++] = r;
+    }
+    for (f=binfo->nfiles;f>0;--f){
+        b->file_off[f] = b->file_off[f-1];
+    }
+    b->file_off[0] = 0;
+
+    for (j=0;j<n;++j){
+        _create_doc(binfo, b->idx[j], &b->docs[j], &b->infos[j]);
+    }
+    b->n = n;
+}
+
+// single-producer (generator) single-consumer (bench thread) ring
+struct pregen_ring {
+    struct write_batch *slots;
+    size_t nslots;
+    volatile uint64_t head; // advanced by the generator only
+    volatile uint64_t tail; // advanced by the bench thread only
+    // random state of the generator for this bench thread
+    uint64_t rngx, rngy, rngz;
+    struct zipf_rnd_cursor zipf;
+    // generator side
+    uint64_t gen_us;
+    uint64_t gen_batches;
+    // bench thread side
+    uint64_t wait_us;
+    uint64_t nwaits;
+    uint64_t nbatches;
+};
+
+struct pregen_args {
+    struct bench_info *binfo;
+    struct pregen_ring **rings;
+    int nrings;
+    uint8_t terminate_signal;
+};
+
+void _pregen_ring_init(struct pregen_ring *ring, struct bench_info *binfo,
+                       struct zipf_rnd *zipf, uint64_t seed)
+{
+    size_t i;
+
+    ring->nslots = binfo->pregen_depth;
+    ring->slots = (struct write_batch *)
+                  malloc(sizeof(struct write_batch) * ring->nslots);
+    for (i=0;i<ring->nslots;++i){
+        _write_batch_init(&ring->slots[i], binfo);
+    }
+    ring->head = ring->tail = 0;
+
+    seed = MurmurHash64A(&seed, sizeof(seed), 0);
+    ring->rngx = seed;
+    ring->rngy = ring->rngx;
+    ring->rngy ^= ring->rngy << 16; ring->rngy ^= ring->rngy >> 5;
+    ring->rngy ^= ring->rngy << 1;
+    ring->rngz = ring->rngy;
+    ring->rngz ^= ring->rngz << 16; ring->rngz ^= ring->rngz >> 5;
+    ring->rngz ^= ring->rngz << 1;
+    if (binfo->batch_dist.type == RND_ZIPFIAN) {
+        zipf_rnd_cursor_init(&ring->zipf, zipf, seed);
+    }
+
+    ring->gen_us = ring->gen_batches = 0;
+    ring->wait_us = ring->nwaits = ring->nbatches = 0;
+}
+
+void _pregen_ring_free(struct pregen_ring *ring)
+{
+    size_t i;
+
+    for (i=0;i<ring->nslots;++i){
+        _write_batch_free(&ring->slots[i]);
+    }
+    free(ring->slots);
+}
+
+// generate the next write batch of the ring, in the same way as bench_thread
+void _pregen_fill(struct bench_info *binfo, struct pregen_ring *ring,
+                  struct write_batch *b)
+{
+    int64_t batchsize;
+    size_t j;
+    uint64_t r, op_med;
+    uint64_t rngx = ring->rngx, rngy = ring->rngy, rngz = ring->rngz;
+    uint64_t rngt, rngz2;
+    struct rndinfo op_dist;
+
+    BDR_RNG_NEXTPAIR;
+    batchsize = get_random(&binfo->wbatchsize, rngz, rngz2);
+    if (batchsize <= 0) batchsize = 1;
+
+    BDR_RNG_NEXTPAIR;
+    op_med = _get_op_med(binfo, &ring->zipf, rngz, rngz2);
+    _set_op_dist(binfo, op_med, &op_dist);
+
+    // pick documents, then group them by file
+    _write_batch_reserve(b, batchsize);
+    for (j=0;j<(size_t)batchsize;++j){
+        BDR_RNG_NEXTPAIR;
+        r = get_random(&op_dist, rngz, rngz2);
+        if (r >= binfo->ndocs) r = r % binfo->ndocs;
+        b->raw_idx[j] = r;
+    }
+    _write_batch_group(binfo, b, batchsize);
+
+    ring->rngx = rngx;
+    ring->rngy = rngy;
+    ring->rngz = rngz;
+}
+
+void * pregen_thread(void *voidargs)
+{
+    int i, filled, backoff = 0;
+    struct pregen_args *args = (struct pregen_args *)voidargs;
+    struct pregen_ring *ring;
+    struct stopwatch sw;
+
+    stopwatch_init(&sw);
+    while (!args->terminate_signal) {
+        filled = 0;
+        for (i=0;i<args->nrings;++i){
+            ring = args->rings[i];
+            if (ring->head - ring->tail >= ring->nslots) continue;
+
+            stopwatch_start(&sw);
+            _pregen_fill(args->binfo, ring, &ring->slots[ring->head % ring->nslots]);
+            ring->gen_us += _timeval_to_us(stopwatch_get_curtime(&sw));
+            ring->gen_batches++;
+
+            // publish the batch before advancing head
+            __sync_synchronize();
+            ring->head++;
+            filled = 1;
+        }
+        if (!filled) {
+            // all rings are full
+            _backoff(&backoff);
+        } else {
+            backoff = 0;
+        }
+    }
+    return NULL;
+}
+
+// next pre-generated batch (NULL if terminated, or a quiesce was
+// requested while waiting: the writer parks before trying again)
+struct write_batch * _pregen_pop(struct pregen_ring *ring,
+                                  volatile uint8_t *terminate_signal,
+                                  volatile int *quiesce_requested)
+{
+    uint64_t begin;
+    int backoff = 0;
+
+    if (ring->head == ring->tail) {
+        // generator is behind
+        begin = _get_now_us();
+        ring->nwaits++;
+        while (ring->head == ring->tail) {
+            if (*terminate_signal || *quiesce_requested) {
+                ring->wait_us += _get_now_us() - begin;
+                return NULL;
+            }
+            _backoff(&backoff);
+        }
+        ring->wait_us += _get_now_us() - begin;
+    }
+    // read the batch after observing head
+    __sync_synchronize();
+    return &ring->slots[ring->tail % ring->nslots];
+}
+
+void _pregen_release(struct pregen_ring *ring)
+{
+    // finish reading the batch before handing the slot back
+    __sync_synchronize();
+    ring->tail++;
+    ring->nbatches++;
+}
+
+// A logical client issues a batch, waits for the result, thinks, and
+// issues the next one. Clients of a bench thread take turns in order of
+// the end of their think times; since couchstore calls block, a client
+// runs its whole batch before the next client gets the thread.
+struct vclient {
+    uint64_t wake_us; // end of think time (intended start of the next batch)
+    uint64_t nbatches;
+    uint64_t sum_us; // sum of response times
+    uint64_t max_us;
+};
+
+struct vclient_set {
+    size_t n;
+    struct vclient *clients;
+    uint32_t *heap; // client ids, min-heap on wake_us
+};
+
+// exponential think time with mean binfo->think_us
+uint64_t _vclient_think_us(struct bench_info *binfo, uint64_t rnd)
+{
+    double u;
+
+    if (binfo->think_us == 0) return 0;
+    // u in (0, 1]
+    u = ((rnd >> 11) + 1) / 9007199254740992.0;
+    return (uint64_t)(-log(u) * binfo->think_us);
+}
+
+void _vclient_sift_down(struct vclient_set *vs, size_t pos)
+{
+    size_t child;
+    uint32_t temp;
+
+    while ((child = pos*2 + 1) < vs->n) {
+        if (child + 1 < vs->n &&
+            vs->clients[vs->heap[child+1]].wake_us <
+            vs->clients[vs->heap[child]].wake_us) {
+            child++;
+        }
+        if (vs->clients[vs->heap[pos]].wake_us <=
+            vs->clients[vs->heap[child]].wake_us) {
+            break;
+        }
+        temp = vs->heap[pos];
+        vs->heap[pos] = vs->heap[child];
+        vs->heap[child] = temp;
+        pos = child;
+    }
+}
+
+void _vclient_set_init(struct vclient_set *vs, struct bench_info *binfo,
+                       uint64_t seed)
+{
+    size_t i;
+    uint64_t now_us, rnd;
+
+    vs->n = binfo->vclients;
+    vs->clients = (struct vclient *)calloc(vs->n, sizeof(struct vclient));
+    vs->heap = (uint32_t *)malloc(sizeof(uint32_t) * vs->n);
+
+    // clients start thinking at the same time
+    now_us = _get_now_us();
+    for (i=0;i<vs->n;++i){
+        rnd = seed + i;
+        rnd = MurmurHash64A(&rnd, sizeof(rnd), 0);
+        vs->clients[i].wake_us = now_us + _vclient_think_us(binfo, rnd);
+        vs->heap[i] = i;
+    }
+    for (i=vs->n/2; i>0; --i){
+        _vclient_sift_down(vs, i-1);
+    }
+}
+
+void _vclient_set_free(struct vclient_set *vs)
+{
+    free(vs->clients);
+    free(vs->heap);
+}
+
+// one save_documents() per file with that file's handle,
+// then one commit per file touched by the batch
+void _write_batch_save(struct bench_thread_args *args, Db **db,
+                       struct write_batch *b)
+{
+    size_t i, c;
+    struct bench_info *binfo = args->binfo;
+
+    for (i=0;i<binfo->nfiles;++i){
+        c = b->file_off[i+1] - b->file_off[i];
+        if (c == 0) continue;
+        if (args->gc) {
+            // saved and committed by the group commit leader
+            _gc_submit(&args->gc[i], b->docs + b->file_off[i],
+                       b->infos + b->file_off[i], c);
+        } else {
+            couchstore_save_documents(db[i], b->docs + b->file_off[i],
+                                      b->infos + b->file_off[i], c, 0x0);
+        }
+    }
+    if (args->gc) return;
+
+    for (i=0;i<binfo->nfiles;++i){
+        if (b->file_off[i+1] > b->file_off[i]) {
+            couchstore_commit(db[i]);
+        }
+    }
+}
+
+// consumes a value read in place
+void _read_ref_callback(Db *db, const Doc *doc, void *ctx)
+{
+    *(uint64_t *)ctx += doc->data.size;
+}
+
+// the search controller samples latencies while the thread runs, so the
+// updates are bracketed by a sequence counter (odd while updating)
+static void _lat_update_begin(struct bench_thread_args *args)
+{
+    args->lat_seq++;
+    __sync_synchronize();
+}
+
+static void _lat_update_end(struct bench_thread_args *args)
+{
+    __sync_synchronize();
+    args->lat_seq++;
+}
+
+// consistent copy of one of the latency stats of a running bench thread
+static void _lat_copy(struct bench_thread_args *args, struct latency_stat *src,
+                      struct latency_stat *dst)
+{
+    uint32_t seq;
+
+    do {
+        while ((seq = args->lat_seq) & 1) {
+            sched_yield();
+        }
+        __sync_synchronize();
+        *dst = *src;
+        __sync_synchronize();
+    } while (seq != args->lat_seq);
+}
+
+void * bench_thread(void *voidargs)
+{
+    struct bench_thread_args *args = (struct bench_thread_args *)voidargs;
+    int j;
+    int batchsize = 0, nmiss;
+    int write_mode, write_mode_r;
+    int miss, pinned;
+    uint32_t rate_epoch = 0, file_epoch = 0, ckpt = 0;
+    int backoff = 0;
+    int curfile_no;
+    double prob;
+    char keybuf[MAX_KEYLEN];
+    uint64_t r, crc, op_med;
+    uint64_t op_w, op_r, op_w_cum, op_r_cum, op_w_turn, op_r_turn;
+    uint64_t expected_us, elapsed_us, elapsed_sec;
+    size_t reader_ops, writer_ops; // may be changed by the search controller
+    Db **db;
+    Doc *rq_doc;
+    sized_buf rq_id;
+    struct rndinfo write_mode_random, op_dist;
+    struct bench_info *binfo = args->binfo;
+    struct bench_result *result = args->result;
+    struct zipf_rnd_cursor zipf;
+    struct write_batch wb, *pb;
+    struct vclient_set *vs = args->vclients;
+    struct vclient *vc = NULL;
+    uint64_t now_us, resp_us, wait_us;
+    int slot = 0;
+    struct stopwatch sw, sw_op;
+    struct timeval gap;
+    struct arrival req;
+    couchstore_error_t err;
+
+    // uint64_t *offset_arr = (uint64_t*)malloc(sizeof(uint64_t) * args->binfo->ndocs);
+
+    db = args->db;
+    _write_batch_init(&wb, binfo);
+
+    op_med = op_w = op_r = op_w_cum = op_r_cum = 0;
+    elapsed_us = 0;
+    write_mode_random.type = RND_UNIFORM;
+    write_mode_random.a = 0;
+    write_mode_random.b = 256 * 256;
+
+    crc = args->rnd_seed;
+    crc = MurmurHash64A(&crc, sizeof(crc), 0);
+    BDR_RNG_VARS_SET(crc);
+    BDR_RNG_NEXTPAIR;
+    BDR_RNG_NEXTPAIR;
+    BDR_RNG_NEXTPAIR;
+
+    if (binfo->batch_dist.type == RND_ZIPFIAN) {
+        // tables are shared, random state is private to this thread
+        // (all threads get the same rnd_seed, so mix in the thread id)
+        r = args->id;
+        zipf_rnd_cursor_init(&zipf, args->zipf,
+                             rngz2 ^ MurmurHash64A(&r, sizeof(r), 0));
+    }
+
+    stopwatch_init_start(&sw);
+
+    // calculate rw_factor and write probability
+    _get_rw_factor(binfo, &prob);
+
+    spin_lock(&args->b_stat->lock);
+    reader_ops = binfo->reader_ops;
+    writer_ops = binfo->writer_ops;
+    spin_unlock(&args->b_stat->lock);
+
+    while(!args->terminate_signal) {
+        if (args->quiesce->requested && (args->mode == 0 || args->mode == 1)) {
+            // couchstore cannot write during compaction
+            _quiesce_park(args->quiesce);
+        }
+        if (args->db && _quiesce_reopen_needed(args->quiesce, &file_epoch)) {
+            _reopen_handles(binfo, args->db, args->compaction_no);
+        }
+        gap = stopwatch_get_curtime(&sw);
+        elapsed_us = _timeval_to_us(gap);
+        if (elapsed_us == 0) elapsed_us = 1;
+        elapsed_sec = elapsed_us / 1000000;
+
+        spin_lock(&args->b_stat->lock);
+        op_w = args->b_stat->op_count_write;
+        op_r = args->b_stat->op_count_read;
+        pinned = args->b_stat->snapshot_pinned;
+        if (rate_epoch != args->b_stat->rate_epoch) {
+            // target rate changed: restart pacing from now
+            rate_epoch = args->b_stat->rate_epoch;
+            reader_ops = binfo->reader_ops;
+            writer_ops = binfo->writer_ops;
+            stopwatch_init_start(&sw);
+            op_w_cum = op_r_cum = 0;
+            elapsed_us = 1;
+            elapsed_sec = 0;
+        }
+        spin_unlock(&args->b_stat->lock);
+
+        BDR_RNG_NEXTPAIR;
+        write_mode = 0;
+        if (args->queue) {
+            // open-loop: serve the next arrival
+            if (_arrival_queue_pop(args->queue, &req,
+                    (args->mode == 0 || args->mode == 1)?(args->quiesce):(NULL)) < 0) {
+                break;
+            }
+            if (args->db && _quiesce_reopen_needed(args->quiesce, &file_epoch)) {
+                // compacted while waiting
+                _reopen_handles(binfo, args->db, args->compaction_no);
+            }
+            latency_add(&args->lat_queue, MAX(_get_now_us(), req.time_us) - req.time_us);
+            write_mode = req.write;
+        } else if (vs) {
+            // run the client whose think time ends first
+            vc = &vs->clients[vs->heap[0]];
+            now_us = _get_now_us();
+            if (vc->wake_us > now_us) {
+                // all clients are thinking
+                usleep(MIN(vc->wake_us - now_us, 100000));
+                continue;
+            }
+            if (args->mode == 0) {
+                write_mode_r = get_random(&write_mode_random, rngz, rngz2);
+                write_mode = ( (prob * 65536.0) > write_mode_r);
+            } else {
+                write_mode = (args->mode == 1);
+            }
+        } else switch(args->mode) {
+        case 0: // reader+writer
+            // decide write or read
+            write_mode_r = get_random(&write_mode_random, rngz, rngz2);
+            write_mode = ( (prob * 65536.0) > write_mode_r);
+            break;
 
         case 1: // writer
             write_mode = 1;
-            if (binfo->writer_ops > 0 && binfo->write_prob > 100) {
+            if (writer_ops > 0 && binfo->write_prob > 100) {
                 // ops mode
-                if (op_w_cum < elapsed_sec * binfo->writer_ops) break;
-                op_w_turn = op_w_cum - elapsed_sec*binfo->writer_ops;
-                if (op_w_turn < binfo->writer_ops) {
-                    expected_us = 1000000 * op_w_turn / binfo->writer_ops;
+                if (op_w_cum < elapsed_sec * writer_ops) break;
+                op_w_turn = op_w_cum - elapsed_sec*writer_ops;
+                if (op_w_turn < writer_ops) {
+                    expected_us = 1000000 * op_w_turn / writer_ops;
                 } else {
                     expected_us = 1000000;
                 }
@@ -796,7 +2278,8 @@ void * bench_thread(void *voidargs)
             } else {
                 if (op_w * 100 > (op_w + op_r) * binfo->write_prob &&
                     binfo->write_prob <= 100) {
-                    usleep(1);
+                    // readers are behind
+                    _backoff(&backoff);
                     continue;
                 }
             }
@@ -804,12 +2287,12 @@ void * bench_thread(void *voidargs)
 
         case 2: // reader
             write_mode = 0;
-            if (binfo->reader_ops > 0 && binfo->write_prob > 100) {
+            if (reader_ops > 0 && binfo->write_prob > 100) {
                 // ops mode
-                if (op_r_cum < elapsed_sec * binfo->reader_ops) break;
-                op_r_turn = op_r_cum - elapsed_sec*binfo->reader_ops;
-                if (op_r_turn < binfo->reader_ops) {
-                    expected_us = 1000000 * op_r_turn / binfo->reader_ops;
+                if (op_r_cum < elapsed_sec * reader_ops) break;
+                op_r_turn = op_r_cum - elapsed_sec*reader_ops;
+                if (op_r_turn < reader_ops) {
+                    expected_us = 1000000 * op_r_turn / reader_ops;
                 } else {
                     expected_us = 1000000;
                 }
@@ -820,94 +2303,112 @@ void * bench_thread(void *voidargs)
             } else {
                 if (op_w * 100 < (op_w + op_r) * binfo->write_prob &&
                     binfo->write_prob <= 100) {
-                    usleep(1);
+                    // writers are behind
+                    _backoff(&backoff);
                     continue;
                 }
             }
             break;
         }
 
-        // randomly set batchsize
-        BDR_RNG_NEXTPAIR;
-        if (write_mode) {
-            batchsize = get_random(&binfo->wbatchsize, rngz, rngz2);
-            if (batchsize <= 0) batchsize = 1;
-        }else{
-            batchsize = get_random(&binfo->rbatchsize, rngz, rngz2);
-            if (batchsize <= 0) batchsize = 1;
-        }
+        backoff = 0;
 
-        // ramdomly set document distribution for batch
-        if (binfo->batch_dist.type == RND_UNIFORM) {
-            // uniform distribution
+        if (!(write_mode && args->ring)) {
+            // randomly set batchsize (pre-generated batches have their own)
             BDR_RNG_NEXTPAIR;
-            op_med = get_random(&binfo->batch_dist, rngz, rngz2);
-        }else{
-            // zipfian distribution
+            if (write_mode) {
+                batchsize = get_random(&binfo->wbatchsize, rngz, rngz2);
+                if (batchsize <= 0) batchsize = 1;
+            }else{
+                batchsize = get_random(&binfo->rbatchsize, rngz, rngz2);
+                if (batchsize <= 0) batchsize = 1;
+            }
+
+            // ramdomly set document distribution for batch
             BDR_RNG_NEXTPAIR;
-            op_med = zipf_rnd_get(zipf);
-            op_med = op_med * binfo->batch_dist.b + (rngz % binfo->batch_dist.b);
+            op_med = _get_op_med(binfo, &zipf, rngz, rngz2);
+            _set_op_dist(binfo, op_med, &op_dist);
         }
-        if (op_med >= binfo->ndocs) op_med = binfo->ndocs - 1;
 
-        // distribution of operations in a batch
-        if (binfo->op_dist.type == RND_NORMAL){
-            op_dist.type = RND_NORMAL;
-            op_dist.a = op_med;
-            op_dist.b = binfo->batchrange/2;
-        }else {
-            op_dist.type = RND_UNIFORM;
-            op_dist.a = op_med - binfo->batchrange;
-            op_dist.b = op_med + binfo->batchrange;
-            if (op_dist.a < 0) op_dist.a = 0;
-            if (op_dist.b >= binfo->ndocs) op_dist.b = binfo->ndocs;
+        if (args->pool) {
+            slot = _handle_pool_get(args->pool, &wait_us);
+            if (wait_us) {
+                args->handle_waits++;
+                args->handle_wait_us += wait_us;
+            }
+            if (args->pool->exclusive &&
+                _quiesce_reopen_needed(args->quiesce, &args->pool->file_epoch[slot])) {
+                _reopen_handles(binfo, args->pool->db[slot], args->compaction_no);
+            }
+            db = args->pool->db[slot];
         }
 
-        if (write_mode) {
-            // write (update)
-#if defined(__FDB_BENCH) || defined(__WT_BENCH)
-            // initialize
-            memset(commit_mask, 0, sizeof(int) * binfo->nfiles);
-
+        if (write_mode && args->ring) {
+            // write a pre-generated batch
+            pb = _pregen_pop(args->ring, &args->terminate_signal,
+                             &args->quiesce->requested);
+            if (!pb) {
+                if (args->pool) _handle_pool_put(args->pool, slot);
+                if (args->terminate_signal) break;
+                continue;
+            }
+            batchsize = pb->n;
             for (j=0;j<batchsize;++j){
-                rq_doc = NULL;
-                rq_info = NULL;
+                _bench_result_doc_hit(result, pb->idx[j]);
+                _bench_result_file_hit(result,
+                    GET_FILE_NO(binfo->ndocs, binfo->nfiles, pb->idx[j]));
+            }
 
+            ckpt = ckpt_seq;
+            stopwatch_start(&sw_op);
+            _write_batch_save(args, db, pb);
+            gap = stopwatch_get_curtime(&sw_op);
+            _pregen_release(args->ring);
+        } else if (write_mode) {
+            // write (update), grouped by file
+            ckpt = ckpt_seq;
+            stopwatch_start(&sw_op);
+            _write_batch_reserve(&wb, batchsize);
+            for (j=0;j<batchsize;++j){
                 BDR_RNG_NEXTPAIR;
                 r = get_random(&op_dist, rngz, rngz2);
                 if (r >= binfo->ndocs) r = r % binfo->ndocs;
-                curfile_no = GET_FILE_NO(binfo->ndocs, binfo->nfiles, r);
                 _bench_result_doc_hit(result, r);
-                _bench_result_file_hit(result, curfile_no);
-                //printf("%22"_X64" %22"_X64" %6d %6d\n", rngz, rngz2, op_med, (int)r);
-
-                _create_doc(binfo, r, &rq_doc, &rq_info);
-                err = couchstore_save_document(db[curfile_no], rq_doc, rq_info, 0x0);
-
-                // set mask
-                commit_mask[curfile_no] = 1;
-
-                free(rq_doc->id.buf);
-                free(rq_doc->data.buf);
-                free(rq_doc);
-                free(rq_info);
+                _bench_result_file_hit(result,
+                    GET_FILE_NO(binfo->ndocs, binfo->nfiles, r));
+                wb.raw_idx[j] = r;
             }
+            _write_batch_group(binfo, &wb, batchsize);
+            _write_batch_save(args, db, &wb);
+            gap = stopwatch_get_curtime(&sw_op);
+        }
 
-            for (j=0;j<binfo->nfiles;++j) {
-                if (commit_mask[j]) {
-                    couchstore_commit(db[j]);
-                }
+        if (write_mode) {
+            _lat_update_begin(args);
+            if (pinned) {
+                latency_add(&args->lat_write_pinned, _timeval_to_us(gap));
+            } else {
+                latency_add(&args->lat_write, _timeval_to_us(gap));
             }
-#else
-            for (i=0; i<binfo->nfiles;++i){
-                rq_doc_arr[i] = (Doc **)malloc(sizeof(Doc*) * batchsize);
-                rq_info_arr[i] = (DocInfo **)malloc(sizeof(DocInfo*) * batchsize);
-                memset(rq_doc_arr[i], 0, sizeof(Doc*) * batchsize);
-                memset(rq_info_arr[i], 0, sizeof(DocInfo*) * batchsize);
-                file_doccount[i] = 0;
+            if (_ckpt_overlap(ckpt)) {
+                latency_add(&args->lat_write_ckpt, _timeval_to_us(gap));
+            }
+            _lat_update_end(args);
+
+            spin_lock(&args->b_stat->lock);
+            args->b_stat->op_count_write += batchsize;
+            if (pinned) {
+                args->b_stat->op_count_write_pinned += batchsize;
             }
+            args->b_stat->batch_count++;
+            spin_unlock(&args->b_stat->lock);
 
+            op_w_cum += batchsize;
+        }else{
+            // read
+            nmiss = 0;
             for (j=0;j<batchsize;++j){
+
                 BDR_RNG_NEXTPAIR;
                 r = get_random(&op_dist, rngz, rngz2);
                 if (r >= binfo->ndocs) r = r % binfo->ndocs;
@@ -915,81 +2416,494 @@ void * bench_thread(void *voidargs)
                 _bench_result_doc_hit(result, r);
                 _bench_result_file_hit(result, curfile_no);
 
-                c = file_doccount[curfile_no]++;
-                _create_doc(binfo, r,
-                            &rq_doc_arr[curfile_no][c],
-                            &rq_info_arr[curfile_no][c]);
-
-                // set mask
-                commit_mask[curfile_no] = 1;
-
-            }
+                miss = 0;
+                if (binfo->miss_prob) {
+                    BDR_RNG_NEXT;
+                    miss = ((rngz % 100) < binfo->miss_prob);
+                }
+                if (miss) {
+                    // index beyond ndocs is never written,
+                    // but look it up in the file where 'r' resides
+                    rq_id.size = keygen_seed2key(&binfo->keygen, binfo->ndocs + r,
+                                                 keybuf);
+                } else {
+                    rq_id.size = keygen_seed2key(&binfo->keygen, r, keybuf);
+                }
 
-            for (i=0;i<binfo->nfiles;++i) {
-                if (file_doccount[i] > 0) {
-                    err = couchstore_save_documents(db[curfile_no],
-                                                    rq_doc_arr[i],
-                                                    rq_info_arr[i],
-                                                    file_doccount[i], 0x0);
-#if defined(__COUCH_BENCH)
-                    err = couchstore_commit(db[curfile_no]);
-#endif
-                    for (j=0;j<file_doccount[i];++j){
-                        free(rq_doc_arr[i][j]->id.buf);
-                        free(rq_doc_arr[i][j]->data.buf);
-                        free(rq_doc_arr[i][j]);
-                        free(rq_info_arr[i][j]);
+                ckpt = ckpt_seq;
+                if (binfo->read_ref) {
+                    // no copy, and the key is not copied either
+                    stopwatch_start(&sw_op);
+                    err = engine->open_document_ref(db[curfile_no], keybuf,
+                                                    rq_id.size, _read_ref_callback,
+                                                    &args->read_bytes);
+                    gap = stopwatch_get_curtime(&sw_op);
+                } else {
+                    rq_id.buf = (char *)malloc(rq_id.size);
+                    memcpy(rq_id.buf, keybuf, rq_id.size);
+
+                    rq_doc = NULL;
+                    stopwatch_start(&sw_op);
+                    err = couchstore_open_document(db[curfile_no], rq_id.buf,
+                                                   rq_id.size, &rq_doc, 0x0);
+                    if (rq_doc) {
+                        // freeing the copy is part of the read
+                        args->read_bytes += rq_doc->data.size;
+                        rq_doc->id.buf = NULL;
+                        couchstore_free_document(rq_doc);
                     }
+                    gap = stopwatch_get_curtime(&sw_op);
+                    free(rq_id.buf);
+                }
+                if (err == COUCHSTORE_SUCCESS) {
+                    _lat_update_begin(args);
+                    latency_add(&args->lat_read, _timeval_to_us(gap));
+                    _lat_update_end(args);
+                    if (_ckpt_overlap(ckpt)) {
+                        latency_add(&args->lat_read_ckpt, _timeval_to_us(gap));
+                    }
+                } else if (err == COUCHSTORE_ERROR_DOC_NOT_FOUND && miss) {
+                    latency_add(&args->lat_read_miss, _timeval_to_us(gap));
+                    nmiss++;
+                } else {
+                    printf("read error: document number %"_F64"\n", r);
                 }
-                free(rq_doc_arr[i]);
-                free(rq_info_arr[i]);
             }
-#endif
 
             spin_lock(&args->b_stat->lock);
-            args->b_stat->op_count_write += batchsize;
+            args->b_stat->op_count_read += batchsize;
+            args->b_stat->op_count_miss += nmiss;
             args->b_stat->batch_count++;
             spin_unlock(&args->b_stat->lock);
 
-            op_w_cum += batchsize;
-        }else{
-            // read
-            for (j=0;j<batchsize;++j){
+            op_r_cum += batchsize;
+        }
 
-                BDR_RNG_NEXTPAIR;
-                r = get_random(&op_dist, rngz, rngz2);
-                if (r >= binfo->ndocs) r = r % binfo->ndocs;
-                curfile_no = GET_FILE_NO(binfo->ndocs, binfo->nfiles, r);
-                _bench_result_doc_hit(result, r);
-                _bench_result_file_hit(result, curfile_no);
+        if (args->pool) {
+            _handle_pool_put(args->pool, slot);
+        }
+
+        if (args->queue) {
+            _lat_update_begin(args);
+            latency_add(&args->lat_response,
+                        MAX(_get_now_us(), req.time_us) - req.time_us);
+            _lat_update_end(args);
+        }
+        if (vs) {
+            // includes the time spent behind other clients of this thread
+            now_us = _get_now_us();
+            resp_us = now_us - vc->wake_us;
+            _lat_update_begin(args);
+            latency_add(&args->lat_response, resp_us);
+            _lat_update_end(args);
+            vc->nbatches++;
+            vc->sum_us += resp_us;
+            if (resp_us > vc->max_us) vc->max_us = resp_us;
+
+            BDR_RNG_NEXT;
+            vc->wake_us = now_us + _vclient_think_us(binfo, rngz);
+            _vclient_sift_down(vs, 0);
+        }
+    }
+
+    _write_batch_free(&wb);
+
+    return NULL;
+}
+
+struct snapshot_scan_ctx {
+    struct bench_thread_args *args;
+    struct stopwatch sw;
+    uint64_t ndocs;
+    uint64_t size_max;
+    uint64_t last_check_us;
+};
+
+int _snapshot_scan_callback(Db *db, DocInfo *docinfo, void *ctx)
+{
+    struct snapshot_scan_ctx *sctx = (struct snapshot_scan_ctx *)ctx;
+    struct bench_info *binfo = sctx->args->binfo;
+    uint64_t elapsed_us, expected_us, size;
+
+    if (sctx->args->terminate_signal) return -1;
+
+    if (engine->open_doc_with_docinfo) {
+        // the iteration gives keys only; read the body as well
+        Doc *doc = NULL;
+        if (engine->open_doc_with_docinfo(db, docinfo, &doc, 0x0) ==
+            COUCHSTORE_SUCCESS) {
+            couchstore_free_document(doc);
+        }
+    }
+    sctx->ndocs++;
+
+    elapsed_us = _timeval_to_us(stopwatch_get_curtime(&sctx->sw));
+    if (elapsed_us - sctx->last_check_us >= 1000000) {
+        // sample the DB size every second while the snapshot is held
+        size = _get_dbsize(binfo);
+        if (size > sctx->size_max) sctx->size_max = size;
+        sctx->last_check_us = elapsed_us;
+    }
+
+    if (binfo->snapshot_ops > 0) {
+        expected_us = sctx->ndocs * 1000000 / binfo->snapshot_ops;
+        if (expected_us > elapsed_us) {
+            usleep(expected_us - elapsed_us);
+        }
+    }
+
+    return 0;
+}
+
+// shortest held/not-held time a write rate is reported for
+#define SNAPSHOT_MIN_RATE_SEC (1.0)
+
+// snapshots of all files held by a snapshot reader
+struct snapshot_hold {
+    Db **snapshot;
+    int nfail;
+    couchstore_error_t err; // of the last failed open
+    uint64_t begin_us;
+    uint64_t size_begin;
+    uint64_t op_begin; // b_stat->op_count_write when taken
+};
+
+static void _snapshot_take(struct bench_thread_args *args,
+                           struct snapshot_hold *h,
+                           struct snapshot_scan_ctx *sctx)
+{
+    struct bench_info *binfo = args->binfo;
+    struct bench_shared_stat *b_stat = args->b_stat;
+    couchstore_error_t err;
+    size_t i;
+
+    h->size_begin = sctx->size_max = _get_dbsize(binfo);
+    h->begin_us = _get_now_us();
+
+    spin_lock(&b_stat->lock);
+    if (b_stat->snapshot_pinned++ == 0) {
+        stopwatch_start(&b_stat->sw_pinned);
+    }
+    h->op_begin = b_stat->op_count_write;
+    spin_unlock(&b_stat->lock);
+
+    h->nfail = 0;
+    for (i=0;i<binfo->nfiles;++i) {
+        err = couchstore_open_snapshot(args->db[i], &h->snapshot[i]);
+        if (err != COUCHSTORE_SUCCESS) {
+            h->snapshot[i] = NULL;
+            h->err = err;
+            h->nfail++;
+        }
+    }
+}
+
+// closes the snapshots and records the DB growth over the hold period
+static void _snapshot_release(struct bench_thread_args *args,
+                              struct snapshot_hold *h,
+                              struct snapshot_scan_ctx *sctx)
+{
+    struct bench_info *binfo = args->binfo;
+    struct bench_shared_stat *b_stat = args->b_stat;
+    uint64_t size, op_end;
+    size_t i;
+
+    size = _get_dbsize(binfo);
+    if (size > sctx->size_max) sctx->size_max = size;
+    for (i=0;i<binfo->nfiles;++i) {
+        if (h->snapshot[i]) {
+            couchstore_close_snapshot(h->snapshot[i]);
+        }
+    }
+
+    spin_lock(&b_stat->lock);
+    if (--b_stat->snapshot_pinned == 0) {
+        stopwatch_stop(&b_stat->sw_pinned);
+    }
+    op_end = b_stat->op_count_write;
+    spin_unlock(&b_stat->lock);
+
+    if (sctx->size_max > h->size_begin &&
+        sctx->size_max - h->size_begin > args->scan_growth) {
+        args->scan_growth = sctx->size_max - h->size_begin;
+        args->scan_growth_ratio = (double)sctx->size_max / h->size_begin;
+        args->scan_growth_us = _get_now_us() - h->begin_us;
+        args->scan_growth_writes = op_end - h->op_begin;
+    }
+}
+
+// takes a snapshot of every file and scans the whole key space; the same
+// snapshot is scanned again until it has been held for snapshot_hold_sec
+// (0: a new snapshot for every pass)
+void * snapshot_thread(void *voidargs)
+{
+    struct bench_thread_args *args = (struct bench_thread_args *)voidargs;
+    struct bench_info *binfo = args->binfo;
+    struct snapshot_scan_ctx sctx;
+    struct snapshot_hold hold;
+    struct timeval gap;
+    int i, held = 0, reopen;
+    uint32_t file_epoch = 0;
+    uint64_t size;
+    Db *snapshot[binfo->nfiles];
+
+    sctx.args = args;
+    hold.snapshot = snapshot;
+
+    while(!args->terminate_signal) {
+        // snapshots belong to the handles, so they go first
+        reopen = _quiesce_reopen_needed(args->quiesce, &file_epoch);
+        if (held && (reopen || _get_now_us() - hold.begin_us >=
+                                   binfo->snapshot_hold_sec * 1000000)) {
+            _snapshot_release(args, &hold, &sctx);
+            held = 0;
+        }
+        if (reopen) {
+            _reopen_handles(binfo, args->db, args->compaction_no);
+        }
+
+        if (!held) {
+            _snapshot_take(args, &hold, &sctx);
+            held = 1;
+            if (hold.nfail == (int)binfo->nfiles &&
+                hold.err == COUCHSTORE_ERROR_INVALID_ARGUMENTS) {
+                // not supported in this configuration (e.g., ForestDB namespaces)
+                _snapshot_release(args, &hold, &sctx);
+                held = 0;
+                printf("\nsnapshots are not supported, snapshot reader stopped\n");
+                break;
+            }
+            if (hold.nfail) {
+                printf("\nsnapshot open failed on %d file%s\n",
+                       hold.nfail, (hold.nfail>1)?("s"):(""));
+            }
+        }
+
+        sctx.ndocs = 0;
+        sctx.last_check_us = 0;
+        stopwatch_init_start(&sctx.sw);
+        for (i=0;i<binfo->nfiles && !args->terminate_signal;++i) {
+            if (snapshot[i]) {
+                couchstore_all_docs(snapshot[i], NULL, 0x0,
+                                    _snapshot_scan_callback, &sctx);
+            }
+        }
+        gap = stopwatch_stop(&sctx.sw);
+        size = _get_dbsize(binfo);
+        if (size > sctx.size_max) sctx.size_max = size;
+
+        args->scan_docs += sctx.ndocs;
+        args->scan_us += _timeval_to_us(gap);
+        if (!args->terminate_signal) {
+            // count completed passes only
+            args->scan_passes++;
+        }
+
+        if (hold.nfail) {
+            // retry the failed files with a new snapshot
+            _snapshot_release(args, &hold, &sctx);
+            held = 0;
+            usleep(100000);
+        } else if (binfo->snapshot_hold_sec == 0) {
+            _snapshot_release(args, &hold, &sctx);
+            held = 0;
+        }
+    }
+    if (held) {
+        _snapshot_release(args, &hold, &sctx);
+    }
+
+    return NULL;
+}
+
+struct search_point {
+    uint64_t target;
+    double achieved;
+    uint64_t p50;
+    uint64_t p99;
+    double drop;
+    int pass;
+};
+
+struct search_args {
+    struct bench_info *binfo;
+    struct bench_thread_args *b_args;
+    int bench_threads;
+    struct bench_shared_stat *b_stat;
+    struct dispatcher_args *d_args;
+    uint64_t rate; // current target
+    struct search_point *points;
+    int npoints;
+    uint8_t done;
+    uint8_t terminate_signal;
+};
+
+// per-thread reader_ops/writer_ops (closed-loop) or arrival rate (open-loop);
+// bench threads and the dispatcher read them under b_stat->lock
+void _search_set_rate(struct search_args *args, uint64_t rate, double r_share)
+{
+    struct bench_info *binfo = args->binfo;
+
+    spin_lock(&args->b_stat->lock);
+    if (binfo->arrival_mode) {
+        binfo->arrival_rate = rate;
+    } else {
+        if (binfo->nreaders && r_share > 0) {
+            binfo->reader_ops = MAX(1, rate * r_share / binfo->nreaders);
+        }
+        if (binfo->nwriters && r_share < 1) {
+            binfo->writer_ops = MAX(1, rate * (1 - r_share) / binfo->nwriters);
+        }
+    }
+    args->b_stat->rate_epoch++;
+    spin_unlock(&args->b_stat->lock);
+    args->rate = rate;
+}
+
+int _search_sleep(struct search_args *args, size_t secs)
+{
+    size_t i;
+    for (i=0;i<secs*10;++i){
+        if (args->terminate_signal) return -1;
+        usleep(100000);
+    }
+    return 0;
+}
+
+// latency of the SLO metric and # served requests (open-loop) or paced ops
+void _search_collect(struct search_args *args, struct latency_stat *ls,
+                     uint64_t *count, uint64_t *drops)
+{
+    int i;
+    struct bench_info *binfo = args->binfo;
+    struct bench_thread_args *b_args = args->b_args;
+    struct latency_stat *src, tmp;
+
+    latency_init(ls);
+    for (i=0;i<args->bench_threads;++i){
+        switch(binfo->slo_metric) {
+        case 0: src = &b_args[i].lat_read; break;
+        case 1: src = &b_args[i].lat_write; break;
+        default: src = &b_args[i].lat_response; break;
+        }
+        _lat_copy(&b_args[i], src, &tmp);
+        latency_merge(ls, &tmp);
+    }
+
+    if (binfo->arrival_mode) {
+        *count = 0;
+        for (i=0;i<args->bench_threads;++i){
+            _lat_copy(&b_args[i], &b_args[i].lat_response, &tmp);
+            *count += tmp.count;
+        }
+        *drops = args->d_args->ndrops;
+    } else {
+        spin_lock(&args->b_stat->lock);
+        *count = ((binfo->reader_ops)?(args->b_stat->op_count_read):(0)) +
+                 ((binfo->writer_ops)?(args->b_stat->op_count_write):(0));
+        spin_unlock(&args->b_stat->lock);
+        *drops = 0;
+    }
+}
 
-                rq_id.size = keygen_seed2key(&binfo->keygen, r, keybuf);
-                rq_id.buf = (char *)malloc(rq_id.size);
-                memcpy(rq_id.buf, keybuf, rq_id.size);
+// steps (or binary-searches) the target rate until the SLO is violated
+void * search_controller(void *voidargs)
+{
+    struct search_args *args = (struct search_args *)voidargs;
+    struct bench_info *binfo = args->binfo;
+    struct search_point *pt;
+    struct latency_stat ls_begin, ls_end;
+    uint64_t rate, lo, hi, count_begin, count_end, drops_begin, drops_end;
+    uint64_t r_agg, w_agg;
+    double r_share;
+
+    // keep the configured read:write ratio; a side configured as
+    // unthrottled (0 ops/sec) stays unthrottled
+    r_agg = binfo->reader_ops * binfo->nreaders;
+    w_agg = binfo->writer_ops * binfo->nwriters;
+    if (r_agg + w_agg > 0) {
+        r_share = (double)r_agg / (r_agg + w_agg);
+    } else {
+        r_share = (double)binfo->nreaders / (binfo->nreaders + binfo->nwriters);
+    }
 
-                err = couchstore_open_document(db[curfile_no], rq_id.buf,
-                                               rq_id.size, &rq_doc, 0x0);
-                if (err != COUCHSTORE_SUCCESS) {
-                    printf("read error: document number %"_F64"\n", r);
-                }
+    lo = hi = 0;
+    rate = binfo->search_start;
+    while (!args->terminate_signal) {
+        _search_set_rate(args, rate, r_share);
+        if (_search_sleep(args, binfo->search_warmup) < 0) break;
 
-                rq_doc->id.buf = NULL;
-                couchstore_free_document(rq_doc);
-                free(rq_id.buf);
+        _search_collect(args, &ls_begin, &count_begin, &drops_begin);
+        if (binfo->arrival_mode) {
+            count_begin += drops_begin;
+        }
+        if (_search_sleep(args, binfo->search_measure) < 0) break;
+        _search_collect(args, &ls_end, &count_end, &drops_end);
+        latency_sub(&ls_end, &ls_begin);
+
+        pt = &args->points[args->npoints++];
+        pt->target = rate;
+        pt->achieved = (double)(count_end - count_begin) / binfo->search_measure;
+        pt->p50 = latency_percentile(&ls_end, 50);
+        pt->p99 = latency_percentile(&ls_end, 99);
+        pt->drop = 0;
+        pt->pass = (ls_end.count > 0 && pt->p99 <= binfo->slo_p99_us);
+        if (binfo->arrival_mode) {
+            uint64_t narrivals = count_end + drops_end - count_begin;
+            if (narrivals) {
+                pt->drop = (drops_end - drops_begin) * 100.0 / narrivals;
             }
+            if (pt->drop > binfo->slo_drop) pt->pass = 0;
+        } else if (pt->achieved < rate * 0.95) {
+            // pacing fell behind: the engine cannot sustain this rate
+            pt->pass = 0;
+        }
 
-            spin_lock(&args->b_stat->lock);
-            args->b_stat->op_count_read += batchsize;
-            args->b_stat->batch_count++;
-            spin_unlock(&args->b_stat->lock);
+        lprintf("\n[search] target %d /sec: achieved %.1f /sec, "
+                "p50 %d us, p99 %d us", (int)rate, pt->achieved,
+                (int)pt->p50, (int)pt->p99);
+        if (binfo->arrival_mode) {
+            lprintf(", drop %.2f %%", pt->drop);
+        }
+        lprintf(" => %s\n", (pt->pass)?("ok"):("SLO violated"));
 
-            op_r_cum += batchsize;
+        // next target
+        if (pt->pass) {
+            lo = rate;
+        } else {
+            hi = rate;
+        }
+        if (binfo->search_mode == 1) {
+            // step
+            if (!pt->pass || rate + binfo->search_step > binfo->search_max) break;
+            rate += binfo->search_step;
+        } else {
+            // binary: double until the first violation, then bisect
+            if (hi == 0) {
+                if (rate >= binfo->search_max) break;
+                rate = MIN(rate * 2, binfo->search_max);
+            } else {
+                if (hi - lo <= binfo->search_step) break;
+                rate = (lo + hi) / 2;
+            }
         }
+        if (args->npoints == 64) break;
     }
 
+    args->done = 1;
     return NULL;
 }
 
+int _search_point_cmp(const void *a, const void *b)
+{
+    struct search_point *aa = (struct search_point *)a;
+    struct search_point *bb = (struct search_point *)b;
+
+    if (aa->target < bb->target) return -1;
+    if (aa->target > bb->target) return 1;
+    return 0;
+}
+
 void _wait_leveldb_compaction(struct bench_info *binfo, Db **db)
 {
     int n=6;
@@ -1032,17 +2946,6 @@ wait_next:
     }
 }
 
-// non-standard function for extension
-couchstore_error_t couchstore_set_flags(uint64_t flags);
-couchstore_error_t couchstore_set_cache(uint64_t size);
-couchstore_error_t couchstore_set_compaction(int mode,
-                                             size_t threshold);
-couchstore_error_t couchstore_open_conn(const char *filename);
-couchstore_error_t couchstore_close_conn();
-couchstore_error_t couchstore_set_wal_size(size_t size);
-couchstore_error_t couchstore_set_wbs_size(uint64_t size);
-couchstore_error_t couchstore_set_idx_type(int type);
-
 int _does_file_exist(char *filename) {
     struct stat st;
     int result = stat(filename, &st);
@@ -1065,7 +2968,169 @@ char *_get_dirname(char *filename, char *dirname_buf)
     return NULL;
 }
 
-void do_bench(struct bench_info *binfo)
+void _print_latency(const char *name, struct latency_stat *ls)
+{
+    if (ls->count == 0) return;
+    lprintf("%s: avg %.1f us, p50 %d us, p99 %d us, p99.9 %d us, max %d us\n",
+            name, latency_avg(ls),
+            (int)latency_percentile(ls, 50), (int)latency_percentile(ls, 99),
+            (int)latency_percentile(ls, 99.9), (int)ls->max);
+}
+
+// a handle for each file
+Db ** _open_handles(struct bench_info *binfo, int *compaction_no)
+{
+    size_t i;
+    char curfile[256];
+    Db **db = (Db**)malloc(sizeof(Db*) * binfo->nfiles);
+
+    for (i=0;i<binfo->nfiles;++i){
+        sprintf(curfile, "%s%d.%d", binfo->filename, (int)i, compaction_no[i]);
+        couchstore_open_db(curfile,
+                           COUCHSTORE_OPEN_FLAG_CREATE |
+                               ((binfo->sync_write)?(0x10):(0x0)),
+                           &db[i]);
+    }
+    return db;
+}
+
+// results after warm-up (used by the thread scaling sweep)
+struct bench_summary {
+    size_t nreaders;
+    size_t nwriters;
+    double sec;
+    double ops_per_sec;
+    uint64_t p99_read;
+    uint64_t p99_write;
+    double cpu_us_per_op;
+};
+
+struct bench_window {
+    uint64_t time_us;
+    uint64_t cpu_us;
+    uint64_t op_count;
+    struct latency_stat lat_read;
+    struct latency_stat lat_write;
+};
+
+uint64_t _get_cpu_us()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return _timeval_to_us(ru.ru_utime) + _timeval_to_us(ru.ru_stime);
+}
+
+#define ENGINE_STATS_INTERVAL_US (1000000)
+
+void _engine_stats_init(struct couch_engine_stats *s)
+{
+    int i;
+
+    s->doc_count = s->space_used = s->file_size = ENGINE_STAT_NONE;
+    s->cache_hits = s->cache_misses = ENGINE_STAT_NONE;
+    s->mem_bytes = s->compaction_pending = ENGINE_STAT_NONE;
+    s->nlevels = 0;
+    for (i=0;i<ENGINE_STATS_MAX_LEVELS;++i){
+        s->level_bytes[i] = ENGINE_STAT_NONE;
+    }
+}
+
+void _engine_stats_print_header(FILE *fp)
+{
+    fprintf(fp, "# time(s) docs space_used file_size cache_hit_ratio(%%) "
+                "mem_bytes compaction_pending level_bytes(L0 L1 ..)\n");
+}
+
+void _engine_stats_print_value(FILE *fp, uint64_t val)
+{
+    if (val == ENGINE_STAT_NONE) {
+        fprintf(fp, " -");
+    } else {
+        fprintf(fp, " %"_F64, val);
+    }
+}
+
+// one line per sample; the cache hit ratio is of the last interval
+void _engine_stats_print(FILE *fp, double time_s,
+                         struct couch_engine_stats *cur,
+                         struct couch_engine_stats *prev)
+{
+    int i;
+    uint64_t hits, total;
+
+    fprintf(fp, "%.1f", time_s);
+    _engine_stats_print_value(fp, cur->doc_count);
+    _engine_stats_print_value(fp, cur->space_used);
+    _engine_stats_print_value(fp, cur->file_size);
+    if (cur->cache_hits == ENGINE_STAT_NONE ||
+        cur->cache_misses == ENGINE_STAT_NONE) {
+        fprintf(fp, " -");
+    } else {
+        hits = cur->cache_hits;
+        total = cur->cache_hits + cur->cache_misses;
+        if (prev->cache_hits != ENGINE_STAT_NONE &&
+            prev->cache_misses != ENGINE_STAT_NONE &&
+            hits >= prev->cache_hits &&
+            total >= prev->cache_hits + prev->cache_misses) {
+            hits -= prev->cache_hits;
+            total -= prev->cache_hits + prev->cache_misses;
+        }
+        if (total) {
+            fprintf(fp, " %.2f", hits * 100.0 / total);
+        } else {
+            fprintf(fp, " -");
+        }
+    }
+    _engine_stats_print_value(fp, cur->mem_bytes);
+    _engine_stats_print_value(fp, cur->compaction_pending);
+    for (i=0;i<cur->nlevels;++i){
+        _engine_stats_print_value(fp, cur->level_bytes[i]);
+    }
+    fprintf(fp, "\n");
+    fflush(fp);
+}
+
+void _bench_window_mark(struct bench_window *w,
+                        struct bench_thread_args *b_args, int bench_threads,
+                        struct bench_shared_stat *b_stat, uint64_t time_us)
+{
+    int i;
+    struct latency_stat tmp;
+
+    w->time_us = time_us;
+    w->cpu_us = _get_cpu_us();
+    spin_lock(&b_stat->lock);
+    w->op_count = b_stat->op_count_read + b_stat->op_count_write;
+    spin_unlock(&b_stat->lock);
+    latency_init(&w->lat_read);
+    latency_init(&w->lat_write);
+    for (i=0;i<bench_threads;++i){
+        // threads may still be running (start of the window)
+        _lat_copy(&b_args[i], &b_args[i].lat_read, &tmp);
+        latency_merge(&w->lat_read, &tmp);
+        _lat_copy(&b_args[i], &b_args[i].lat_write, &tmp);
+        latency_merge(&w->lat_write, &tmp);
+        _lat_copy(&b_args[i], &b_args[i].lat_write_pinned, &tmp);
+        latency_merge(&w->lat_write, &tmp);
+    }
+}
+
+// 'end' - 'begin'
+void _bench_window_summary(struct bench_window *begin, struct bench_window *end,
+                           struct bench_summary *summary)
+{
+    uint64_t ops = end->op_count - begin->op_count;
+
+    latency_sub(&end->lat_read, &begin->lat_read);
+    latency_sub(&end->lat_write, &begin->lat_write);
+    summary->sec = (end->time_us - begin->time_us) / 1000000.0;
+    summary->ops_per_sec = (summary->sec > 0)?(ops / summary->sec):(0);
+    summary->p99_read = latency_percentile(&end->lat_read, 99);
+    summary->p99_write = latency_percentile(&end->lat_write, 99);
+    summary->cpu_us_per_op = (ops)?((double)(end->cpu_us - begin->cpu_us) / ops):(0);
+}
+
+void do_bench(struct bench_info *binfo, struct bench_summary *summary)
 {
     BDR_RNG_VARS;
     int i, j, ret;
@@ -1076,9 +3141,10 @@ void do_bench(struct bench_info *binfo)
     int cur_compaction = -1;
     int bench_threads;
     uint64_t written_init, written_final;
+    uint64_t nsyncs_begin = 0, nsyncs;
     char curfile[256], newfile[256], bodybuf[1024], cmd[256];
     char fsize1[128], fsize2[128], *str;
-    void *compactor_ret;
+    void *compactor_ret, *dispatcher_ret;
     void **bench_worker_ret;
     double gap_double;
     Db *db[binfo->nfiles], *info_handle[binfo->nfiles];
@@ -1088,11 +3154,32 @@ void do_bench(struct bench_info *binfo)
     spin_t cur_compaction_lock;
     struct stopwatch sw, sw_compaction, progress;
     struct timeval gap, _gap;
-    struct zipf_rnd zipf;
     struct bench_result result;
     struct compactor_args c_args;
+    struct quiesce quiesce;
     struct bench_shared_stat b_stat;
     struct bench_thread_args *b_args;
+    struct dispatcher_args d_args;
+    thread_t tid_dispatcher;
+    struct search_args s_args;
+    thread_t tid_search;
+    struct checkpoint_args k_args;
+    thread_t tid_checkpoint;
+    int ckpt_on;
+    struct handle_pool pool;
+    int pool_slot = -1;
+    uint64_t pool_wait_us;
+    Db **shared_db = NULL;
+    struct bench_window *w_begin = NULL, *w_end = NULL;
+    uint64_t begin_us, end_us;
+    uint64_t stats_next_us = 0;
+    struct couch_engine_stats stats_cur, stats_prev;
+    struct pregen_args *g_args = NULL;
+    thread_t *tid_pregen = NULL;
+    struct pregen_ring **rings = NULL;
+    int nrings = 0, npregen = 0;
+    struct group_commit *gcs = NULL;
+    Db **gc_db = NULL;
 
     memleak_start();
 
@@ -1106,13 +3193,26 @@ void do_bench(struct bench_info *binfo)
 
     written_init = written_final = 0;
 
-#if !defined(__COUCH_BENCH)
-    couchstore_set_cache(binfo->cache_size);
-#endif
-#if defined(__FDB_BENCH)
-    couchstore_set_compaction(binfo->auto_compaction, binfo->compact_thres);
-    couchstore_set_wal_size(binfo->fdb_wal);
-#endif
+    if (engine->set_cache) {
+        engine->set_cache(binfo->cache_size);
+    }
+    if (engine->set_compaction) {
+        engine->set_compaction(binfo->auto_compaction, binfo->compact_thres);
+    }
+    if (engine->set_wal_size) {
+        engine->set_wal_size(binfo->fdb_wal);
+    }
+    if (engine->set_raw_body) {
+        // LevelDB, RocksDB, WiredTiger: value format (must match the files)
+        engine->set_raw_body(binfo->raw_body);
+    }
+    if (engine->set_stats) {
+        // RocksDB, WiredTiger: collect statistics for the sampler
+        engine->set_stats(binfo->stats_filename[0] != 0);
+    }
+    if (engine->set_checkpoint) {
+        engine->set_checkpoint(binfo->ckpt_policy, binfo->ckpt_value);
+    }
 
     if (binfo->initialize) {
         // === initialize and populate files ========
@@ -1130,43 +3230,45 @@ void do_bench(struct bench_info *binfo)
             }
         }
 
-#if defined(__WT_BENCH)
-        // WiredTiger: open connection
-        couchstore_set_idx_type(binfo->wt_type);
-        couchstore_open_conn((char*)binfo->filename);
-#endif
-#if defined(__LEVEL_BENCH) || defined(__ROCKS_BENCH)
-        // LevelDB, RocksDB: set WBS size
-        couchstore_set_wbs_size(binfo->wbs_init);
-#endif
+        if (engine->set_idx_type) {
+            // WiredTiger: B+tree or LSM-tree
+            engine->set_idx_type(binfo->wt_type);
+        }
+        if (engine->set_wbs_size) {
+            // LevelDB, RocksDB: set WBS size
+            engine->set_wbs_size(binfo->wbs_init);
+        }
+        if (engine->set_flags) {
+            // ForestDB: set wal_flush_before_commit flag (0x1),
+            // and enable seq tree (0x2) for snapshot readers
+            engine->set_flags(((binfo->pop_commit)?(0x0):(0x1)) |
+                              ((binfo->nsnapshots)?(0x2):(0x0)));
+        }
+        if ((engine->flags & ENGINE_CONN) || binfo->namespaces) {
+            // WiredTiger, LMDB: open connection (files are tables/sub-DBs)
+            // ForestDB, RocksDB: open the instance holding the namespaces
+            engine->open_conn((char*)binfo->filename);
+        }
 
         for (i=0;i<binfo->nfiles;++i){
             compaction_no[i] = 0;
             sprintf(curfile, "%s%d.%d", binfo->init_filename, i, compaction_no[i]);
-#if defined(__FDB_BENCH)
-            if (!binfo->pop_commit) {
-                // set wal_flush_before_commit flag (0x1)
-                couchstore_set_flags(0x1);
-            }
-#endif
             couchstore_open_db(curfile, COUCHSTORE_OPEN_FLAG_CREATE, &db[i]);
-#if defined(__LEVEL_BENCH) || defined(__ROCKS_BENCH)
-            if (!binfo->pop_commit) {
-                couchstore_set_sync(db[i], 0);
+            if ((engine->flags & ENGINE_SYNC_OPTION) && !binfo->pop_commit) {
+                engine->set_sync(db[i], 0);
             }
-#endif
         }
 
         stopwatch_start(&sw);
         population(db, binfo);
 
 #ifdef __PRINT_IOSTAT
-#if defined(__LEVEL_BENCH) || defined(__ROCKS_BENCH)
-        gap = stopwatch_stop(&sw);
-        LOG_PRINT_TIME(gap, " sec elapsed\n");
-        print_proc_io_stat(cmd);
-        _wait_leveldb_compaction(binfo, db);
-#endif // __LEVEL_BENCH || __ROCKS_BENCH
+        if (engine->flags & ENGINE_BG_COMPACTION) {
+            gap = stopwatch_stop(&sw);
+            LOG_PRINT_TIME(gap, " sec elapsed\n");
+            print_proc_io_stat(cmd);
+            _wait_leveldb_compaction(binfo, db);
+        }
 #endif // __PRINT_IOSTAT
         if (binfo->sync_write) {
             lprintf("flushing disk buffer.. "); fflush(stdout);
@@ -1180,12 +3282,17 @@ void do_bench(struct bench_info *binfo)
         for (i=0;i<binfo->nfiles;++i){
             couchstore_close_db(db[i]);
         }
+        if (binfo->namespaces) {
+            // reopened below with the benchmark configuration,
+            // as the files are
+            engine->close_conn();
+        }
         gap = stopwatch_stop(&sw);
-#if defined(__LEVEL_BENCH) || defined(__ROCKS_BENCH)
 #if defined(__PRINT_IOSTAT)
-        gap.tv_sec -= 3; // subtract waiting time
+        if (engine->flags & ENGINE_BG_COMPACTION) {
+            gap.tv_sec -= 3; // subtract waiting time
+        }
 #endif // __PRINT_IOSTAT
-#endif // __LEVEL_BENCH || __ROCKS_BENCH
         gap_double = gap.tv_sec + (double)gap.tv_usec / 1000000.0;
         LOG_PRINT_TIME(gap, " sec elapsed ");
         lprintf("(%.2f ops/sec)\n", binfo->ndocs / gap_double);
@@ -1197,12 +3304,12 @@ void do_bench(struct bench_info *binfo)
             compaction_no[i] = 0;
         }
 
-#if defined(__WT_BENCH)
-        // for WiredTiger: open connection
-        couchstore_open_conn((char*)binfo->filename);
-#else
-        _dir_scan(binfo, compaction_no);
-#endif
+        if (engine->flags & ENGINE_CONN) {
+            // for WiredTiger and LMDB: open connection
+            engine->open_conn((char*)binfo->filename);
+        } else if (!binfo->namespaces) {
+            _dir_scan(binfo, compaction_no);
+        }
     }
 
     // ==== perform benchmark ====
@@ -1210,19 +3317,27 @@ void do_bench(struct bench_info *binfo)
 
     compaction_turn = 0;
 
-#if defined(__LEVEL_BENCH) || defined(__ROCKS_BENCH)
-    // LevelDB, RocksDB: reset write buffer size
-    couchstore_set_wbs_size(binfo->wbs_bench);
-#endif
-#if defined(__FDB_BENCH)
-    // ForestDB: clear wal_flush_before_commit flag
-    couchstore_set_flags(0x0);
-#endif
+    if (engine->set_wbs_size) {
+        // LevelDB, RocksDB: reset write buffer size
+        engine->set_wbs_size(binfo->wbs_bench);
+    }
+    if (engine->set_flags) {
+        // ForestDB: clear wal_flush_before_commit flag
+        engine->set_flags((binfo->nsnapshots)?(0x2):(0x0));
+    }
+    if (binfo->namespaces) {
+        engine->open_conn((char*)binfo->filename);
+    }
 
-    if (binfo->batch_dist.type == RND_ZIPFIAN) {
-        // zipfian distribution .. initialize zipf_rnd
-        zipf_rnd_init(&zipf, binfo->ndocs / binfo->batch_dist.b,
-                      binfo->batch_dist.a/100.0, 1024*1024);
+    if (binfo->arrival_mode == 2) {
+        d_args.ntrace = _load_arrival_trace(binfo->arrival_trace, &d_args.trace);
+        if (d_args.ntrace == 0) {
+            printf("\nfailed to load arrival trace '%s'\n", binfo->arrival_trace);
+            exit(0);
+        }
+    } else {
+        d_args.trace = NULL;
+        d_args.ntrace = 0;
     }
 
     // set signal handler
@@ -1231,75 +3346,234 @@ void do_bench(struct bench_info *binfo)
     // bench stat init
     b_stat.batch_count = 0;
     b_stat.op_count_read = b_stat.op_count_write = 0;
+    b_stat.op_count_miss = 0;
+    b_stat.op_count_write_pinned = 0;
+    b_stat.snapshot_pinned = 0;
+    stopwatch_init(&b_stat.sw_pinned);
     prev_op_count_read = prev_op_count_write = 0;
     spin_init(&b_stat.lock);
+    if (engine->sync_count) {
+        nsyncs_begin = engine->sync_count();
+    }
 
     // thread args
     if (binfo->nreaders == 0 && binfo->nwriters == 0){
         // create a rw thread
-        bench_threads = 1;
+        bench_threads = 1 + binfo->nsnapshots;
         b_args = alca(struct bench_thread_args, bench_threads);
         bench_worker = alca(thread_t, bench_threads);
-        b_args[0].mode = 0;
+        for (i=0;i<bench_threads;++i){
+            b_args[i].mode = (i == 0)?(0):(3);
+        }
     } else {
-        bench_threads = binfo->nreaders + binfo->nwriters;
+        bench_threads = binfo->nreaders + binfo->nwriters + binfo->nsnapshots;
         b_args = alca(struct bench_thread_args, bench_threads);
         bench_worker = alca(thread_t, bench_threads);
         for (i=0;i<bench_threads;++i){
-            b_args[i].mode = (i < binfo->nwriters)?(1):(2);
+            if (i < binfo->nwriters) {
+                b_args[i].mode = 1;
+            } else if (i < binfo->nwriters + binfo->nreaders) {
+                b_args[i].mode = 2;
+            } else {
+                b_args[i].mode = 3;
+            }
         }
     }
     bench_worker_ret = alca(void*, bench_threads);
+
+    if (engine->flags & ENGINE_INFO_HANDLE) {
+        // ForestDB: open another handle to get DB info
+        for (j=0;j<binfo->nfiles;++j){
+            sprintf(curfile, "%s%d.%d", binfo->filename, j, compaction_no[j]);
+            couchstore_open_db(curfile,
+                               COUCHSTORE_OPEN_FLAG_CREATE |
+                                   ((binfo->sync_write)?(0x10):(0x0)),
+                               &info_handle[j]);
+        }
+    }
+    if (engine->flags & ENGINE_SINGLE_OPEN) {
+        // open only once (multiple open is not allowed)
+        shared_db = (Db**)malloc(sizeof(Db*) * binfo->nfiles);
+        for (j=0;j<binfo->nfiles;++j){
+            sprintf(curfile, "%s%d.%d", binfo->filename, j, compaction_no[j]);
+            couchstore_open_db(curfile, COUCHSTORE_OPEN_FLAG_CREATE, &shared_db[j]);
+            if (engine->flags & ENGINE_SYNC_OPTION) {
+                engine->set_sync(shared_db[j], binfo->sync_write);
+            }
+        }
+    }
+    if (binfo->handle_mode != HANDLE_PER_THREAD) {
+        pool.nslots = (binfo->handle_mode == HANDLE_POOL)?(binfo->handle_pool_size):(1);
+        if (engine->flags & ENGINE_THREAD_SAFE) {
+            // a pool limits the number of threads using the handles at once
+            pool.exclusive = (binfo->handle_mode == HANDLE_POOL);
+        } else {
+            pool.exclusive = 1;
+        }
+        pool.db = (Db***)malloc(sizeof(Db**) * pool.nslots);
+        pool.file_epoch = (uint32_t*)calloc(pool.nslots, sizeof(uint32_t));
+        pool.free_slots = (int*)malloc(sizeof(int) * pool.nslots);
+        for (i=0;i<pool.nslots;++i){
+            if (shared_db) {
+                pool.db[i] = shared_db;
+            } else {
+                pool.db[i] = _open_handles(binfo, compaction_no);
+            }
+            pool.free_slots[i] = i;
+        }
+        pool.nfree = pool.nslots;
+        mutex_init(&pool.lock);
+        thread_cond_init(&pool.cond);
+    }
+    j = 0;
+    for (i=0;i<bench_threads;++i){
+        if (b_args[i].mode == 0 || b_args[i].mode == 1) j++;
+    }
+    _quiesce_init(&quiesce, j);
+    if (binfo->group_commit && binfo->nwriters) {
+        // coordinators write through their own handles
+        if (shared_db) {
+            gc_db = shared_db;
+        } else {
+            gc_db = _open_handles(binfo, compaction_no);
+        }
+        gcs = (struct group_commit *)
+              malloc(sizeof(struct group_commit) * binfo->nfiles);
+        for (j=0;j<binfo->nfiles;++j){
+            _gc_init(&gcs[j], binfo, j, gc_db[j], compaction_no, &quiesce);
+        }
+    }
     for (i=0;i<bench_threads;++i){
         b_args[i].id = i;
         b_args[i].rnd_seed = rnd_seed;
         b_args[i].compaction_no = compaction_no;
         b_args[i].b_stat = &b_stat;
         b_args[i].result = &result;
-        b_args[i].zipf = &zipf;
+        b_args[i].zipf = &binfo->zipf;
         b_args[i].terminate_signal = 0;
-        b_args[i].op_signal = 0;
+        b_args[i].quiesce = &quiesce;
         b_args[i].binfo = binfo;
+        latency_init(&b_args[i].lat_read);
+        latency_init(&b_args[i].lat_read_miss);
+        latency_init(&b_args[i].lat_write);
+        latency_init(&b_args[i].lat_write_pinned);
+        latency_init(&b_args[i].lat_read_ckpt);
+        latency_init(&b_args[i].lat_write_ckpt);
+        b_args[i].scan_docs = b_args[i].scan_passes = 0;
+        b_args[i].scan_us = b_args[i].scan_growth = 0;
+        b_args[i].scan_growth_ratio = 0;
+        b_args[i].scan_growth_us = b_args[i].scan_growth_writes = 0;
+        latency_init(&b_args[i].lat_queue);
+        latency_init(&b_args[i].lat_response);
+        b_args[i].lat_seq = 0;
+        b_args[i].vclients = NULL;
+        if (binfo->vclients && b_args[i].mode != 3) {
+            b_args[i].vclients = (struct vclient_set *)
+                                 malloc(sizeof(struct vclient_set));
+            _vclient_set_init(b_args[i].vclients, binfo,
+                              (uint64_t)rnd_seed * bench_threads + i);
+        }
+        b_args[i].gc = (b_args[i].mode == 0 || b_args[i].mode == 1)?(gcs):(NULL);
+        b_args[i].ring = NULL;
+        if (binfo->pregen_threads && (b_args[i].mode == 0 || b_args[i].mode == 1)) {
+            b_args[i].ring = (struct pregen_ring *)malloc(sizeof(struct pregen_ring));
+            _pregen_ring_init(b_args[i].ring, binfo, &binfo->zipf, rnd_seed + i);
+        }
+        b_args[i].queue = NULL;
+        if (binfo->arrival_mode && b_args[i].mode != 3) {
+            b_args[i].queue = (struct arrival_queue *)
+                              malloc(sizeof(struct arrival_queue));
+            _arrival_queue_init(b_args[i].queue, binfo->arrival_qlen);
+        }
 
         // open db instances
-#if defined(__FDB_BENCH) || defined(__COUCH_BENCH) || defined(__WT_BENCH)
-        b_args[i].db = (Db**)malloc(sizeof(Db*) * binfo->nfiles);
-        for (j=0;j<binfo->nfiles;++j){
-            sprintf(curfile, "%s%d.%d", binfo->filename, j, compaction_no[j]);
-            couchstore_open_db(curfile,
-                               COUCHSTORE_OPEN_FLAG_CREATE |
-                                   ((binfo->sync_write)?(0x10):(0x0)),
-                               &b_args[i].db[j]);
-#if defined(__FDB_BENCH)
-            // ForestDB: open another handle to get DB info
-            if (i==0) {
-                couchstore_open_db(curfile,
-                                   COUCHSTORE_OPEN_FLAG_CREATE |
-                                       ((binfo->sync_write)?(0x10):(0x0)),
-                                   &info_handle[j]);
+        b_args[i].pool = NULL;
+        b_args[i].handle_waits = b_args[i].handle_wait_us = 0;
+        b_args[i].read_bytes = 0;
+        if (shared_db) {
+            b_args[i].db = shared_db;
+            if (b_args[i].mode != 3) {
+                b_args[i].pool = &pool;
             }
-#endif
+        } else if (binfo->handle_mode == HANDLE_PER_THREAD || b_args[i].mode == 3) {
+            b_args[i].db = _open_handles(binfo, compaction_no);
+        } else {
+            b_args[i].db = NULL;
+            b_args[i].pool = &pool;
         }
-#elif defined(__LEVEL_BENCH) || defined(__ROCKS_BENCH)
-        if (i==0) {
-            // open only once (multiple open is not allowed)
-            b_args[i].db = (Db**)malloc(sizeof(Db*) * binfo->nfiles);
-            for (j=0;j<binfo->nfiles;++j){
-                sprintf(curfile, "%s%d.%d", binfo->filename, j, compaction_no[j]);
-                couchstore_open_db(curfile, COUCHSTORE_OPEN_FLAG_CREATE,
-                                   &b_args[i].db[j]);
-                couchstore_set_sync(b_args[i].db[j], binfo->sync_write);
-            }
+        if (b_args[i].mode == 3) {
+            affinity_thread_create(&binfo->affinity, i, &bench_worker[i],
+                                   snapshot_thread, (void*)&b_args[i]);
         } else {
-            b_args[i].db = b_args[0].db;
+            affinity_thread_create(&binfo->affinity, i, &bench_worker[i],
+                                   bench_thread, (void*)&b_args[i]);
+        }
+    }
+
+    if (binfo->pregen_threads) {
+        // generator threads, each serving every npregen-th ring
+        rings = alca(struct pregen_ring *, bench_threads);
+        for (i=0;i<bench_threads;++i){
+            if (b_args[i].ring) rings[nrings++] = b_args[i].ring;
+        }
+        npregen = MIN((int)binfo->pregen_threads, nrings);
+        g_args = alca(struct pregen_args, npregen);
+        tid_pregen = alca(thread_t, npregen);
+        for (i=0;i<npregen;++i){
+            g_args[i].binfo = binfo;
+            g_args[i].rings = alca(struct pregen_ring *, nrings);
+            g_args[i].nrings = 0;
+            for (j=i;j<nrings;j+=npregen){
+                g_args[i].rings[g_args[i].nrings++] = rings[j];
+            }
+            g_args[i].terminate_signal = 0;
+            affinity_thread_create(&binfo->affinity, bench_threads + 3 + i,
+                                   &tid_pregen[i], pregen_thread, (void*)&g_args[i]);
         }
-#endif
-        thread_create(&bench_worker[i], bench_thread, (void*)&b_args[i]);
+    }
+
+    if (binfo->arrival_mode) {
+        d_args.binfo = binfo;
+        d_args.b_args = b_args;
+        d_args.bench_threads = bench_threads;
+        d_args.rnd_seed = rnd_seed;
+        d_args.narrivals = d_args.ndrops = 0;
+        d_args.terminate_signal = 0;
+        affinity_thread_create(&binfo->affinity, bench_threads + 2,
+                               &tid_dispatcher, dispatcher, (void*)&d_args);
+    }
+    if (binfo->search_mode) {
+        s_args.binfo = binfo;
+        s_args.b_args = b_args;
+        s_args.bench_threads = bench_threads;
+        s_args.b_stat = &b_stat;
+        s_args.d_args = &d_args;
+        s_args.rate = binfo->search_start;
+        s_args.points = (struct search_point *)
+                        malloc(sizeof(struct search_point) * 64);
+        s_args.npoints = 0;
+        s_args.done = s_args.terminate_signal = 0;
+        affinity_thread_create(&binfo->affinity, bench_threads,
+                               &tid_search, search_controller, (void*)&s_args);
+    }
+    ckpt_on = (binfo->ckpt_policy == ENGINE_CKPT_MANUAL ||
+               (binfo->ckpt_policy != ENGINE_CKPT_DEFAULT &&
+                engine->checkpoint_running));
+    if (ckpt_on) {
+        memset(&k_args, 0, sizeof(k_args));
+        k_args.binfo = binfo;
+        ckpt_seq = 0;
+        // the compactor's core: engines with checkpoints do not compact
+        affinity_thread_create(&binfo->affinity, bench_threads + 1,
+                               &tid_checkpoint, checkpointer, (void*)&k_args);
     }
 
     gap = stopwatch_stop(&sw);
     LOG_PRINT_TIME(gap, " sec elapsed\n");
 
+    // this thread monitors the run from a slot of its own
+    affinity_set_thread(&binfo->affinity, bench_threads + 3 + npregen);
+
     // timer for total elapsed time
     stopwatch_init(&sw);
     stopwatch_start(&sw);
@@ -1308,8 +3582,27 @@ void do_bench(struct bench_info *binfo)
     stopwatch_init(&progress);
     stopwatch_start(&progress);
 
+    // measurement window starts after warm-up
+    w_begin = (struct bench_window *)malloc(sizeof(struct bench_window));
+    w_end = (struct bench_window *)malloc(sizeof(struct bench_window));
+    begin_us = _get_now_us();
+    w_begin->time_us = 0;
+    if (stats_fp) {
+        _engine_stats_init(&stats_prev);
+        _engine_stats_print_header(stats_fp);
+    }
+    if (binfo->warmup_secs == 0) {
+        _bench_window_mark(w_begin, b_args, bench_threads, &b_stat, begin_us);
+    }
+
     i = 0;
     while (i<binfo->nbatches || binfo->nbatches == 0) {
+        if (w_begin->time_us == 0 &&
+            _get_now_us() - begin_us >= binfo->warmup_secs * 1000000) {
+            _bench_window_mark(w_begin, b_args, bench_threads, &b_stat,
+                               _get_now_us());
+        }
+
         spin_lock(&b_stat.lock);
         op_count_read = b_stat.op_count_read;
         op_count_write = b_stat.op_count_write;
@@ -1322,8 +3615,7 @@ void do_bench(struct bench_info *binfo)
             // for every 0.1 sec, print current status
             uint64_t cur_size;
             int cpt_no;
-            Db *temp_db;
-            couchstore_error_t err;
+            Db *temp_db, **temp_dbs;
 
             // reset stopwatch for the next period
             stopwatch_init(&progress);
@@ -1332,15 +3624,40 @@ void do_bench(struct bench_info *binfo)
             spin_lock(&cur_compaction_lock);
             curfile_no = compaction_turn;
             compaction_turn = (compaction_turn + 1) % binfo->nfiles;
-#ifdef __FDB_BENCH
-            temp_db = info_handle[curfile_no];
-#else
-            temp_db = b_args[0].db[curfile_no];
-#endif
+            if (engine->flags & ENGINE_INFO_HANDLE) {
+                temp_dbs = info_handle;
+            } else {
+                temp_dbs = b_args[0].db;
+            }
+            temp_db = (temp_dbs)?(temp_dbs[curfile_no]):(NULL);
             cpt_no = compaction_no[curfile_no] - ((curfile_no == cur_compaction)?(1):(0));
             spin_unlock(&cur_compaction_lock);
 
+            if (!temp_db) {
+                // bench threads use shared handles: borrow one
+                pool_slot = _handle_pool_get(&pool, &pool_wait_us);
+                if (pool.exclusive &&
+                    _quiesce_reopen_needed(&quiesce, &pool.file_epoch[pool_slot])) {
+                    _reopen_handles(binfo, pool.db[pool_slot], compaction_no);
+                }
+                temp_dbs = pool.db[pool_slot];
+                temp_db = temp_dbs[curfile_no];
+            }
+
             couchstore_db_info(temp_db, dbinfo);
+            if (stats_fp && _get_now_us() >= stats_next_us) {
+                stats_next_us = _get_now_us() + ENGINE_STATS_INTERVAL_US;
+                _engine_stats_init(&stats_cur);
+                engine->get_stats(temp_dbs, binfo->nfiles, &stats_cur);
+                _engine_stats_print(stats_fp,
+                                    (_get_now_us() - begin_us) / 1000000.0,
+                                    &stats_cur, &stats_prev);
+                stats_prev = stats_cur;
+            }
+            if (pool_slot >= 0) {
+                _handle_pool_put(&pool, pool_slot);
+                pool_slot = -1;
+            }
             if (binfo->auto_compaction) {
                 // auto compaction
                 strcpy(curfile, dbinfo->filename);
@@ -1354,7 +3671,11 @@ void do_bench(struct bench_info *binfo)
             stopwatch_stop(&sw);
             printf("\r");
 
-            if (binfo->nbatches > 0) {
+            if (binfo->search_mode) {
+                printf("(target %d /sec, ", (int)s_args.rate);
+                gap = sw.elapsed;
+                PRINT_TIME(gap, " s, ");
+            }else if (binfo->nbatches > 0) {
                 printf("%5.1f %% (", i*100.0 / (binfo->nbatches-1));
                 gap = sw.elapsed;
                 PRINT_TIME(gap, " s, ");
@@ -1362,7 +3683,7 @@ void do_bench(struct bench_info *binfo)
                 printf("(");
                 gap = sw.elapsed;
                 PRINT_TIME(gap, " s / ");
-                printf("%d s, ", (int)binfo->bench_secs);
+                printf("%d s, ", (int)(binfo->bench_secs + binfo->warmup_secs));
             }else {
                 printf("%5.1f %% (",
                        (op_count_read+op_count_write)*100.0 / (binfo->nops-1));
@@ -1406,9 +3727,9 @@ void do_bench(struct bench_info *binfo)
             }
 
             print_filesize_approx(dbinfo->space_used, fsize2);
-#if !defined(__WT_BENCH)
-            printf(" (%s / %s)", fsize1, fsize2);
-#endif
+            if (!(engine->flags & ENGINE_CONN) && !binfo->namespaces) {
+                printf(" (%s / %s)", fsize1, fsize2);
+            }
             fflush(stdout);
 
             stopwatch_start(&sw);
@@ -1442,39 +3763,13 @@ void do_bench(struct bench_info *binfo)
                     }
                     fflush(stdout);
 
-#ifdef __COUCH_BENCH
-                    int signal_count = 0;
-                    int bench_nrs = 0;
-
-                    for (j=0; j<bench_threads; ++j) {
-                        if (b_args[j].mode != 2) {
-                            // close all non-readers
-                            bench_nrs++;
-                            b_args[j].op_signal |= OP_CLOSE;
-                        }
-                    }
-                    while (signal_count < bench_nrs) {
-                        signal_count = 0;
-                        usleep(10000);
-                        for (j=0;j<bench_threads;++j){
-                            if (b_args[j].op_signal & OP_CLOSE_OK) {
-                                signal_count++;
-                            }
-                        }
+                    c_args.flag = 0;
+                    if (engine->flags & ENGINE_COMPACT_EXCLUSIVE) {
+                        // wait until all writers are out of their batches
+                        _quiesce_request(&quiesce);
+                        c_args.flag = 1;
                     }
-
-                    c_args.flag = 1;
-                    c_args.binfo = binfo;
-                    c_args.curfile = curfile;
-                    c_args.newfile = newfile;
-                    c_args.sw_compaction = &sw_compaction;
-                    c_args.cur_compaction = &cur_compaction;
-                    c_args.bench_threads = bench_threads;
-                    c_args.b_args = b_args;
-                    c_args.lock = &cur_compaction_lock;
-                    thread_create(&tid_compactor, compactor, &c_args);
-#endif
-#ifdef __FDB_BENCH
+                    c_args.quiesce = &quiesce;
                     c_args.binfo = binfo;
                     c_args.curfile = curfile;
                     c_args.newfile = newfile;
@@ -1483,9 +3778,8 @@ void do_bench(struct bench_info *binfo)
                     c_args.bench_threads = bench_threads;
                     c_args.b_args = b_args;
                     c_args.lock = &cur_compaction_lock;
-                    c_args.flag = 0;
-                    thread_create(&tid_compactor, compactor, &c_args);
-#endif
+                    affinity_thread_create(&binfo->affinity, bench_threads + 1,
+                                           &tid_compactor, compactor, &c_args);
                 } else {
                     spin_unlock(&cur_compaction_lock);
                 }
@@ -1493,7 +3787,7 @@ void do_bench(struct bench_info *binfo)
                 spin_unlock(&cur_compaction_lock);
             }
 
-            if (sw.elapsed.tv_sec >= binfo->bench_secs &&
+            if ((size_t)sw.elapsed.tv_sec >= binfo->bench_secs + binfo->warmup_secs &&
                 binfo->bench_secs > 0) break;
 
             stopwatch_start(&progress);
@@ -1503,18 +3797,33 @@ void do_bench(struct bench_info *binfo)
             usleep(100000);
         }
 
-next_loop:
         if ((op_count_read + op_count_write) >= binfo->nops &&
             binfo->nops > 0) break;
 
         if (got_signal) {
             break;
         }
+        if (binfo->search_mode && s_args.done) {
+            break;
+        }
     }
 
-    // terminate all bench_worker threads
+    end_us = _get_now_us();
+
+    // terminate search controller, dispatcher and all bench_worker threads
+    if (binfo->search_mode) {
+        s_args.terminate_signal = 1;
+        thread_join(tid_search, &dispatcher_ret);
+    }
+    if (binfo->arrival_mode) {
+        d_args.terminate_signal = 1;
+        thread_join(tid_dispatcher, &dispatcher_ret);
+    }
     for (i=0;i<bench_threads;++i){
         b_args[i].terminate_signal = 1;
+        if (b_args[i].queue) {
+            _arrival_queue_close(b_args[i].queue);
+        }
     }
 
     lprintf("\n");
@@ -1526,6 +3835,15 @@ next_loop:
     for (i=0;i<bench_threads;++i){
         thread_join(bench_worker[i], &bench_worker_ret[i]);
     }
+    affinity_reset_thread(&binfo->affinity);
+    for (i=0;i<npregen;++i){
+        g_args[i].terminate_signal = 1;
+        thread_join(tid_pregen[i], &dispatcher_ret);
+    }
+    if (ckpt_on) {
+        k_args.terminate_signal = 1;
+        thread_join(tid_checkpoint, &dispatcher_ret);
+    }
 
     // waiting for unterminated compactor & bench workers
     if (cur_compaction != -1) {
@@ -1534,23 +3852,352 @@ next_loop:
         thread_join(tid_compactor, &compactor_ret);
     }
 
-    lprintf("%d reads (%.2f ops/sec)\n"
-            "%d writes (%.2f ops/sec)\n",
-            op_count_read, (double)op_count_read / gap_double,
-            op_count_write, (double)op_count_write / gap_double);
+    lprintf("%d reads (%.2f ops/sec)\n"
+            "%d writes (%.2f ops/sec)\n",
+            op_count_read, (double)op_count_read / gap_double,
+            op_count_write, (double)op_count_write / gap_double);
+    if (engine->sync_count) {
+        // separate files sync their own logs, namespaces and connection
+        // engines share one log for all files
+        nsyncs = engine->sync_count() - nsyncs_begin;
+        lprintf("%"_F64" fsyncs (%.2f per sec, %.1f writes per fsync, %s)\n",
+                nsyncs, (double)nsyncs / gap_double,
+                (nsyncs)?((double)op_count_write / nsyncs):(0),
+                (binfo->namespaces || (engine->flags & ENGINE_CONN))?
+                    ("one log for all files"):("one log per file"));
+    }
+    if (binfo->miss_prob) {
+        lprintf("%d reads of missing keys (%.1f %%)\n", (int)b_stat.op_count_miss,
+                (op_count_read)?(b_stat.op_count_miss * 100.0 / op_count_read):(0));
+    }
+    {
+        struct latency_stat lat_read, lat_read_miss;
+        struct latency_stat lat_write, lat_write_pinned;
+
+        latency_init(&lat_read);
+        latency_init(&lat_read_miss);
+        latency_init(&lat_write);
+        latency_init(&lat_write_pinned);
+        for (i=0;i<bench_threads;++i){
+            latency_merge(&lat_read, &b_args[i].lat_read);
+            latency_merge(&lat_read_miss, &b_args[i].lat_read_miss);
+            latency_merge(&lat_write, &b_args[i].lat_write);
+            latency_merge(&lat_write_pinned, &b_args[i].lat_write_pinned);
+        }
+        _print_latency("read latency", &lat_read);
+        if (op_count_read) {
+            uint64_t read_bytes = 0;
+            for (i=0;i<bench_threads;++i){
+                read_bytes += b_args[i].read_bytes;
+            }
+            lprintf("read values: %s (%.1f MB/s), %s\n",
+                    print_filesize_approx(read_bytes, bodybuf),
+                    (double)read_bytes / gap_double / (1024*1024),
+                    (binfo->read_ref)?("read in place (zero-copy)"):
+                                      ("copied and freed"));
+        }
+        if (binfo->miss_prob) {
+            _print_latency("read latency (miss)", &lat_read_miss);
+        }
+        if (binfo->nsnapshots) {
+            _print_latency("write batch latency (no snapshot)", &lat_write);
+            _print_latency("write batch latency (snapshot held)", &lat_write_pinned);
+        } else {
+            _print_latency("write batch latency", &lat_write);
+        }
+    }
+    if (ckpt_on) {
+        uint64_t ckpt_us = 0, ckpt_max = 0;
+        struct latency_stat lat_read, lat_write;
+        struct latency_stat lat_read_ckpt, lat_write_ckpt;
+
+        for (j=0;j<k_args.n;++j){
+            ckpt_us += k_args.end_us[j] - k_args.begin_us[j];
+            ckpt_max = MAX(ckpt_max, k_args.end_us[j] - k_args.begin_us[j]);
+        }
+        lprintf("\n%d checkpoints, %.1f %% of the time (avg %.1f ms, max %.1f ms)\n",
+                k_args.n, ckpt_us * 100.0 / (end_us - begin_us),
+                (k_args.n)?(ckpt_us / 1000.0 / k_args.n):(0), ckpt_max / 1000.0);
+        for (j=0;j<k_args.n;++j){
+            lprintf("checkpoint #%d: %.3f - %.3f sec\n", j+1,
+                    (double)((int64_t)(k_args.begin_us[j] - begin_us)) / 1000000,
+                    (double)((int64_t)(k_args.end_us[j] - begin_us)) / 1000000);
+        }
+
+        latency_init(&lat_read);
+        latency_init(&lat_write);
+        latency_init(&lat_read_ckpt);
+        latency_init(&lat_write_ckpt);
+        for (i=0;i<bench_threads;++i){
+            latency_merge(&lat_read, &b_args[i].lat_read);
+            latency_merge(&lat_write, &b_args[i].lat_write);
+            latency_merge(&lat_write, &b_args[i].lat_write_pinned);
+            latency_merge(&lat_read_ckpt, &b_args[i].lat_read_ckpt);
+            latency_merge(&lat_write_ckpt, &b_args[i].lat_write_ckpt);
+        }
+        latency_sub(&lat_read, &lat_read_ckpt);
+        latency_sub(&lat_write, &lat_write_ckpt);
+        _print_latency("read latency (during checkpoints)", &lat_read_ckpt);
+        _print_latency("read latency (between checkpoints)", &lat_read);
+        _print_latency("write batch latency (during checkpoints)", &lat_write_ckpt);
+        _print_latency("write batch latency (between checkpoints)", &lat_write);
+        free(k_args.begin_us);
+        free(k_args.end_us);
+    }
+    if (gcs) {
+        int b;
+        uint64_t ncommits = 0, nrequests = 0, ndocs = 0;
+        uint64_t hist[GC_HIST_NBUCKETS];
+        struct latency_stat lat_commit;
+
+        memset(hist, 0, sizeof(hist));
+        latency_init(&lat_commit);
+        for (j=0;j<binfo->nfiles;++j){
+            ncommits += gcs[j].ncommits;
+            nrequests += gcs[j].nrequests;
+            ndocs += gcs[j].ndocs;
+            for (b=0;b<GC_HIST_NBUCKETS;++b){
+                hist[b] += gcs[j].hist[b];
+            }
+            latency_merge(&lat_commit, &gcs[j].lat_commit);
+        }
+        lprintf("group commit: %"_F64" commits (%.1f commits/sec%s), "
+                "%.2f writers and %.1f docs per commit\n",
+                ncommits, ncommits / gap_double,
+                (binfo->sync_write)?(", one fsync each"):(", no fsync"),
+                (ncommits)?((double)nrequests / ncommits):(0),
+                (ncommits)?((double)ndocs / ncommits):(0));
+        lprintf("writers per commit:");
+        for (b=0;b<GC_HIST_NBUCKETS;++b){
+            if (hist[b] == 0) continue;
+            if (b == 0) {
+                lprintf(" 1");
+            } else if (b == GC_HIST_NBUCKETS-1) {
+                lprintf(" %d+", 1 << b);
+            } else {
+                lprintf(" %d-%d", 1 << b, (2 << b) - 1);
+            }
+            lprintf(": %.1f%%", hist[b] * 100.0 / ncommits);
+        }
+        lprintf("\n");
+        _print_latency("group commit latency (write + commit)", &lat_commit);
+    }
+    if (binfo->vclients) {
+        int nthreads = 0;
+        uint64_t nbatches = 0, sum_us = 0, max_us = 0;
+        double rate, rate_min = -1, rate_max = 0, avg_us, avg_max_us = 0;
+        struct latency_stat lat_response;
+        struct vclient *vc;
+
+        latency_init(&lat_response);
+        for (i=0;i<bench_threads;++i){
+            if (!b_args[i].vclients) continue;
+            nthreads++;
+            latency_merge(&lat_response, &b_args[i].lat_response);
+            for (j=0;j<(int)b_args[i].vclients->n;++j){
+                vc = &b_args[i].vclients->clients[j];
+                nbatches += vc->nbatches;
+                sum_us += vc->sum_us;
+                if (vc->max_us > max_us) max_us = vc->max_us;
+                rate = vc->nbatches / gap_double;
+                if (rate_min < 0 || rate < rate_min) rate_min = rate;
+                if (rate > rate_max) rate_max = rate;
+                avg_us = (vc->nbatches)?((double)vc->sum_us / vc->nbatches):(0);
+                if (avg_us > avg_max_us) avg_max_us = avg_us;
+            }
+        }
+        lprintf("%d logical clients (%d per thread on %d threads), "
+                "%.2f batches/sec\n",
+                (int)binfo->vclients * nthreads, (int)binfo->vclients, nthreads,
+                nbatches / gap_double);
+        lprintf("batches/sec per client: %.2f min, %.2f avg, %.2f max\n",
+                rate_min, nbatches / gap_double / (binfo->vclients * nthreads),
+                rate_max);
+        // Little's law: clients in a batch (not thinking) on average
+        lprintf("clients in a batch: %.1f on average, "
+                "slowest client mean response %.1f us\n",
+                (double)sum_us / 1000000 / gap_double, avg_max_us);
+        _print_latency("client response time (waiting + service)", &lat_response);
+    }
+    if (binfo->handle_mode != HANDLE_PER_THREAD && pool.exclusive) {
+        uint64_t waits = 0, wait_us = 0;
+
+        for (i=0;i<bench_threads;++i){
+            waits += b_args[i].handle_waits;
+            wait_us += b_args[i].handle_wait_us;
+        }
+        lprintf("handle %s: %"_F64" of %"_F64" batches waited for a handle, "
+                "%.3f sec in total (%.1f us per wait)\n",
+                (binfo->handle_mode == HANDLE_POOL)?("pool"):("lock"),
+                waits, (uint64_t)b_stat.batch_count, (double)wait_us / 1000000,
+                (waits)?((double)wait_us / waits):(0));
+    }
+    if (nrings) {
+        uint64_t gen_us = 0, gen_batches = 0;
+        uint64_t wait_us = 0, nwaits = 0, nbatches = 0;
+
+        for (i=0;i<nrings;++i){
+            gen_us += rings[i]->gen_us;
+            gen_batches += rings[i]->gen_batches;
+            wait_us += rings[i]->wait_us;
+            nwaits += rings[i]->nwaits;
+            nbatches += rings[i]->nbatches;
+        }
+        lprintf("write batch generation: %.1f us per batch "
+                "(%d generator thread%s, not included in write latency)\n",
+                (gen_batches)?((double)gen_us / gen_batches):(0),
+                npregen, (npregen>1)?("s"):(""));
+        lprintf("bench threads waited for the generator: %"_F64" of %"_F64
+                " batches, %.3f sec in total (%.1f us per batch)\n",
+                nwaits, nbatches, (double)wait_us / 1000000,
+                (nbatches)?((double)wait_us / nbatches):(0));
+    }
+    if (binfo->nsnapshots) {
+        uint64_t scan_docs = 0, scan_passes = 0, scan_us = 0, scan_growth = 0;
+        uint64_t scan_growth_us = 0, scan_growth_writes = 0;
+        uint64_t op_pinned = b_stat.op_count_write_pinned;
+        double scan_growth_ratio = 0, pinned_sec;
+
+        for (i=0;i<bench_threads;++i){
+            if (b_args[i].mode != 3) continue;
+            scan_docs += b_args[i].scan_docs;
+            scan_passes += b_args[i].scan_passes;
+            scan_us += b_args[i].scan_us;
+            if (b_args[i].scan_growth > scan_growth) {
+                scan_growth = b_args[i].scan_growth;
+                scan_growth_ratio = b_args[i].scan_growth_ratio;
+                scan_growth_us = b_args[i].scan_growth_us;
+                scan_growth_writes = b_args[i].scan_growth_writes;
+            }
+        }
+        pinned_sec = b_stat.sw_pinned.elapsed.tv_sec +
+                     (double)b_stat.sw_pinned.elapsed.tv_usec / 1000000.0;
+        if (pinned_sec > gap_double) pinned_sec = gap_double;
+
+        lprintf("snapshot scan: %d full pass%s, %"_F64" docs "
+                "(%.2f docs/sec per reader)\n",
+                (int)scan_passes, (scan_passes>1)?("es"):(""), scan_docs,
+                (scan_us)?((double)scan_docs * 1000000 / scan_us):(0));
+        // a rate over less than SNAPSHOT_MIN_RATE_SEC means nothing
+        if (pinned_sec >= SNAPSHOT_MIN_RATE_SEC) {
+            sprintf(fsize1, "%.2f", op_pinned / pinned_sec);
+        } else {
+            strcpy(fsize1, "-");
+        }
+        if (gap_double - pinned_sec >= SNAPSHOT_MIN_RATE_SEC) {
+            sprintf(fsize2, "%.2f",
+                    (op_count_write - op_pinned) / (gap_double - pinned_sec));
+        } else {
+            strcpy(fsize2, "-");
+        }
+        lprintf("snapshot held for %.1f of %.1f sec, writes: "
+                "%s ops/sec (held), %s ops/sec (not held)\n",
+                pinned_sec, gap_double, fsize1, fsize2);
+        lprintf("max DB size growth while a snapshot is held: %s",
+                print_filesize_approx(scan_growth, bodybuf));
+        if (scan_growth) {
+            lprintf(" (%.2fx) over a %.1f sec hold, %"_F64" docs written meanwhile",
+                    scan_growth_ratio, scan_growth_us / 1000000.0,
+                    scan_growth_writes);
+        }
+        lprintf("\n");
+    }
+    if (binfo->arrival_mode) {
+        uint64_t len_sum = 0, len_max = 0, nqueued = 0;
+        struct latency_stat lat_queue, lat_response;
+
+        latency_init(&lat_queue);
+        latency_init(&lat_response);
+        for (i=0;i<bench_threads;++i){
+            if (!b_args[i].queue) continue;
+            len_sum += b_args[i].queue->len_sum;
+            len_max = MAX(len_max, b_args[i].queue->len_max);
+            nqueued += b_args[i].queue->tail - b_args[i].queue->head;
+            latency_merge(&lat_queue, &b_args[i].lat_queue);
+            latency_merge(&lat_response, &b_args[i].lat_response);
+        }
+        lprintf("%"_F64" arrivals (%.2f /sec), %"_F64" dropped (%.2f %%), "
+                "%"_F64" still queued at exit\n",
+                d_args.narrivals, d_args.narrivals / gap_double,
+                d_args.ndrops,
+                (d_args.narrivals)?(d_args.ndrops * 100.0 / d_args.narrivals):(0),
+                nqueued);
+        lprintf("queue length at arrival: avg %.2f, max %d (limit %d)\n",
+                (d_args.narrivals)?((double)len_sum / d_args.narrivals):(0),
+                (int)len_max, (int)binfo->arrival_qlen);
+        _print_latency("queueing delay", &lat_queue);
+        _print_latency("response time (queueing + service)", &lat_response);
+    }
+    if (binfo->search_mode) {
+        int knee = -1;
+        const char *unit = (binfo->arrival_mode)?("req/sec"):("ops/sec");
+
+        qsort(s_args.points, s_args.npoints, sizeof(struct search_point),
+              _search_point_cmp);
+        lprintf("\nthroughput-latency curve (%s p99 SLO: %d us)\n",
+                (binfo->slo_metric == 0)?("read"):
+                ((binfo->slo_metric == 1)?("write batch"):("response time")),
+                (int)binfo->slo_p99_us);
+        lprintf("%12s %12s %10s %10s %8s\n",
+                "target", "achieved", "p50 (us)", "p99 (us)", "drop %");
+        for (i=0;i<s_args.npoints;++i){
+            struct search_point *pt = &s_args.points[i];
+            lprintf("%12d %12.1f %10d %10d %8.2f %s\n",
+                    (int)pt->target, pt->achieved, (int)pt->p50, (int)pt->p99,
+                    pt->drop, (pt->pass)?(""):("*"));
+            if (pt->pass) knee = i;
+        }
+        if (knee >= 0) {
+            lprintf("knee point: %d %s (achieved %.1f, p99 %d us)\n",
+                    (int)s_args.points[knee].target, unit,
+                    s_args.points[knee].achieved, (int)s_args.points[knee].p99);
+        } else {
+            lprintf("no target rate met the SLO\n");
+        }
+        free(s_args.points);
+    }
 
     lprintf("total %d operations (%.2f ops/sec) performed\n",
             op_count_read + op_count_write,
              (double)(op_count_read + op_count_write) / gap_double);
 
-#if defined(__FDB_BENCH) || defined(__COUCH_BENCH)
+    if (w_begin->time_us) {
+        struct bench_summary sm;
+
+        _bench_window_mark(w_end, b_args, bench_threads, &b_stat, end_us);
+        _bench_window_summary(w_begin, w_end, &sm);
+        sm.nreaders = binfo->nreaders;
+        sm.nwriters = binfo->nwriters;
+        if (binfo->warmup_secs) {
+            lprintf("after %d s warm-up: %.2f ops/sec, p99 read %d us, "
+                    "p99 write batch %d us, %.1f CPU us/op\n",
+                    (int)binfo->warmup_secs, sm.ops_per_sec,
+                    (int)sm.p99_read, (int)sm.p99_write, sm.cpu_us_per_op);
+        }
+        if (summary) {
+            *summary = sm;
+        }
+    } else if (summary) {
+        // terminated during warm-up
+        memset(summary, 0, sizeof(struct bench_summary));
+        summary->nreaders = binfo->nreaders;
+        summary->nwriters = binfo->nwriters;
+    }
+    free(w_begin);
+    free(w_end);
+
     if (!binfo->auto_compaction) {
         // manual compaction
         lprintf("compaction : occurred %d time%s, ",
                 total_compaction, (total_compaction>1)?("s"):(""));
         LOG_PRINT_TIME(sw_compaction.elapsed, " sec elapsed\n");
+        for (i=0;i<(int)quiesce.nrecords;++i){
+            lprintf("  C#%d: writers paused for %.1f ms "
+                    "(%.1f ms to drain in-flight batches)\n", i+1,
+                    quiesce.records[i].pause_us / 1000.0,
+                    quiesce.records[i].drain_us / 1000.0);
+        }
     }
-#endif
 
     written_final = print_proc_io_stat(cmd);
 #if defined(__PRINT_IOSTAT)
@@ -1562,11 +4209,7 @@ next_loop:
         if (op_count_write) {
             lprintf("total %"_F64" bytes (%s) written during benchmark\n", written,
                     print_filesize_approx((written_final - written_init), bodybuf));
-            if (binfo->bodylen.type == RND_NORMAL) {
-                avg_docsize = binfo->bodylen.a;
-            } else {
-                avg_docsize = (binfo->bodylen.a + binfo->bodylen.b)/2;
-            }
+            avg_docsize = get_random_avg(&binfo->bodylen);
             lprintf("average disk write throughput: %.2f MB/s\n",
                     (double)written / (gap.tv_sec*1000000 + gap.tv_usec) *
                         1000000 / (1024*1024));
@@ -1576,44 +4219,85 @@ next_loop:
         }
     }
 #endif
-
-    lprintf("\n");
-
-    keygen_free(&binfo->keygen);
-    if (binfo->batch_dist.type == RND_ZIPFIAN) {
-        zipf_rnd_free(&zipf);
+    {
+        // separate files vs. namespaces: per-instance caches and buffers
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        lprintf("peak memory usage (RSS): %s\n",
+                print_filesize_approx((uint64_t)ru.ru_maxrss * 1024, bodybuf));
     }
 
-#ifdef __FDB_BENCH
-    // print ForestDB's own block cache info (internal function call)
-    //bcache_print_items();
-#endif
+    lprintf("\n");
 
     printf("waiting for termination of DB module..\n");
-#if defined(__FDB_BENCH) || defined(__COUCH_BENCH) || defined(__WT_BENCH)
     for (i=0;i<bench_threads;++i){
+        if (!b_args[i].db || b_args[i].db == shared_db) continue;
         for (j=0;j<binfo->nfiles;++j){
             couchstore_close_db(b_args[i].db[j]);
-#ifdef __FDB_BENCH
-            if (i==0) {
-                couchstore_close_db(info_handle[j]);
-            }
-#endif
         }
         free(b_args[i].db);
     }
-#elif defined(__LEVEL_BENCH) || defined(__ROCKS_BENCH)
-    for (j=0;j<binfo->nfiles;++j){
-        couchstore_close_db(b_args[0].db[j]);
+    if (binfo->handle_mode != HANDLE_PER_THREAD && !shared_db) {
+        for (i=0;i<pool.nslots;++i){
+            for (j=0;j<binfo->nfiles;++j){
+                couchstore_close_db(pool.db[i][j]);
+            }
+            free(pool.db[i]);
+        }
+    }
+    if (gc_db && gc_db != shared_db) {
+        for (j=0;j<binfo->nfiles;++j){
+            // may have been reopened after compaction
+            couchstore_close_db(gcs[j].db);
+        }
+        free(gc_db);
+    }
+    if (engine->flags & ENGINE_INFO_HANDLE) {
+        for (j=0;j<binfo->nfiles;++j){
+            couchstore_close_db(info_handle[j]);
+        }
+    }
+    if (shared_db) {
+        for (j=0;j<binfo->nfiles;++j){
+            couchstore_close_db(shared_db[j]);
+        }
+        free(shared_db);
+    }
+    if (gcs) {
+        for (j=0;j<binfo->nfiles;++j){
+            _gc_free(&gcs[j]);
+        }
+        free(gcs);
+    }
+    if (binfo->handle_mode != HANDLE_PER_THREAD) {
+        free(pool.db);
+        free(pool.file_epoch);
+        free(pool.free_slots);
+        thread_cond_destroy(&pool.cond);
+        mutex_destroy(&pool.lock);
     }
-    free(b_args[0].db);
-#endif
 
-#if defined(__WT_BENCH) || defined(__FDB_BENCH)
-    couchstore_close_conn();
-#endif
+    if (engine->close_conn) {
+        engine->close_conn();
+    }
 
+    for (i=0;i<bench_threads;++i){
+        if (b_args[i].queue) {
+            _arrival_queue_free(b_args[i].queue);
+            free(b_args[i].queue);
+        }
+        if (b_args[i].ring) {
+            _pregen_ring_free(b_args[i].ring);
+            free(b_args[i].ring);
+        }
+        if (b_args[i].vclients) {
+            _vclient_set_free(b_args[i].vclients);
+            free(b_args[i].vclients);
+        }
+    }
+    free(d_args.trace);
     free(dbinfo);
+    _quiesce_free(&quiesce);
 
     _bench_result_print(&result);
     _bench_result_free(&result);
@@ -1621,25 +4305,91 @@ next_loop:
     memleak_end();
 }
 
+char * _rnd_str(struct rndinfo *ri, char *buf)
+{
+    switch(ri->type) {
+    case RND_NORMAL:
+        sprintf(buf, "Norm(%d,%d)", (int)ri->a, (int)ri->b);
+        break;
+    case RND_LOGNORMAL:
+        sprintf(buf, "LogNorm(%d,%.2f)", (int)ri->a, ri->b/100.0);
+        break;
+    case RND_PARETO:
+        sprintf(buf, "Pareto(%d,%.2f)", (int)ri->a, ri->b/100.0);
+        break;
+    case RND_BIMODAL:
+        sprintf(buf, "Bimodal(%d,%d / %d,%d, %d %%)",
+                (int)ri->a, (int)ri->b, (int)ri->c, (int)ri->d, (int)ri->e);
+        break;
+    case RND_EMPIRICAL:
+        sprintf(buf, "Empirical(%d buckets, avg %.1f)",
+                (int)ri->emp->n, ri->emp->avg);
+        break;
+    default:
+        sprintf(buf, "Uniform(%d,%d)", (int)ri->a, (int)ri->b);
+        break;
+    }
+    return buf;
+}
+
+void _print_affinity(struct affinity *aff)
+{
+    int i, n, node, cpu;
+    int *list;
+    char *buf;
+    const char *policy_str[] = {"none", "compact", "scatter", "list"};
+    const char *mempolicy_str[] = {"default", "local", "interleave", "bind"};
+
+    if (aff->policy == AFFINITY_NONE && aff->mempolicy == MEMPOLICY_DEFAULT) {
+        return;
+    }
+
+    list = (int *)malloc(sizeof(int) * AFFINITY_MAX_CPUS);
+    buf = (char *)malloc(AFFINITY_MAX_CPUS * 12);
+
+    lprintf("NUMA topology: %d node(s), %d CPU(s)\n", aff->nnodes, aff->ncpus);
+    for (node=0; node<aff->nnodes; ++node){
+        n = 0;
+        for (cpu=0; cpu<AFFINITY_MAX_CPUS; ++cpu){
+            if (aff->cpu_node[cpu] == node) list[n++] = cpu;
+        }
+        if (n) {
+            lprintf("  node %d: CPU %s\n", node, affinity_list_str(list, n, buf));
+        }
+    }
+
+    lprintf("thread affinity: %s", policy_str[aff->policy]);
+    if (aff->policy != AFFINITY_NONE) {
+        n = MIN(aff->norder, 16);
+        lprintf(" (thread slot -> CPU:");
+        for (i=0;i<n;++i){
+            lprintf(" %d", aff->order[i]);
+        }
+        lprintf("%s)", (aff->norder > n)?(" ..."):(""));
+    }
+    lprintf("\n");
+
+    lprintf("memory policy: %s", mempolicy_str[aff->mempolicy]);
+    if (aff->mempolicy == MEMPOLICY_INTERLEAVE ||
+        aff->mempolicy == MEMPOLICY_BIND) {
+        n = 0;
+        for (node=0; node<AFFINITY_MAX_NODES; ++node){
+            if (aff->node_mask & ((uint64_t)1 << node)) list[n++] = node;
+        }
+        lprintf(" (node %s)", affinity_list_str(list, n, buf));
+    }
+    lprintf("\n");
+
+    free(list);
+    free(buf);
+}
+
 void _print_benchinfo(struct bench_info *binfo)
 {
     char tempstr[256];
 
     lprintf("\n === benchmark configuration ===\n");
-    lprintf("DB module: ");
-#ifdef __FDB_BENCH
-    lprintf("ForestDB\n");
-#elif __COUCH_BENCH
-    lprintf("Couchstore\n");
-#elif __LEVEL_BENCH
-    lprintf("LevelDB\n");
-#elif __ROCKS_BENCH
-    lprintf("RocksDB\n");
-#elif __WT_BENCH
-    lprintf("WiredTiger\n");
-#else
-    lprintf("unknown\n");
-#endif
+    lprintf("DB module: %s\n", engine->desc);
 
     lprintf("random seed: %d\n", (int)rnd_seed);
 
@@ -1655,7 +4405,11 @@ void _print_benchinfo(struct bench_info *binfo)
 
     lprintf("# documents (i.e. working set size): %d\n", (int)binfo->ndocs);
     if (binfo->nfiles > 1) {
-        lprintf("# files: %d\n", (int)binfo->nfiles);
+        lprintf("# files: %d", (int)binfo->nfiles);
+        if (binfo->namespaces) {
+            lprintf(" (namespaces of one DB instance)");
+        }
+        lprintf("\n");
     }
 
     lprintf("# threads: ");
@@ -1679,28 +4433,117 @@ void _print_benchinfo(struct bench_info *binfo)
     } else {
         lprintf("\n");
     }
+    if (binfo->nsnapshots) {
+        lprintf("# snapshot readers: %d", (int)binfo->nsnapshots);
+        if (binfo->snapshot_ops) {
+            lprintf(" (%d docs/sec", (int)binfo->snapshot_ops);
+        } else {
+            lprintf(" (max");
+        }
+        if (binfo->snapshot_hold_sec) {
+            lprintf(", each snapshot held for %d sec)\n",
+                    (int)binfo->snapshot_hold_sec);
+        } else {
+            lprintf(", a new snapshot every pass)\n");
+        }
+    }
+    lprintf("handles: ");
+    if (binfo->handle_mode == HANDLE_PER_THREAD) {
+        lprintf("per thread\n");
+    } else if (binfo->handle_mode == HANDLE_SHARED) {
+        if (engine->flags & ENGINE_THREAD_SAFE) {
+            lprintf("shared (concurrent)\n");
+        } else {
+            lprintf("shared (serialized)\n");
+        }
+    } else {
+        lprintf("pool of %d\n", (int)binfo->handle_pool_size);
+    }
+    if (binfo->vclients) {
+        lprintf("# logical clients: %d per thread, think time %d us (mean)\n",
+                (int)binfo->vclients, (int)binfo->think_us);
+    }
+    if (binfo->pregen_threads) {
+        lprintf("# write batch generators: %d (%d batches ahead per writer)\n",
+                (int)binfo->pregen_threads, (int)binfo->pregen_depth);
+    }
+
+    if (binfo->arrival_mode == 1) {
+        lprintf("arrival: open-loop, Poisson %d /sec (queue limit %d)\n",
+                (int)binfo->arrival_rate, (int)binfo->arrival_qlen);
+    } else if (binfo->arrival_mode == 2) {
+        lprintf("arrival: open-loop, trace %s (queue limit %d)\n",
+                binfo->arrival_trace, (int)binfo->arrival_qlen);
+    }
+
+    if (binfo->search_mode) {
+        lprintf("saturation search: %s from %d /sec (step %d, max %d), "
+                "%d s warm-up + %d s measurement\n",
+                (binfo->search_mode == 1)?("step"):("binary"),
+                (int)binfo->search_start, (int)binfo->search_step,
+                (int)binfo->search_max,
+                (int)binfo->search_warmup, (int)binfo->search_measure);
+        lprintf("SLO: %s p99 <= %d us",
+                (binfo->slo_metric == 0)?("read"):
+                ((binfo->slo_metric == 1)?("write batch"):("response time")),
+                (int)binfo->slo_p99_us);
+        if (binfo->arrival_mode) {
+            lprintf(", drop <= %.2f %%", binfo->slo_drop);
+        }
+        lprintf("\n");
+    }
+
+    _print_affinity(&binfo->affinity);
 
     lprintf("block cache size: %s\n",
             print_filesize_approx(binfo->cache_size, tempstr));
-#if defined(__LEVEL_BENCH) || defined(__ROCKS_BENCH)
-    lprintf("WBS size: %s (init), ",
-        print_filesize_approx(binfo->wbs_init, tempstr));
-    lprintf("%s (bench)\n",
-        print_filesize_approx(binfo->wbs_bench, tempstr));
-#endif
-#if defined(__FDB_BENCH)
-    lprintf("WAL size: %"_F64"\n", binfo->fdb_wal);
-#endif
-#if defined(__WT_BENCH)
-    lprintf("indexing: %s\n", (binfo->wt_type==0)?"b-tree":"lsm-tree");
-#endif
+    if (engine->set_wbs_size) {
+        lprintf("WBS size: %s (init), ",
+            print_filesize_approx(binfo->wbs_init, tempstr));
+        lprintf("%s (bench)\n",
+            print_filesize_approx(binfo->wbs_bench, tempstr));
+    }
+    if (engine->set_wal_size) {
+        lprintf("WAL size: %"_F64"\n", binfo->fdb_wal);
+    }
+    if (engine->set_idx_type) {
+        lprintf("indexing: %s\n", (binfo->wt_type==0)?"b-tree":"lsm-tree");
+    }
+    if (binfo->raw_body) {
+        lprintf("raw body: on (no docinfo header)\n");
+    }
+    if (binfo->engine_options[0]) {
+        lprintf("%s options: %s\n", engine->name, binfo->engine_options);
+    }
+    if (binfo->ckpt_policy == ENGINE_CKPT_TIME) {
+        lprintf("checkpoint: every %d sec\n", (int)binfo->ckpt_value);
+    } else if (binfo->ckpt_policy == ENGINE_CKPT_LOG_SIZE) {
+        lprintf("checkpoint: every %s of log\n",
+                print_filesize_approx(binfo->ckpt_value, tempstr));
+    } else if (binfo->ckpt_policy == ENGINE_CKPT_MANUAL) {
+        lprintf("checkpoint: by the benchmark, %d sec apart\n",
+                (int)binfo->ckpt_value);
+    }
+    if (binfo->stats_filename[0]) {
+        lprintf("engine statistics: %s_*.txt (every %d sec)\n",
+                binfo->stats_filename, ENGINE_STATS_INTERVAL_US / 1000000);
+    }
 
-    lprintf("key length: %s(%d,%d) / ",
-            (binfo->keylen.type == RND_NORMAL)?"Norm":"Uniform",
-            (int)binfo->keylen.a, (int)binfo->keylen.b);
-    lprintf("body length: %s(%d,%d)\n",
-            (binfo->bodylen.type == RND_NORMAL)?"Norm":"Uniform",
-            (int)binfo->bodylen.a, (int)binfo->bodylen.b);
+    lprintf("key length: %s / ", _rnd_str(&binfo->keylen, tempstr));
+    lprintf("body length: %s", _rnd_str(&binfo->bodylen, tempstr));
+    if (binfo->bodylen.type != RND_NORMAL &&
+        binfo->bodylen.type != RND_UNIFORM) {
+        lprintf(" (limit %s)", print_filesize_approx(binfo->bodylen_limit, tempstr));
+    }
+    lprintf("\n");
+    lprintf("key order: %s",
+            (binfo->key_order == KEYGEN_SEQUENTIAL)?"sequential":
+            ((binfo->key_order == KEYGEN_REVERSE)?"reverse":"hashed"));
+    if (binfo->key_order != KEYGEN_HASHED) {
+        // shorter key lengths are raised to the width of the index
+        lprintf(" (key length at least %d)", KEYGEN_ORD_KEY_WIDTH);
+    }
+    lprintf("\n");
 
     lprintf("batch distribution: ");
     if (binfo->batch_dist.type == RND_UNIFORM) {
@@ -1719,7 +4562,23 @@ void _print_benchinfo(struct bench_info *binfo)
                 (unsigned long)binfo->nops);
     }
     if (binfo->bench_secs > 0){
-        lprintf("benchmark duration: %lu seconds\n", (unsigned long)binfo->bench_secs);
+        lprintf("benchmark duration: %lu seconds", (unsigned long)binfo->bench_secs);
+        if (binfo->warmup_secs) {
+            lprintf(" (+ %lu seconds warm-up)", (unsigned long)binfo->warmup_secs);
+        }
+        lprintf("\n");
+    } else if (binfo->warmup_secs) {
+        lprintf("warm-up: %lu seconds\n", (unsigned long)binfo->warmup_secs);
+    }
+    if (binfo->scale_mode) {
+        size_t i;
+        lprintf("thread scaling: %s =",
+                (binfo->scale_mode == 1)?("readers"):
+                ((binfo->scale_mode == 2)?("writers"):("readers and writers")));
+        for (i=0;i<binfo->scale_nsteps;++i){
+            lprintf(" %d", (int)binfo->scale_threads[i]);
+        }
+        lprintf("\n");
     }
 
     lprintf("read batch size: %s(%d,%d) / ",
@@ -1738,15 +4597,29 @@ void _print_benchinfo(struct bench_info *binfo)
         lprintf("write ratio: max capacity");
     }
     lprintf(" (%s)\n", ((binfo->sync_write)?("synchronous"):("asynchronous")));
+    if (binfo->group_commit) {
+        if (binfo->group_commit_max) {
+            lprintf("group commit: on (up to %d writers per commit)\n",
+                    (int)binfo->group_commit_max);
+        } else {
+            lprintf("group commit: on\n");
+        }
+    }
+    if (binfo->miss_prob) {
+        lprintf("read miss ratio: %d %%\n", (int)binfo->miss_prob);
+    }
+    if (binfo->read_ref) {
+        lprintf("zero-copy read: on\n");
+    }
 
-#if defined(__FDB_BENCH) || defined(__COUCH_BENCH)
-    lprintf("compaction threshold: %d %%", (int)binfo->compact_thres);
-#if defined(__FDB_BENCH)
-    lprintf(" (%s)\n", ((binfo->auto_compaction)?("auto"):("manual")));
-#else
-    lprintf("\n");
-#endif
-#endif
+    if (engine->flags & ENGINE_COMPACTION) {
+        lprintf("compaction threshold: %d %%", (int)binfo->compact_thres);
+        if (engine->set_compaction) {
+            lprintf(" (%s)\n", ((binfo->auto_compaction)?("auto"):("manual")));
+        } else {
+            lprintf("\n");
+        }
+    }
 }
 
 void _set_keygen(struct bench_info *binfo)
@@ -1756,24 +4629,25 @@ void _set_keygen(struct bench_info *binfo)
     struct rndinfo rnd_len[level], rnd_dist[level];
     struct keygen_option opt;
 
-    if (binfo->keylen.type == RND_NORMAL) {
-        avg_keylen = binfo->keylen.a;
-    } else {
-        avg_keylen = (binfo->keylen.a + binfo->keylen.b) / 2;
-    }
-    if (binfo->prefixlen.type == RND_NORMAL) {
-        avg_prefixlen = binfo->prefixlen.a;
-    } else {
-        avg_prefixlen = (binfo->prefixlen.a + binfo->prefixlen.b) / 2;
+    // keygen cuts long segments to fit a key into MAX_KEYLEN,
+    // but every segment needs room for its minimum
+    if (level * (KEYGEN_ORD_KEY_WIDTH + 1) >= MAX_KEYLEN) {
+        printf("too many prefix levels (%d), keys are limited to %d bytes\n",
+               (int)binfo->nlevel, MAX_KEYLEN - 1);
+        exit(0);
     }
 
+    avg_keylen = get_random_avg(&binfo->keylen);
+    avg_prefixlen = get_random_avg(&binfo->prefixlen);
+
     for (i=0;i<binfo->nlevel+1; ++i) {
         if (i<binfo->nlevel) {
             rnd_len[i] = binfo->prefixlen;
             rnd_dist[i].type = RND_UNIFORM;
             rnd_dist[i].a = 0;
             rnd_dist[i].b = binfo->nprefixes;
-        } else {
+        } else if (binfo->keylen.type == RND_NORMAL ||
+                   binfo->keylen.type == RND_UNIFORM) {
             // right most (last) prefix
             rnd_len[i].type = RND_NORMAL;
             rnd_len[i].a = avg_keylen - avg_prefixlen * binfo->nlevel;
@@ -1781,13 +4655,113 @@ void _set_keygen(struct bench_info *binfo)
             rnd_dist[i].type = RND_UNIFORM;
             rnd_dist[i].a = 0;
             rnd_dist[i].b = 0xfffffffffffffff;
+        } else {
+            // right most (last) prefix: other distributions cannot be
+            // shifted, so prefixes are added on top of the given length
+            rnd_len[i] = binfo->keylen;
+            rnd_dist[i].type = RND_UNIFORM;
+            rnd_dist[i].a = 0;
+            rnd_dist[i].b = 0xfffffffffffffff;
         }
     }
     opt.abt_only = 1;
     opt.delimiter = 1;
+    opt.order = binfo->key_order;
     keygen_init(&binfo->keygen, level, rnd_len, rnd_dist, &opt);
 }
 
+// every key of the section named after the engine ('[rocksdb]', ...) is
+// passed to the DB module as is; returns the accepted ones for the report
+char * _set_engine_options(dictionary *cfg)
+{
+    int i;
+    size_t seclen, len = 0;
+    char *key, *opts;
+
+    opts = (char*)malloc(1);
+    opts[0] = 0;
+    seclen = strlen(engine->name);
+    for (i=0;i<cfg->size;++i){
+        key = cfg->key[i];
+        if (key == NULL || strncmp(key, engine->name, seclen) ||
+            key[seclen] != ':') {
+            continue;
+        }
+        key += seclen + 1;
+        if (!engine->set_option) {
+            printf("native options are not supported by the DB module, "
+                   "[%s] is ignored\n", engine->name);
+            break;
+        }
+        if (engine->set_option(key, cfg->val[i]) != COUCHSTORE_SUCCESS) {
+            printf("invalid %s option '%s = %s', ignored\n",
+                   engine->name, key, cfg->val[i]);
+            continue;
+        }
+        opts = (char*)realloc(opts, len + strlen(key) + strlen(cfg->val[i]) + 4);
+        len += sprintf(opts + len, "%s%s=%s", (len)?(", "):(""), key, cfg->val[i]);
+    }
+
+    return opts;
+}
+
+// read distribution of '[section]' from config
+void _get_rndinfo(dictionary *cfg, char *section, struct rndinfo *ri,
+                  int64_t median, int64_t sd, int64_t lower, int64_t upper)
+{
+    char key[256], *str;
+
+    memset(ri, 0, sizeof(struct rndinfo));
+    sprintf(key, "%s:distribution", section);
+    str = iniparser_getstring(cfg, key, (char*)"normal");
+
+    if (str[0] == 'n') {
+        ri->type = RND_NORMAL;
+        sprintf(key, "%s:median", section);
+        ri->a = iniparser_getint(cfg, key, median);
+        sprintf(key, "%s:standard_deviation", section);
+        ri->b = iniparser_getint(cfg, key, sd);
+    } else if (str[0] == 'l') {
+        ri->type = RND_LOGNORMAL;
+        sprintf(key, "%s:median", section);
+        ri->a = iniparser_getint(cfg, key, median);
+        sprintf(key, "%s:sigma", section);
+        ri->b = (int64_t)(iniparser_getdouble(cfg, key, 1.0) * 100);
+    } else if (str[0] == 'p') {
+        ri->type = RND_PARETO;
+        sprintf(key, "%s:minimum", section);
+        ri->a = iniparser_getint(cfg, key, lower);
+        sprintf(key, "%s:alpha", section);
+        ri->b = (int64_t)(iniparser_getdouble(cfg, key, 1.5) * 100);
+        if (ri->b <= 0) ri->b = 150;
+    } else if (str[0] == 'b') {
+        ri->type = RND_BIMODAL;
+        sprintf(key, "%s:median", section);
+        ri->a = iniparser_getint(cfg, key, median);
+        sprintf(key, "%s:standard_deviation", section);
+        ri->b = iniparser_getint(cfg, key, sd);
+        sprintf(key, "%s:median2", section);
+        ri->c = iniparser_getint(cfg, key, upper);
+        sprintf(key, "%s:standard_deviation2", section);
+        ri->d = iniparser_getint(cfg, key, sd);
+        sprintf(key, "%s:ratio2_percent", section);
+        ri->e = iniparser_getint(cfg, key, 10);
+    } else if (str[0] == 'e') {
+        sprintf(key, "%s:histogram", section);
+        str = iniparser_getstring(cfg, key, (char*)"");
+        if (rnd_empirical_load(ri, str) < 0) {
+            printf("cannot load histogram file '%s' for [%s]\n", str, section);
+            exit(0);
+        }
+    } else {
+        ri->type = RND_UNIFORM;
+        sprintf(key, "%s:lower_bound", section);
+        ri->a = iniparser_getint(cfg, key, lower);
+        sprintf(key, "%s:upper_bound", section);
+        ri->b = iniparser_getint(cfg, key, upper);
+    }
+}
+
 struct bench_info get_benchinfo()
 {
     static dictionary *cfg;
@@ -1807,6 +4781,25 @@ struct bench_info get_benchinfo()
     ncores = (size_t)sysconf(_SC_NPROCESSORS_ONLN);
 #endif
 
+    // DB module
+#if defined(__MULTI_BENCH)
+    str = iniparser_getstring(cfg, (char*)"db_config:engine", (char*)"");
+    if (!str[0]) {
+        printf("no DB module is given, set 'engine' in [db_config]\n");
+        exit(0);
+    }
+    engine = couch_engine_load(str,
+                 iniparser_getstring(cfg, (char*)"db_config:engine_path",
+                                     (char*)"."));
+    if (!engine) {
+        exit(0);
+    }
+#else
+    // linked in
+    engine = couch_engine_get();
+#endif
+    binfo.engine_options = _set_engine_options(cfg);
+
     binfo.ndocs = iniparser_getint(cfg, (char*)"document:ndocs", 10000);
     binfo.filename = filename;
     binfo.init_filename = init_filename;
@@ -1815,18 +4808,27 @@ struct bench_info get_benchinfo()
     str = iniparser_getstring(cfg, (char*)"log:filename", (char*)"");
     strcpy(binfo.log_filename, str);
 
+    binfo.stats_filename = (char*)malloc(256);
+    str = iniparser_getstring(cfg, (char*)"log:engine_stats", (char*)"");
+    strcpy(binfo.stats_filename, str);
+    if (binfo.stats_filename[0] && !engine->get_stats) {
+        printf("engine statistics are not provided by the DB module\n");
+        binfo.stats_filename[0] = 0;
+    }
+
     binfo.cache_size = iniparser_getint(cfg, (char*)"db_config:cache_size_MB", 128);
     binfo.cache_size *= (1024*1024);
 
     str = iniparser_getstring(cfg, (char*)"db_config:compaction_mode", (char*)"auto");
     if (str[0] == 'a' || str[0] == 'A') binfo.auto_compaction = 1;
     else binfo.auto_compaction = 0;
-#if defined(__LEVEL_BENCH) || defined(__ROCKS_BENCH) || defined(__WT_BENCH)
-    binfo.auto_compaction = 1;
-#elif defined(__COUCH_BENCH)
-    // couchstore: manual compaction only
-    binfo.auto_compaction = 0;
-#endif
+    if (!(engine->flags & ENGINE_COMPACTION)) {
+        // compaction is done by the DB module itself (if any)
+        binfo.auto_compaction = 1;
+    } else if (!engine->set_compaction) {
+        // couchstore: manual compaction only
+        binfo.auto_compaction = 0;
+    }
 
     binfo.wbs_init = iniparser_getint(cfg, (char*)"db_config:wbs_init_MB", 4);
     binfo.wbs_init *= (1024*1024);
@@ -1839,6 +4841,37 @@ struct bench_info get_benchinfo()
     } else {
         binfo.wt_type = 1; /* lsm-tree */
     }
+    str = iniparser_getstring(cfg, (char*)"db_config:raw_body", (char*)"off");
+    binfo.raw_body = (!strcmp(str, "on") || str[0] == 'y' || str[0] == 'Y');
+    if (binfo.raw_body && !engine->set_raw_body) {
+        printf("raw body is not supported by the DB module, "
+               "values keep the docinfo header\n");
+        binfo.raw_body = 0;
+    }
+
+    str = iniparser_getstring(cfg, (char*)"db_config:checkpoint", (char*)"default");
+    if (str[0] == 't' || str[0] == 'T') {
+        binfo.ckpt_policy = ENGINE_CKPT_TIME;
+    } else if (str[0] == 'l' || str[0] == 'L') {
+        binfo.ckpt_policy = ENGINE_CKPT_LOG_SIZE;
+    } else if (str[0] == 'm' || str[0] == 'M') {
+        binfo.ckpt_policy = ENGINE_CKPT_MANUAL;
+    } else {
+        binfo.ckpt_policy = ENGINE_CKPT_DEFAULT;
+    }
+    if (binfo.ckpt_policy == ENGINE_CKPT_LOG_SIZE) {
+        binfo.ckpt_value = iniparser_getint(cfg, (char*)"db_config:checkpoint_log_MB", 64);
+        binfo.ckpt_value *= (1024*1024);
+    } else {
+        binfo.ckpt_value = iniparser_getint(cfg, (char*)"db_config:checkpoint_sec", 60);
+    }
+    if (binfo.ckpt_policy != ENGINE_CKPT_DEFAULT &&
+        (!engine->set_checkpoint ||
+         (binfo.ckpt_policy == ENGINE_CKPT_MANUAL && !engine->checkpoint))) {
+        printf("checkpoint policy is not supported by the DB module, "
+               "its default is used\n");
+        binfo.ckpt_policy = ENGINE_CKPT_DEFAULT;
+    }
 
     str = iniparser_getstring(cfg, (char*)"db_file:filename", (char*)"./dummy");
     strcpy(binfo.filename, str);
@@ -1847,10 +4880,28 @@ struct bench_info get_benchinfo()
     strcpy(binfo.init_filename, str);
 
     binfo.nfiles = iniparser_getint(cfg, (char*)"db_file:nfiles", 1);
+    str = iniparser_getstring(cfg, (char*)"db_file:namespaces", (char*)"off");
+    binfo.namespaces = (!strcmp(str, "on") || str[0] == 'y' || str[0] == 'Y');
+    if (binfo.namespaces && !engine->set_namespace) {
+        if (!(engine->flags & ENGINE_CONN)) {
+            printf("namespaces are not supported by the DB module, "
+                   "each file is a separate DB\n");
+        }
+        // WiredTiger, LMDB: files are always tables/sub-DBs of one connection
+        binfo.namespaces = 0;
+    }
+    if (binfo.namespaces) {
+        engine->set_namespace(1);
+        if (!binfo.auto_compaction) {
+            // a KV instance cannot be compacted apart from its file
+            printf("manual compaction is not possible with namespaces, "
+                   "auto compaction is used\n");
+            binfo.auto_compaction = 1;
+        }
+    }
 
     binfo.pop_nthreads = iniparser_getint(cfg, (char*)"population:nthreads", ncores*2);
     if (binfo.pop_nthreads < 1) binfo.pop_nthreads = ncores*2;
-    if (binfo.pop_nthreads > binfo.nfiles) binfo.pop_nthreads = binfo.nfiles;
 
     binfo.pop_batchsize = iniparser_getint(cfg, (char*)"population:batchsize", 4096);
 
@@ -1863,17 +4914,7 @@ struct bench_info get_benchinfo()
     else binfo.fdb_flush_wal = 1;
 
     // key length
-    str = iniparser_getstring(cfg, (char*)"key_length:distribution", (char*)"normal");
-    if (str[0] == 'n') {
-        binfo.keylen.type = RND_NORMAL;
-        binfo.keylen.a = iniparser_getint(cfg, (char*)"key_length:median", 64);
-        binfo.keylen.b = iniparser_getint(cfg,
-                                          (char*)"key_length:standard_deviation", 8);
-    }else{
-        binfo.keylen.type = RND_UNIFORM;
-        binfo.keylen.a = iniparser_getint(cfg, (char*)"key_length:lower_bound", 32);
-        binfo.keylen.b = iniparser_getint(cfg, (char*)"key_length:upper_bound", 96);
-    }
+    _get_rndinfo(cfg, (char*)"key_length", &binfo.keylen, 64, 8, 32, 96);
 
     // prefix composition
     str = iniparser_getstring(cfg, (char*)"prefix:distribution", (char*)"uniform");
@@ -1890,27 +4931,77 @@ struct bench_info get_benchinfo()
     binfo.nlevel = iniparser_getint(cfg, (char*)"prefix:level", 0);
     binfo.nprefixes = iniparser_getint(cfg, (char*)"prefix:nprefixes", 100);
 
+    // key ordering
+    str = iniparser_getstring(cfg, (char*)"document:key_order", (char*)"hashed");
+    if (str[0] == 's' || str[0] == 'S') {
+        binfo.key_order = KEYGEN_SEQUENTIAL;
+    } else if (str[0] == 'r' || str[0] == 'R') {
+        binfo.key_order = KEYGEN_REVERSE;
+    } else {
+        binfo.key_order = KEYGEN_HASHED;
+    }
+
     // thread information
     binfo.nreaders = iniparser_getint(cfg, (char*)"threads:readers", 0);
     binfo.nwriters = iniparser_getint(cfg, (char*)"threads:writers", 0);
     binfo.reader_ops = iniparser_getint(cfg, (char*)"threads:reader_ops", 0);
     binfo.writer_ops = iniparser_getint(cfg, (char*)"threads:writer_ops", 0);
+    binfo.nsnapshots = iniparser_getint(cfg, (char*)"threads:snapshot_readers", 0);
+    binfo.snapshot_ops =
+        iniparser_getint(cfg, (char*)"threads:snapshot_reader_ops", 0);
+    binfo.snapshot_hold_sec =
+        iniparser_getint(cfg, (char*)"threads:snapshot_hold_sec", 0);
+    str = iniparser_getstring(cfg, (char*)"threads:handles",
+                              (engine->flags & ENGINE_THREAD_SAFE)?
+                                  ((char*)"shared"):((char*)"per_thread"));
+    binfo.handle_pool_size = 1;
+    if (!strncmp(str, "pool", 4)) {
+        // pool(N)
+        binfo.handle_mode = HANDLE_POOL;
+        while (*str && (*str < '0' || *str > '9')) str++;
+        binfo.handle_pool_size = atoi(str);
+        if (binfo.handle_pool_size < 1) binfo.handle_pool_size = 1;
+    } else if (str[0] == 's' || str[0] == 'S') {
+        binfo.handle_mode = HANDLE_SHARED;
+    } else {
+        binfo.handle_mode = HANDLE_PER_THREAD;
+    }
+    if ((engine->flags & ENGINE_SINGLE_OPEN) &&
+        binfo.handle_mode == HANDLE_PER_THREAD) {
+        printf("a DB cannot be opened more than once, handles are shared\n");
+        binfo.handle_mode = HANDLE_SHARED;
+    }
+    binfo.vclients = iniparser_getint(cfg, (char*)"threads:clients_per_thread", 0);
+    binfo.think_us = iniparser_getint(cfg, (char*)"threads:think_time_us", 0);
+    binfo.pregen_threads = iniparser_getint(cfg, (char*)"threads:generators", 0);
+    binfo.pregen_depth =
+        iniparser_getint(cfg, (char*)"threads:generator_queue_depth", 16);
+    if (binfo.pregen_depth < 1) binfo.pregen_depth = 1;
+
+    // open-loop arrivals
+    str = iniparser_getstring(cfg, (char*)"arrival:mode", (char*)"closed");
+    if (str[0] == 'p' || str[0] == 'P') {
+        binfo.arrival_mode = 1;
+    } else if (str[0] == 't' || str[0] == 'T') {
+        binfo.arrival_mode = 2;
+    } else {
+        binfo.arrival_mode = 0;
+    }
+    binfo.arrival_rate = iniparser_getint(cfg, (char*)"arrival:rate", 1000);
+    if (binfo.arrival_rate == 0 && binfo.arrival_mode == 1) binfo.arrival_mode = 0;
+    binfo.arrival_qlen = iniparser_getint(cfg, (char*)"arrival:queue_length", 1024);
+    if (binfo.arrival_qlen < 1) binfo.arrival_qlen = 1;
+    binfo.arrival_trace = (char*)malloc(256);
+    str = iniparser_getstring(cfg, (char*)"arrival:trace_file", (char*)"");
+    strcpy(binfo.arrival_trace, str);
 
     // create keygen structure
     _set_keygen(&binfo);
 
-    str = iniparser_getstring(cfg, (char*)"body_length:distribution", (char*)"normal");
-    if (str[0] == 'n') {
-        binfo.bodylen.type = RND_NORMAL;
-        binfo.bodylen.a = iniparser_getint(cfg, (char*)"body_length:median", 512);
-        binfo.bodylen.b = iniparser_getint(cfg,
-                                           (char*)"body_length:standard_deviation",
-                                           32);
-    }else{
-        binfo.bodylen.type = RND_UNIFORM;
-        binfo.bodylen.a = iniparser_getint(cfg, (char*)"body_length:lower_bound", 448);
-        binfo.bodylen.b = iniparser_getint(cfg, (char*)"body_length:upper_bound", 576);
-    }
+    _get_rndinfo(cfg, (char*)"body_length", &binfo.bodylen, 512, 32, 448, 576);
+    binfo.bodylen_limit = iniparser_getint(cfg, (char*)"body_length:upper_limit",
+                                           16*1024*1024);
+    if (binfo.bodylen_limit < 8) binfo.bodylen_limit = 8;
 
     binfo.nbatches = iniparser_getint(cfg, (char*)"operation:nbatches", 0);
     binfo.nops = iniparser_getint(cfg, (char*)"operation:nops", 0);
@@ -1918,6 +5009,7 @@ struct bench_info get_benchinfo()
     if (binfo.nbatches == 0 && binfo.nops == 0 && binfo.bench_secs == 0) {
         binfo.bench_secs = 60;
     }
+    binfo.warmup_secs = iniparser_getint(cfg, (char*)"operation:warmup_sec", 0);
 
     size_t avg_write_batchsize;
     str = iniparser_getstring(cfg, (char*)"operation:batchsize_distribution",
@@ -2007,13 +5099,199 @@ struct bench_info get_benchinfo()
     str = iniparser_getstring(cfg, (char*)"operation:write_type", (char*)"sync");
     binfo.sync_write = (str[0]=='s')?(1):(0);
 
+    str = iniparser_getstring(cfg, (char*)"operation:group_commit", (char*)"off");
+    binfo.group_commit = (!strcmp(str, "on") || str[0] == 'y' || str[0] == 'Y');
+    binfo.group_commit_max =
+        iniparser_getint(cfg, (char*)"operation:group_commit_max_writers", 0);
+
+    str = iniparser_getstring(cfg, (char*)"operation:zero_copy_read", (char*)"off");
+    binfo.read_ref = (!strcmp(str, "on") || str[0] == 'y' || str[0] == 'Y');
+    if (binfo.read_ref && !engine->open_document_ref) {
+        printf("zero-copy read is not supported by the DB module, values are copied\n");
+        binfo.read_ref = 0;
+    }
+
+    binfo.miss_prob = iniparser_getint(cfg,
+                                       (char*)"operation:read_miss_ratio_percent", 0);
+    if (binfo.miss_prob > 100) binfo.miss_prob = 100;
+
     binfo.compact_thres = iniparser_getint(cfg, (char*)"compaction:threshold", 30);
 
+    // thread/memory placement
+    {
+        affinity_policy_t policy;
+        mempolicy_t mempolicy;
+        char *cpus;
+        int ret;
+
+        str = iniparser_getstring(cfg, (char*)"affinity:policy", (char*)"none");
+        if (str[0] == 'c' || str[0] == 'C') {
+            policy = AFFINITY_COMPACT;
+        } else if (str[0] == 's' || str[0] == 'S') {
+            policy = AFFINITY_SCATTER;
+        } else if (str[0] == 'l' || str[0] == 'L') {
+            policy = AFFINITY_LIST;
+        } else {
+            policy = AFFINITY_NONE;
+        }
+        cpus = iniparser_getstring(cfg, (char*)"affinity:cpus", (char*)"");
+        str = iniparser_getstring(cfg, (char*)"affinity:mem_policy",
+                                  (char*)"default");
+        if (str[0] == 'l' || str[0] == 'L') {
+            mempolicy = MEMPOLICY_LOCAL;
+        } else if (str[0] == 'i' || str[0] == 'I') {
+            mempolicy = MEMPOLICY_INTERLEAVE;
+        } else if (str[0] == 'b' || str[0] == 'B') {
+            mempolicy = MEMPOLICY_BIND;
+        } else {
+            mempolicy = MEMPOLICY_DEFAULT;
+        }
+        str = iniparser_getstring(cfg, (char*)"affinity:mem_nodes", (char*)"");
+        ret = affinity_init(&binfo.affinity, policy, cpus, mempolicy, str);
+        if (binfo.affinity.nrejected) {
+            char buf[AFFINITY_MAX_REJECTED * 12];
+            int n = MIN(binfo.affinity.nrejected, AFFINITY_MAX_REJECTED);
+            printf("CPU %s%s in affinity:cpus not usable (offline, not allowed, "
+                   "or out of range; %d CPUs usable), ignored\n",
+                   affinity_list_str(binfo.affinity.rejected, n, buf),
+                   (binfo.affinity.nrejected > n)?(",..."):(""),
+                   binfo.affinity.ncpus);
+        }
+        if (ret < 0) {
+            printf("no usable CPU for thread affinity, threads are not pinned\n");
+        }
+    }
+
+    // saturation search
+    str = iniparser_getstring(cfg, (char*)"search:mode", (char*)"none");
+    if (str[0] == 's' || str[0] == 'S') {
+        binfo.search_mode = 1;
+    } else if (str[0] == 'b' || str[0] == 'B') {
+        binfo.search_mode = 2;
+    } else {
+        binfo.search_mode = 0;
+    }
+    binfo.search_start = iniparser_getint(cfg, (char*)"search:start_ops", 1000);
+    if (binfo.search_start < 1) binfo.search_start = 1;
+    binfo.search_step = iniparser_getint(cfg, (char*)"search:step_ops", 1000);
+    if (binfo.search_step < 1) binfo.search_step = 1;
+    binfo.search_max = iniparser_getint(cfg, (char*)"search:max_ops", 1000000);
+    binfo.search_warmup = iniparser_getint(cfg, (char*)"search:warmup_sec", 5);
+    binfo.search_measure = iniparser_getint(cfg, (char*)"search:measure_sec", 10);
+    if (binfo.search_measure < 1) binfo.search_measure = 1;
+    str = iniparser_getstring(cfg, (char*)"search:slo_metric",
+                              (char*)((binfo.arrival_mode)?("response"):("read")));
+    if (str[0] == 'w' || str[0] == 'W') {
+        binfo.slo_metric = 1;
+    } else if ((str[0] == 'r' || str[0] == 'R') && str[2] == 's') {
+        binfo.slo_metric = 2;
+    } else {
+        binfo.slo_metric = 0;
+    }
+    if (binfo.slo_metric == 2 && !binfo.arrival_mode) {
+        // response time is only defined for open-loop arrivals
+        binfo.slo_metric = 0;
+    }
+    binfo.slo_p99_us = iniparser_getint(cfg, (char*)"search:slo_p99_us", 10000);
+    binfo.slo_drop = iniparser_getdouble(cfg, (char*)"search:slo_drop_percent", 1.0);
+    if (binfo.search_mode && !binfo.arrival_mode &&
+        (binfo.write_prob <= 100 || binfo.nreaders + binfo.nwriters == 0)) {
+        printf("saturation search needs either open-loop arrivals or "
+               "paced reader/writer threads (write_ratio_percent > 100)\n");
+        binfo.search_mode = 0;
+    }
+    // thread scaling sweep
+    str = iniparser_getstring(cfg, (char*)"scaling:mode", (char*)"none");
+    if (str[0] == 'r' || str[0] == 'R') {
+        binfo.scale_mode = 1;
+    } else if (str[0] == 'w' || str[0] == 'W') {
+        binfo.scale_mode = 2;
+    } else if (str[0] == 'b' || str[0] == 'B') {
+        binfo.scale_mode = 3;
+    } else {
+        binfo.scale_mode = 0;
+    }
+    {
+        int list[64];
+        size_t i;
+
+        str = iniparser_getstring(cfg, (char*)"scaling:threads", (char*)"1,2,4,8");
+        binfo.scale_nsteps = affinity_parse_list(str, list, 64);
+        for (i=0;i<binfo.scale_nsteps;++i){
+            binfo.scale_threads[i] = (list[i] > 0)?(list[i]):(1);
+        }
+    }
+    if (binfo.scale_mode && (binfo.scale_nsteps == 0 || binfo.search_mode)) {
+        printf("thread scaling needs a thread list and "
+               "cannot be combined with saturation search\n");
+        binfo.scale_mode = 0;
+    }
+
+    if (binfo.vclients && (binfo.arrival_mode || binfo.search_mode)) {
+        printf("logical clients are not used with open-loop arrivals "
+               "or saturation search\n");
+        binfo.vclients = 0;
+    }
+    if (binfo.search_mode) {
+        // the search decides when to stop
+        binfo.nbatches = binfo.nops = binfo.bench_secs = 0;
+    }
+
     iniparser_free(cfg);
 
     return binfo;
 }
 
+// run the benchmark for each thread count in [scaling] threads,
+// populating only once
+void do_scaling(struct bench_info *binfo)
+{
+    size_t k, n, nsteps = binfo->scale_nsteps;
+    uint8_t initialize = binfo->initialize;
+    double ops_base = 0, n_base = 0;
+    struct bench_summary points[nsteps];
+
+    for (k=0;k<nsteps;++k){
+        n = binfo->scale_threads[k];
+        if (binfo->scale_mode & 0x1) binfo->nreaders = n;
+        if (binfo->scale_mode & 0x2) binfo->nwriters = n;
+        binfo->initialize = (k == 0)?(initialize):(0);
+
+        lprintf("\n=== scaling step %d/%d: %d reader%s, %d writer%s ===\n",
+                (int)k+1, (int)nsteps,
+                (int)binfo->nreaders, (binfo->nreaders!=1)?("s"):(""),
+                (int)binfo->nwriters, (binfo->nwriters!=1)?("s"):(""));
+        do_bench(binfo, &points[k]);
+        if (got_signal) {
+            nsteps = k+1;
+            break;
+        }
+    }
+
+    lprintf("\nthread scaling (after %d s warm-up, %d s measurement per step)\n",
+            (int)binfo->warmup_secs, (int)binfo->bench_secs);
+    lprintf("readers  writers        ops/sec  p99 read (us)  "
+            "p99 write (us)  CPU us/op  efficiency\n");
+    for (k=0;k<nsteps;++k){
+        n = binfo->scale_threads[k];
+        if (k == 0) {
+            // efficiency is relative to the per-thread throughput of the first step
+            ops_base = points[k].ops_per_sec;
+            n_base = n;
+        }
+        lprintf("%7d  %7d  %13.2f  %13d  %14d  %9.1f  %9.1f%%\n",
+                (int)points[k].nreaders, (int)points[k].nwriters,
+                points[k].ops_per_sec, (int)points[k].p99_read,
+                (int)points[k].p99_write, points[k].cpu_us_per_op,
+                (ops_base > 0)?
+                    (points[k].ops_per_sec / ops_base * n_base / n * 100):(0));
+    }
+    if (binfo->scale_threads[0] != 1) {
+        lprintf("(efficiency relative to %d threads)\n",
+                (int)binfo->scale_threads[0]);
+    }
+}
+
 int main(int argc, char **argv){
     char filename[256];
     struct bench_info binfo;
@@ -2042,6 +5320,25 @@ int main(int argc, char **argv){
         sprintf(filename, "%s_%d.txt", binfo.log_filename, (int)gap.tv_sec);
         log_fp = fopen(filename, "w");
     }
+    if (binfo.stats_filename[0]) {
+        char temp[256], cmd[256], *str;
+
+        str = _get_dirname(binfo.stats_filename, temp);
+        if (str) {
+            if (!_does_file_exist(str)) {
+                sprintf(cmd, "mkdir -p %s > errorlog.txt", str);
+                if (system(cmd) != 0) {
+                    printf("cannot create directory '%s' for engine "
+                           "statistics\n", str);
+                }
+            }
+        }
+
+        // open engine statistics file
+        gettimeofday(&gap, NULL);
+        sprintf(filename, "%s_%d.txt", binfo.stats_filename, (int)gap.tv_sec);
+        stats_fp = fopen(filename, "w");
+    }
 
     binfo.initialize = 1;
     if (argc > 1) {
@@ -2051,13 +5348,43 @@ int main(int argc, char **argv){
             binfo.initialize = 0;
         }
     }
+    if ((engine->flags & ENGINE_VOLATILE) && !binfo.initialize) {
+        printf("the DB module keeps nothing on disk, initialize anyway\n");
+        binfo.initialize = 1;
+    }
 
     _print_benchinfo(&binfo);
-    do_bench(&binfo);
+    // set before any DB is opened so that every thread inherits it
+    if (affinity_set_mempolicy(&binfo.affinity) != 0) {
+        lprintf("failed to set memory policy, use default\n");
+    }
+    if (binfo.batch_dist.type == RND_ZIPFIAN) {
+        // shared by all runs of a scaling sweep
+        zipf_rnd_init(&binfo.zipf, binfo.ndocs / binfo.batch_dist.b,
+                      binfo.batch_dist.a/100.0, 1024*1024);
+    }
+    if (binfo.scale_mode) {
+        do_scaling(&binfo);
+    } else {
+        do_bench(&binfo, NULL);
+    }
+    keygen_free(&binfo.keygen);
+    rnd_empirical_free(&binfo.keylen);
+    rnd_empirical_free(&binfo.bodylen);
+    if (binfo.batch_dist.type == RND_ZIPFIAN) {
+        zipf_rnd_free(&binfo.zipf);
+    }
+    affinity_free(&binfo.affinity);
+#if defined(__MULTI_BENCH)
+    couch_engine_unload();
+#endif
 
     if (log_fp) {
         fclose(log_fp);
     }
+    if (stats_fp) {
+        fclose(stats_fp);
+    }
 
     return 0;
 }
@@ -69,6 +69,8 @@ extern "C" {
                                              Db **db);
     couchstore_error_t couchstore_set_sync(Db *db, int sync);
     couchstore_error_t couchstore_disable_auto_compaction(Db *db, int cpt);
+    couchstore_error_t couchstore_open_snapshot(Db *db, Db **snapshot);
+    couchstore_error_t couchstore_close_snapshot(Db *snapshot);
 
     /**
      * Close an open database and free all allocated resources.
@@ -252,6 +254,25 @@ extern "C" {
                                                 Doc **pDoc,
                                                 couchstore_open_options options);
 
+    /**
+     * Callback of couchstore_open_document_ref(). 'doc' refers to the
+     * buffers of the DB module, which are valid only until it returns.
+     */
+    typedef void (*couchstore_doc_ref_fn)(Db *db, const Doc *doc, void *ctx);
+
+    /**
+     * Retrieve a doc from the db without copying it: the callback is given
+     * the value in place (e.g., a pinned block, a cursor buffer, or a
+     * buffer reused by the handle). Not supported by all DB modules.
+     *
+     * @return COUCHSTORE_SUCCESS if found (the callback has been called)
+     */
+    couchstore_error_t couchstore_open_document_ref(Db *db,
+                                                    const void *id,
+                                                    size_t idlen,
+                                                    couchstore_doc_ref_fn callback,
+                                                    void *ctx);
+
     /**
      * Retrieve a doc from the db, using a DocInfo.
      * The DocInfo must have been filled in with valid values by an API call such
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+
+#include "couch_engine.h"
+
+// Multi-engine binary: the DB module is a shared object loaded at runtime,
+// and the couchstore API used by the benchmark is forwarded to its
+// function table.
+
+static void *engine_handle = NULL;
+static struct couch_engine *engine = NULL;
+
+// 'name' is either an engine name ('forestdb' => <path>/forestdb_engine.so)
+// or the path of a module
+struct couch_engine * couch_engine_load(const char *name, const char *path)
+{
+    char filename[1024];
+    int len;
+    couch_engine_get_fn *get;
+
+    if (strchr(name, '/')) {
+        len = snprintf(filename, sizeof(filename), "%s", name);
+    } else {
+        len = snprintf(filename, sizeof(filename), "%s/%s_engine.so", path, name);
+    }
+    if (len < 0 || (size_t)len >= sizeof(filename)) {
+        printf("path of DB module '%s' is too long\n", name);
+        return NULL;
+    }
+
+    engine_handle = dlopen(filename, RTLD_NOW | RTLD_LOCAL);
+    if (!engine_handle) {
+        printf("failed to load DB module '%s': %s\n", filename, dlerror());
+        return NULL;
+    }
+    get = (couch_engine_get_fn *)dlsym(engine_handle, "couch_engine_get");
+    if (!get) {
+        printf("'%s' is not a DB module: %s\n", filename, dlerror());
+        dlclose(engine_handle);
+        engine_handle = NULL;
+        return NULL;
+    }
+    engine = get();
+    return engine;
+}
+
+void couch_engine_unload(void)
+{
+    if (engine_handle) {
+        dlclose(engine_handle);
+    }
+    engine_handle = NULL;
+    engine = NULL;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_open_db(const char *filename,
+                                      couchstore_open_flags flags,
+                                      Db **pDb)
+{
+    return engine->open_db(filename, flags, pDb);
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_close_db(Db *db)
+{
+    return engine->close_db(db);
+}
+
+couchstore_error_t couchstore_open_snapshot(Db *db, Db **snapshot)
+{
+    return engine->open_snapshot(db, snapshot);
+}
+
+couchstore_error_t couchstore_close_snapshot(Db *snapshot)
+{
+    return engine->close_snapshot(snapshot);
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_db_info(Db *db, DbInfo* info)
+{
+    return engine->db_info(db, info);
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_save_documents(Db *db, Doc* const docs[], DocInfo *infos[],
+        unsigned numdocs, couchstore_save_options options)
+{
+    return engine->save_documents(db, docs, infos, numdocs, options);
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_save_document(Db *db, const Doc *doc, DocInfo *info,
+        couchstore_save_options options)
+{
+    return engine->save_document(db, doc, info, options);
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_open_document(Db *db,
+                                            const void *id,
+                                            size_t idlen,
+                                            Doc **pDoc,
+                                            couchstore_open_options options)
+{
+    return engine->open_document(db, id, idlen, pDoc, options);
+}
+
+LIBCOUCHSTORE_API
+void couchstore_free_document(Doc *doc)
+{
+    engine->free_document(doc);
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_all_docs(Db *db,
+                                       const sized_buf* startKeyPtr,
+                                       couchstore_docinfos_options options,
+                                       couchstore_changes_callback_fn callback,
+                                       void *ctx)
+{
+    return engine->all_docs(db, startKeyPtr, options, callback, ctx);
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_commit(Db *db)
+{
+    return engine->commit(db);
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_compact_db(Db* source, const char* target_filename)
+{
+    return engine->compact_db(source, target_filename);
+}
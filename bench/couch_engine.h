@@ -0,0 +1,152 @@
+#ifndef _COUCH_ENGINE_H
+#define _COUCH_ENGINE_H
+
+#include <stdint.h>
+
+#include "couch_db.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// what the benchmark has to know about a DB module
+#define ENGINE_THREAD_SAFE (0x01) // a handle can be used by many threads at once
+#define ENGINE_SINGLE_OPEN (0x02) // a file cannot be opened more than once
+#define ENGINE_SYNC_OPTION (0x04) // durability is set by set_sync(), not by 0x10
+#define ENGINE_COMPACTION (0x08) // compaction is triggered by the benchmark
+#define ENGINE_COMPACT_EXCLUSIVE (0x10) // writers are paused during compaction
+#define ENGINE_INFO_HANDLE (0x20) // db_info() needs a handle of its own
+#define ENGINE_CONN (0x40) // all files live in one environment (open_conn())
+#define ENGINE_BG_COMPACTION (0x80) // keeps writing to disk after population
+#define ENGINE_VOLATILE (0x100) // keeps nothing on disk
+
+// engine internals sampled on the progress tick
+#define ENGINE_STAT_NONE ((uint64_t)-1) // not provided by the module
+#define ENGINE_STATS_MAX_LEVELS (8)
+
+// checkpoint policy (set_checkpoint())
+#define ENGINE_CKPT_DEFAULT (0) // whatever the engine does by itself
+#define ENGINE_CKPT_TIME (1) // every 'value' seconds
+#define ENGINE_CKPT_LOG_SIZE (2) // every 'value' bytes of log
+#define ENGINE_CKPT_MANUAL (3) // only when checkpoint() is called
+
+struct couch_engine_stats {
+    uint64_t doc_count;
+    uint64_t space_used; // live data
+    uint64_t file_size; // on disk
+    uint64_t cache_hits; // block/page cache, since open
+    uint64_t cache_misses;
+    uint64_t mem_bytes; // memtables or dirty cache, not on disk yet
+    uint64_t compaction_pending; // bytes left to compact
+    int nlevels;
+    uint64_t level_bytes[ENGINE_STATS_MAX_LEVELS];
+};
+
+struct couch_engine {
+    const char *name; // 'engine' in bench_config.ini
+    const char *desc; // for the report
+    uint32_t flags;
+
+    couchstore_error_t (*open_db)(const char *filename,
+                                  couchstore_open_flags flags, Db **pDb);
+    couchstore_error_t (*close_db)(Db *db);
+    couchstore_error_t (*open_snapshot)(Db *db, Db **snapshot);
+    couchstore_error_t (*close_snapshot)(Db *snapshot);
+    couchstore_error_t (*db_info)(Db *db, DbInfo *info);
+    couchstore_error_t (*save_documents)(Db *db, Doc* const docs[],
+                                         DocInfo *infos[], unsigned numdocs,
+                                         couchstore_save_options options);
+    couchstore_error_t (*save_document)(Db *db, const Doc *doc, DocInfo *info,
+                                        couchstore_save_options options);
+    couchstore_error_t (*open_document)(Db *db, const void *id, size_t idlen,
+                                        Doc **pDoc,
+                                        couchstore_open_options options);
+    void (*free_document)(Doc *doc);
+    couchstore_error_t (*all_docs)(Db *db, const sized_buf *startKeyPtr,
+                                   couchstore_docinfos_options options,
+                                   couchstore_changes_callback_fn callback,
+                                   void *ctx);
+    couchstore_error_t (*commit)(Db *db);
+    couchstore_error_t (*compact_db)(Db *source, const char *target_filename);
+
+    // optional (NULL if not supported)
+    couchstore_error_t (*open_document_ref)(Db *db, const void *id, size_t idlen,
+                                            couchstore_doc_ref_fn callback,
+                                            void *ctx);
+    couchstore_error_t (*open_doc_with_docinfo)(Db *db, DocInfo *docinfo,
+                                                Doc **pDoc,
+                                                couchstore_open_options options);
+    couchstore_error_t (*set_sync)(Db *db, int sync);
+    couchstore_error_t (*set_flags)(uint64_t flags);
+    couchstore_error_t (*set_cache)(uint64_t size);
+    couchstore_error_t (*set_compaction)(int mode, size_t threshold);
+    couchstore_error_t (*set_wal_size)(size_t size);
+    couchstore_error_t (*set_wbs_size)(uint64_t size);
+    couchstore_error_t (*set_idx_type)(int type);
+    couchstore_error_t (*set_raw_body)(int raw);
+    // files become namespaces (KV instances, column families) of the
+    // instance opened by open_conn()
+    couchstore_error_t (*set_namespace)(int on);
+    // set_stats(1) before opening files enables engine statistics
+    // that cost something (RocksDB, WiredTiger); get_stats() fills what the
+    // module knows for all files, other fields are left ENGINE_STAT_NONE
+    couchstore_error_t (*set_stats)(int on);
+    couchstore_error_t (*get_stats)(Db *dbs[], int ndbs,
+                                    struct couch_engine_stats *stats);
+    // durable commits (fsync or equivalent) issued by the module so far,
+    // one per commit call whether it covers a file or the whole instance
+    uint64_t (*sync_count)();
+    // native option from the engine's own section of bench_config.ini,
+    // applied to files opened afterwards (COUCHSTORE_ERROR_INVALID_ARGUMENTS
+    // if the module does not know it)
+    couchstore_error_t (*set_option)(const char *key, const char *value);
+    // checkpoint policy of the connection opened afterwards; checkpoint()
+    // returns when all files are checkpointed, checkpoint_running() also
+    // sees the ones the engine starts by itself
+    couchstore_error_t (*set_checkpoint)(int policy, uint64_t value);
+    couchstore_error_t (*checkpoint)();
+    int (*checkpoint_running)();
+    couchstore_error_t (*open_conn)(const char *filename);
+    couchstore_error_t (*close_conn)();
+};
+
+// exported by every DB module (wrappers/couch_*.cc)
+struct couch_engine * couch_engine_get(void);
+typedef struct couch_engine * couch_engine_get_fn(void);
+
+// multi-engine binary only (bench/couch_engine.cc)
+struct couch_engine * couch_engine_load(const char *name, const char *path);
+void couch_engine_unload(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+// functions common to all modules
+static inline void couch_engine_set_core(struct couch_engine *e)
+{
+    e->open_db = couchstore_open_db;
+    e->close_db = couchstore_close_db;
+    e->open_snapshot = couchstore_open_snapshot;
+    e->close_snapshot = couchstore_close_snapshot;
+    e->db_info = couchstore_db_info;
+    e->save_documents = couchstore_save_documents;
+    e->save_document = couchstore_save_document;
+    e->open_document = couchstore_open_document;
+    e->free_document = couchstore_free_document;
+    e->all_docs = couchstore_all_docs;
+    e->commit = couchstore_commit;
+    e->compact_db = couchstore_compact_db;
+}
+
+// accumulates a per-file value into a get_stats() field
+static inline void couch_engine_stat_add(uint64_t *stat, uint64_t val)
+{
+    if (*stat == ENGINE_STAT_NONE) {
+        *stat = val;
+    } else {
+        *stat += val;
+    }
+}
+
+#endif
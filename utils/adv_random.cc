@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "adv_random.h"
+
+#include "memleak.h"
+
+/*
+ * Histogram file format (one bucket per line, '#' for comments):
+ *   <size> <weight>           : exactly 'size'
+ *   <lower> <upper> <weight>  : uniform in [lower, upper]
+ * Weights are relative; they don't need to sum up to 1 or 100.
+ */
+int rnd_empirical_load(struct rndinfo *ri, const char *filename)
+{
+    size_t i, n, cap, nsmall, nlarge;
+    int ret;
+    char line[1024];
+    double lower, upper, weight, sum, *p;
+    uint32_t *small, *large, s, l;
+    struct rnd_empirical *emp;
+    FILE *fp;
+
+    fp = fopen(filename, "r");
+    if (!fp) {
+        return -1;
+    }
+
+    emp = (struct rnd_empirical *)calloc(1, sizeof(struct rnd_empirical));
+    cap = 64;
+    emp->lower = (int64_t *)malloc(sizeof(int64_t) * cap);
+    emp->upper = (int64_t *)malloc(sizeof(int64_t) * cap);
+    p = (double *)malloc(sizeof(double) * cap);
+
+    n = 0;
+    sum = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == '#') continue;
+        lower = upper = 0;
+        weight = 0;
+        ret = sscanf(line, "%lf %lf %lf", &lower, &upper, &weight);
+        if (ret == 2) {
+            // point mass
+            weight = upper;
+            upper = lower;
+        } else if (ret != 3) {
+            continue;
+        }
+        if (weight <= 0 || upper < lower) continue;
+
+        if (n == cap) {
+            cap *= 2;
+            emp->lower = (int64_t *)realloc(emp->lower, sizeof(int64_t) * cap);
+            emp->upper = (int64_t *)realloc(emp->upper, sizeof(int64_t) * cap);
+            p = (double *)realloc(p, sizeof(double) * cap);
+        }
+        emp->lower[n] = (int64_t)lower;
+        emp->upper[n] = (int64_t)upper;
+        p[n] = weight;
+        sum += weight;
+        n++;
+    }
+    fclose(fp);
+
+    if (n == 0) {
+        free(emp->lower);
+        free(emp->upper);
+        free(emp);
+        free(p);
+        return -1;
+    }
+
+    emp->n = n;
+    emp->prob = (uint64_t *)malloc(sizeof(uint64_t) * n);
+    emp->alias = (uint32_t *)malloc(sizeof(uint32_t) * n);
+    small = (uint32_t *)malloc(sizeof(uint32_t) * n);
+    large = (uint32_t *)malloc(sizeof(uint32_t) * n);
+
+    emp->avg = 0;
+    emp->max = 0;
+    for (i=0;i<n;++i){
+        emp->avg += (p[i] / sum) * (emp->lower[i] + emp->upper[i]) / 2.0;
+        if (emp->upper[i] > emp->max) emp->max = emp->upper[i];
+    }
+
+    // build alias table (Vose's method)
+    nsmall = nlarge = 0;
+    for (i=0;i<n;++i){
+        p[i] = p[i] * n / sum;
+        if (p[i] < 1.0) {
+            small[nsmall++] = i;
+        } else {
+            large[nlarge++] = i;
+        }
+    }
+    while (nsmall > 0 && nlarge > 0) {
+        s = small[--nsmall];
+        l = large[--nlarge];
+        emp->prob[s] = (uint64_t)(p[s] * (double)UINT64_MAX);
+        emp->alias[s] = l;
+        p[l] = (p[l] + p[s]) - 1.0;
+        if (p[l] < 1.0) {
+            small[nsmall++] = l;
+        } else {
+            large[nlarge++] = l;
+        }
+    }
+    // remaining buckets (only numerical errors left) always keep themselves
+    while (nlarge > 0) {
+        l = large[--nlarge];
+        emp->prob[l] = UINT64_MAX;
+        emp->alias[l] = l;
+    }
+    while (nsmall > 0) {
+        s = small[--nsmall];
+        emp->prob[s] = UINT64_MAX;
+        emp->alias[s] = s;
+    }
+
+    free(small);
+    free(large);
+    free(p);
+
+    ri->type = RND_EMPIRICAL;
+    ri->emp = emp;
+    ri->a = 0;
+    ri->b = emp->max;
+    return 0;
+}
+
+void rnd_empirical_free(struct rndinfo *ri)
+{
+    struct rnd_empirical *emp = ri->emp;
+
+    if (ri->type != RND_EMPIRICAL || !emp) return;
+
+    free(emp->lower);
+    free(emp->upper);
+    free(emp->prob);
+    free(emp->alias);
+    free(emp);
+    ri->emp = NULL;
+}
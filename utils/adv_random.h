@@ -84,19 +84,52 @@ typedef enum {
     RND_UNIFORM,
     RND_NORMAL,
     RND_ZIPFIAN,
+    RND_LOGNORMAL,
+    RND_PARETO,
+    RND_BIMODAL,
+    RND_EMPIRICAL,
 } rndtype_t;
 
+// histogram loaded from file, sampled by alias method
+struct rnd_empirical {
+    size_t n;
+    // bucket range (including both bounds)
+    int64_t *lower;
+    int64_t *upper;
+    // probability (scaled to UINT64_MAX) of keeping the bucket itself
+    uint64_t *prob;
+    // bucket selected otherwise
+    uint32_t *alias;
+    double avg;
+    int64_t max;
+};
+
 struct rndinfo{
     rndtype_t type;
     // for uniform: lower bound of range (including itself)
     // for normal: average (or median)
+    // for lognormal: median
+    // for pareto: minimum (=scale)
+    // for bimodal: average of the first mode
     int64_t a;
     // for uniform: upper bound of range (including itself but extremely rare (probability == 1/(2^64))
     // for normal: standard deviation (=sigma)
+    // for lognormal: sigma * 100
+    // for pareto: alpha (=shape) * 100
+    // for bimodal: standard deviation of the first mode
     int64_t b;
+    // for bimodal: average and standard deviation of the second mode,
+    // and probability (percentage) of choosing the second mode
+    int64_t c;
+    int64_t d;
+    int64_t e;
+    // for empirical: sampling table
+    struct rnd_empirical *emp;
 };
 
 static double __PI = 3.141592654;
+// upper limit of values from unbounded (heavy-tailed) distributions
+#define RND_MAX_VALUE ((double)((int64_t)1 << 48))
 
 static int64_t get_random(struct rndinfo* ri, uint64_t rv1, uint64_t rv2)
 {
@@ -112,9 +145,68 @@ static int64_t get_random(struct rndinfo* ri, uint64_t rv1, uint64_t rv2)
         r1 =  sqrt(2*r1);
         return (int64_t)(ri->b * r1 * cos(r2) + ri->a);
     }
+    else if (ri->type == RND_LOGNORMAL){
+        double r1, r2;
+        r1 = -log(1-(((double)rv1) / UINT64_MAX ));
+        r2 =  2 * __PI * (((double)rv2) / UINT64_MAX );
+        r1 =  sqrt(2*r1);
+        r1 = ri->a * exp((ri->b / 100.0) * r1 * cos(r2));
+        return (r1 < RND_MAX_VALUE)?((int64_t)r1):((int64_t)RND_MAX_VALUE);
+    }
+    else if (ri->type == RND_PARETO){
+        double r1;
+        r1 = 1 - (((double)rv1) / UINT64_MAX );
+        if (r1 <= 0) return (int64_t)RND_MAX_VALUE;
+        r1 = ri->a / pow(r1, 100.0 / ri->b);
+        return (r1 < RND_MAX_VALUE)?((int64_t)r1):((int64_t)RND_MAX_VALUE);
+    }
+    else if (ri->type == RND_BIMODAL){
+        double r1, r2;
+        r1 = -log(1-(((double)rv1) / UINT64_MAX ));
+        r2 =  2 * __PI * (((double)rv2) / UINT64_MAX );
+        r1 =  sqrt(2*r1);
+        // low bits of rv1 hardly affect r1, so use them to choose the mode
+        if ((int64_t)((rv1 & 0xffff) % 100) < ri->e) {
+            return (int64_t)(ri->d * r1 * cos(r2) + ri->c);
+        }
+        return (int64_t)(ri->b * r1 * cos(r2) + ri->a);
+    }
+    else if (ri->type == RND_EMPIRICAL){
+        struct rnd_empirical *emp = ri->emp;
+        uint64_t idx = rv1 % emp->n;
+        uint64_t range;
+        if (rv2 > emp->prob[idx]) idx = emp->alias[idx];
+        range = emp->upper[idx] - emp->lower[idx] + 1;
+        return emp->lower[idx] + (int64_t)((rv1 / emp->n) % range);
+    }
     return 0;
 }
 
+// returns average of the distribution
+static double get_random_avg(struct rndinfo* ri)
+{
+    switch(ri->type) {
+    case RND_UNIFORM:
+        return (ri->a + ri->b) / 2.0;
+    case RND_NORMAL:
+        return ri->a;
+    case RND_LOGNORMAL:
+        return ri->a * exp((ri->b / 100.0) * (ri->b / 100.0) / 2);
+    case RND_PARETO:
+        if (ri->b <= 100) return RND_MAX_VALUE; // infinite mean
+        return (ri->b / 100.0) * ri->a / (ri->b / 100.0 - 1);
+    case RND_BIMODAL:
+        return (ri->a * (100 - ri->e) + ri->c * ri->e) / 100.0;
+    case RND_EMPIRICAL:
+        return ri->emp->avg;
+    default:
+        return 0;
+    }
+}
+
+int rnd_empirical_load(struct rndinfo *ri, const char *filename);
+void rnd_empirical_free(struct rndinfo *ri);
+
 #ifdef __RAND_GEN_TEST
 
 void _rand_gen_test()
@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__) && !defined(__ANDROID__)
+#include <sched.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#define _AFFINITY_SUPPORT
+#endif
+
+#include "affinity.h"
+
+#include "memleak.h"
+
+// from <numaif.h> (avoid dependency on libnuma)
+#define _MPOL_DEFAULT (0)
+#define _MPOL_BIND (2)
+#define _MPOL_INTERLEAVE (3)
+#define _MPOL_LOCAL (4)
+
+// "0-3,8,10-11" => {0, 1, 2, 3, 8, 10, 11}
+int affinity_parse_list(const char *str, int *out, int max)
+{
+    int a, b, i, len, n = 0;
+    const char *p = str;
+
+    while (*p) {
+        if (sscanf(p, "%d%n", &a, &len) < 1) break;
+        p += len;
+        b = a;
+        if (*p == '-') {
+            p++;
+            if (sscanf(p, "%d%n", &b, &len) < 1) break;
+            p += len;
+        }
+        for (i=a; i<=b && n<max; ++i) {
+            out[n++] = i;
+        }
+        while (*p == ',' || *p == ' ' || *p == '\n') p++;
+    }
+    return n;
+}
+
+// {0, 1, 2, 3, 8} => "0-3,8"
+char * affinity_list_str(int *list, int n, char *buf)
+{
+    int i, begin;
+    char *p = buf;
+
+    buf[0] = 0;
+    for (i=0;i<n;++i){
+        begin = i;
+        while (i+1 < n && list[i+1] == list[i] + 1) i++;
+        if (p != buf) *(p++) = ',';
+        if (i > begin) {
+            p += sprintf(p, "%d-%d", list[begin], list[i]);
+        } else {
+            p += sprintf(p, "%d", list[i]);
+        }
+    }
+    return buf;
+}
+
+int affinity_init(struct affinity *aff,
+                  affinity_policy_t policy, const char *cpulist,
+                  mempolicy_t mempolicy, const char *nodelist)
+{
+    int i, n, node, cpu, added;
+    int cpus[AFFINITY_MAX_CPUS], pos[AFFINITY_MAX_NODES];
+
+    memset(aff, 0, sizeof(struct affinity));
+    aff->policy = policy;
+    aff->mempolicy = mempolicy;
+    aff->cpu_node = (int *)malloc(sizeof(int) * AFFINITY_MAX_CPUS);
+    aff->order = (int *)malloc(sizeof(int) * AFFINITY_MAX_CPUS);
+    for (i=0;i<AFFINITY_MAX_CPUS;++i){
+        aff->cpu_node[i] = -1;
+    }
+
+    // topology: usable CPUs of each NUMA node
+#ifdef _AFFINITY_SUPPORT
+    {
+        char path[256], line[4096];
+        cpu_set_t allowed;
+        FILE *fp;
+
+        CPU_ZERO(&allowed);
+        sched_getaffinity(0, sizeof(allowed), &allowed);
+        for (node=0; node<AFFINITY_MAX_NODES; ++node){
+            sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+            fp = fopen(path, "r");
+            if (!fp) continue;
+            if (fgets(line, sizeof(line), fp)) {
+                n = affinity_parse_list(line, cpus, AFFINITY_MAX_CPUS);
+                for (i=0;i<n;++i){
+                    cpu = cpus[i];
+                    if (cpu < AFFINITY_MAX_CPUS && cpu < CPU_SETSIZE &&
+                        CPU_ISSET(cpu, &allowed)) {
+                        aff->cpu_node[cpu] = node;
+                    }
+                }
+            }
+            fclose(fp);
+            aff->nnodes = node + 1;
+        }
+        if (aff->nnodes == 0) {
+            // no NUMA information: single node
+            aff->nnodes = 1;
+            for (cpu=0; cpu<AFFINITY_MAX_CPUS && cpu<CPU_SETSIZE; ++cpu){
+                if (CPU_ISSET(cpu, &allowed)) aff->cpu_node[cpu] = 0;
+            }
+        }
+    }
+#else
+    aff->nnodes = 1;
+    n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    for (cpu=0; cpu<n && cpu<AFFINITY_MAX_CPUS; ++cpu){
+        aff->cpu_node[cpu] = 0;
+    }
+#endif
+    for (cpu=0; cpu<AFFINITY_MAX_CPUS; ++cpu){
+        if (aff->cpu_node[cpu] >= 0) {
+            aff->ncpus++;
+            aff->node_mask |= ((uint64_t)1 << aff->cpu_node[cpu]);
+        }
+    }
+
+    // CPU order of thread slots
+    switch(policy) {
+    case AFFINITY_COMPACT:
+        for (node=0; node<aff->nnodes; ++node){
+            for (cpu=0; cpu<AFFINITY_MAX_CPUS; ++cpu){
+                if (aff->cpu_node[cpu] == node) {
+                    aff->order[aff->norder++] = cpu;
+                }
+            }
+        }
+        break;
+
+    case AFFINITY_SCATTER:
+        memset(pos, 0, sizeof(pos));
+        do {
+            added = 0;
+            for (node=0; node<aff->nnodes; ++node){
+                while (pos[node] < AFFINITY_MAX_CPUS &&
+                       aff->cpu_node[pos[node]] != node) {
+                    pos[node]++;
+                }
+                if (pos[node] < AFFINITY_MAX_CPUS) {
+                    aff->order[aff->norder++] = pos[node]++;
+                    added = 1;
+                }
+            }
+        } while (added);
+        break;
+
+    case AFFINITY_LIST:
+        n = affinity_parse_list(cpulist, cpus, AFFINITY_MAX_CPUS);
+        for (i=0;i<n;++i){
+            cpu = cpus[i];
+            // cpu_node[] is -1 for CPUs that are offline or not allowed,
+            // and only covers CPUs that fit in a cpu_set_t
+            if (cpu >= 0 && cpu < AFFINITY_MAX_CPUS && aff->cpu_node[cpu] >= 0) {
+                aff->order[aff->norder++] = cpu;
+            } else {
+                if (aff->nrejected < AFFINITY_MAX_REJECTED) {
+                    aff->rejected[aff->nrejected] = cpu;
+                }
+                aff->nrejected++;
+            }
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    // nodes for interleave/bind (default: all nodes with usable CPUs)
+    if (nodelist && nodelist[0]) {
+        n = affinity_parse_list(nodelist, cpus, AFFINITY_MAX_NODES);
+        aff->node_mask = 0;
+        for (i=0;i<n;++i){
+            if (cpus[i] >= 0 && cpus[i] < AFFINITY_MAX_NODES) {
+                aff->node_mask |= ((uint64_t)1 << cpus[i]);
+            }
+        }
+    }
+
+    if (policy != AFFINITY_NONE && aff->norder == 0) {
+        aff->policy = AFFINITY_NONE;
+        return -1;
+    }
+    return 0;
+}
+
+void affinity_free(struct affinity *aff)
+{
+    free(aff->cpu_node);
+    free(aff->order);
+    aff->cpu_node = aff->order = NULL;
+}
+
+// CPU assigned to the given thread slot, or -1 if not pinned
+int affinity_get_cpu(struct affinity *aff, int slot)
+{
+    if (aff->policy == AFFINITY_NONE || aff->norder == 0) return -1;
+    return aff->order[slot % aff->norder];
+}
+
+// pin the calling thread
+int affinity_set_thread(struct affinity *aff, int slot)
+{
+#ifdef _AFFINITY_SUPPORT
+    int cpu = affinity_get_cpu(aff, slot);
+    cpu_set_t set;
+
+    if (cpu < 0) return 0;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    return 0;
+#endif
+}
+
+// unpin the calling thread (any usable CPU)
+int affinity_reset_thread(struct affinity *aff)
+{
+#ifdef _AFFINITY_SUPPORT
+    int cpu;
+    cpu_set_t set;
+
+    if (aff->policy == AFFINITY_NONE || aff->norder == 0) return 0;
+    CPU_ZERO(&set);
+    for (cpu=0; cpu<AFFINITY_MAX_CPUS && cpu<CPU_SETSIZE; ++cpu){
+        if (aff->cpu_node[cpu] >= 0) CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    return 0;
+#endif
+}
+
+// memory policy of the calling thread (inherited by threads created later)
+int affinity_set_mempolicy(struct affinity *aff)
+{
+#ifdef _AFFINITY_SUPPORT
+    unsigned long mask = aff->node_mask;
+    long ret = 0;
+
+    switch(aff->mempolicy) {
+    case MEMPOLICY_LOCAL:
+        ret = syscall(SYS_set_mempolicy, _MPOL_LOCAL, NULL, 0);
+        if (ret != 0) {
+            // MPOL_LOCAL is not supported before Linux 3.8;
+            // default policy also allocates on the local node
+            ret = syscall(SYS_set_mempolicy, _MPOL_DEFAULT, NULL, 0);
+        }
+        break;
+    case MEMPOLICY_INTERLEAVE:
+        ret = syscall(SYS_set_mempolicy, _MPOL_INTERLEAVE,
+                      &mask, sizeof(mask) * 8 + 1);
+        break;
+    case MEMPOLICY_BIND:
+        ret = syscall(SYS_set_mempolicy, _MPOL_BIND,
+                      &mask, sizeof(mask) * 8 + 1);
+        break;
+    default:
+        break;
+    }
+    return (int)ret;
+#else
+    return 0;
+#endif
+}
+
+struct _affinity_args {
+    struct affinity *aff;
+    int slot;
+    void *(*func)(void *);
+    void *args;
+};
+
+static void * _affinity_thread(void *voidargs)
+{
+    struct _affinity_args *a = (struct _affinity_args *)voidargs;
+    void *(*func)(void *) = a->func;
+    void *args = a->args;
+
+    affinity_set_thread(a->aff, a->slot);
+    free(a);
+
+    return func(args);
+}
+
+// same as thread_create, but the new thread pins itself before running 'func'
+int affinity_thread_create(struct affinity *aff, int slot, thread_t *tid,
+                           void *(*func)(void *), void *args)
+{
+    struct _affinity_args *a;
+
+    if (affinity_get_cpu(aff, slot) < 0) {
+        return thread_create(tid, func, args);
+    }
+
+    a = (struct _affinity_args *)malloc(sizeof(struct _affinity_args));
+    a->aff = aff;
+    a->slot = slot;
+    a->func = func;
+    a->args = args;
+    return thread_create(tid, _affinity_thread, a);
+}
@@ -0,0 +1,63 @@
+#ifndef _JSAHN_AFFINITY_H
+#define _JSAHN_AFFINITY_H
+
+#include <stdint.h>
+
+#include "arch.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AFFINITY_MAX_CPUS (1024)
+#define AFFINITY_MAX_NODES (64)
+#define AFFINITY_MAX_REJECTED (16)
+
+typedef enum {
+    AFFINITY_NONE,
+    AFFINITY_COMPACT, // fill up a NUMA node before moving to the next one
+    AFFINITY_SCATTER, // round-robin over NUMA nodes
+    AFFINITY_LIST // explicit CPU list
+} affinity_policy_t;
+
+typedef enum {
+    MEMPOLICY_DEFAULT,
+    MEMPOLICY_LOCAL,
+    MEMPOLICY_INTERLEAVE,
+    MEMPOLICY_BIND
+} mempolicy_t;
+
+struct affinity {
+    affinity_policy_t policy;
+    mempolicy_t mempolicy;
+    uint64_t node_mask; // nodes for interleave/bind
+    int nnodes;
+    int ncpus;
+    int *cpu_node; // NUMA node of each (usable) CPU, -1 if not usable
+    int norder;
+    int *order; // CPU for each thread slot (slot % norder)
+    // CPUs of the list dropped because they are not usable
+    // (offline, not allowed, or beyond CPU_SETSIZE); first ones only
+    int nrejected;
+    int rejected[AFFINITY_MAX_REJECTED];
+};
+
+int affinity_parse_list(const char *str, int *out, int max);
+char * affinity_list_str(int *list, int n, char *buf);
+
+int affinity_init(struct affinity *aff,
+                  affinity_policy_t policy, const char *cpulist,
+                  mempolicy_t mempolicy, const char *nodelist);
+void affinity_free(struct affinity *aff);
+int affinity_get_cpu(struct affinity *aff, int slot);
+int affinity_set_thread(struct affinity *aff, int slot);
+int affinity_reset_thread(struct affinity *aff);
+int affinity_set_mempolicy(struct affinity *aff);
+int affinity_thread_create(struct affinity *aff, int slot, thread_t *tid,
+                           void *(*func)(void *), void *args);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -8,6 +8,11 @@
 
 static char *abt_array =
     (char*)"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
+// alphabet in ascending ASCII order, used for order-preserving keys
+static char *ord_array =
+    (char*)"0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+// # base-62 digits required to represent a 64-bit index
+#define ORD_KEY_WIDTH KEYGEN_ORD_KEY_WIDTH
 
 void keygen_init(
     struct keygen *keygen,
@@ -54,15 +59,40 @@ void _crc2key(struct keygen *keygen, uint64_t crc, char *buf, size_t len, uint8_
     }
 }
 
+// encode index into fixed-width sortable string, and return its length
+size_t _idx2ordkey(uint64_t idx, char *buf, uint8_t abt_only)
+{
+    int i;
+    size_t ord_array_size = strlen(ord_array);
+
+    if (abt_only) {
+        for (i=ORD_KEY_WIDTH-1;i>=0;--i){
+            buf[i] = ord_array[idx % ord_array_size];
+            idx /= ord_array_size;
+        }
+        return ORD_KEY_WIDTH;
+    } else {
+        // big-endian
+        for (i=sizeof(idx)-1;i>=0;--i){
+            buf[i] = idx & 0xff;
+            idx >>= 8;
+        }
+        return sizeof(idx);
+    }
+}
+
 size_t _crc2keylen(struct rndinfo *prefix_len, uint64_t crc)
 {
-    size_t r;
+    int64_t r;
     BDR_RNG_VARS_SET(crc);
     BDR_RNG_NEXTPAIR;
     BDR_RNG_NEXTPAIR;
     BDR_RNG_NEXTPAIR;
 
     r = get_random(prefix_len, rngz, rngz2);
+    // heavy-tailed distributions may return extremely long lengths
+    if (r < 1) r = 1;
+    if (r > KEYGEN_MAX_SEGLEN) r = KEYGEN_MAX_SEGLEN;
     return r;
 }
 
@@ -121,7 +151,7 @@ uint64_t MurmurHash64A ( const void * key, int len, unsigned int seed )
 size_t keygen_seed2key(struct keygen *keygen, uint64_t seed, char *buf)
 {
     uint64_t i, j;
-    size_t len, cursor;
+    size_t len, cursor, room;
     uint32_t rndvalue;
     uint64_t seed_local, seed64, rnd_sel;
 
@@ -133,9 +163,30 @@ size_t keygen_seed2key(struct keygen *keygen, uint64_t seed, char *buf)
 
     cursor = 0;
     for (i=0;i<keygen->nprefix;++i){
+        // room for this segment, keeping a delimiter and the longest
+        // minimum (ordered index) for each of the following ones
+        room = KEYGEN_MAX_KEYLEN - 1 - cursor -
+               (keygen->nprefix - 1 - i) * (ORD_KEY_WIDTH + 1);
+
         if (i+1 == keygen->nprefix) {
             len = _crc2keylen(&keygen->prefix_len[i], seed64);
-            _crc2key(keygen, seed64, buf + cursor, len, keygen->opt.abt_only);
+            if (len > room) len = room;
+            if (keygen->opt.order == KEYGEN_HASHED) {
+                _crc2key(keygen, seed64, buf + cursor, len, keygen->opt.abt_only);
+            } else {
+                // sortable index first, and then random padding
+                size_t ordlen;
+                uint64_t ord = (keygen->opt.order == KEYGEN_REVERSE)?
+                               (UINT64_MAX - seed):(seed);
+
+                ordlen = _idx2ordkey(ord, buf + cursor, keygen->opt.abt_only);
+                if (len > ordlen) {
+                    _crc2key(keygen, seed64, buf + cursor + ordlen,
+                             len - ordlen, keygen->opt.abt_only);
+                } else {
+                    len = ordlen;
+                }
+            }
         } else {
             BDR_RNG_NEXTPAIR;
             BDR_RNG_NEXTPAIR;
@@ -143,6 +194,7 @@ size_t keygen_seed2key(struct keygen *keygen, uint64_t seed, char *buf)
             seed_local = MurmurHash64A(&rnd_sel, sizeof(rnd_sel), 0);
 
             len = _crc2keylen(&keygen->prefix_len[i], seed_local);
+            if (len > room) len = room;
             _crc2key(keygen, seed_local, buf + cursor, len, keygen->opt.abt_only);
         }
 
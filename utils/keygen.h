@@ -7,9 +7,24 @@
 extern "C" {
 #endif
 
+// maximum length of each prefix (or key) segment
+#define KEYGEN_MAX_SEGLEN (1024)
+// sequential/reverse keys: the last segment starts with the index in base-62
+// digits (62^11 > 2^64), so it is never shorter than this
+#define KEYGEN_ORD_KEY_WIDTH (11)
+// whole key, including the terminating null (segments are cut to fit)
+#define KEYGEN_MAX_KEYLEN (4096)
+
+typedef enum {
+    KEYGEN_HASHED,      // keys scattered over the keyspace (MurmurHash of index)
+    KEYGEN_SEQUENTIAL,  // keys sorted in the same order as index
+    KEYGEN_REVERSE,     // keys sorted in the reverse order of index
+} keygen_order_t;
+
 struct keygen_option {
     uint8_t delimiter;
     uint8_t abt_only;
+    keygen_order_t order;
 };
 
 struct keygen {
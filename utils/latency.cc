@@ -0,0 +1,102 @@
+#include <string.h>
+
+#include "latency.h"
+
+static int _us2idx(uint64_t us)
+{
+    int e, idx;
+    uint64_t v;
+
+    if (us < (1 << LATENCY_SUBBITS)) return us;
+
+    // position of the most significant bit
+    e = 0;
+    v = us;
+    while (v >>= 1) e++;
+
+    idx = (e - LATENCY_SUBBITS + 1) * (1 << LATENCY_SUBBITS) +
+          ((us >> (e - LATENCY_SUBBITS)) & ((1 << LATENCY_SUBBITS) - 1));
+    if (idx >= LATENCY_NBUCKETS) idx = LATENCY_NBUCKETS - 1;
+    return idx;
+}
+
+// returns upper bound of the bucket
+static uint64_t _idx2us(int idx)
+{
+    int e, sub;
+
+    if (idx < (1 << LATENCY_SUBBITS)) return idx;
+
+    e = idx / (1 << LATENCY_SUBBITS) + LATENCY_SUBBITS - 1;
+    sub = idx % (1 << LATENCY_SUBBITS);
+    return ((uint64_t)((1 << LATENCY_SUBBITS) + sub + 1) << (e - LATENCY_SUBBITS)) - 1;
+}
+
+void latency_init(struct latency_stat *ls)
+{
+    memset(ls, 0, sizeof(struct latency_stat));
+}
+
+void latency_add(struct latency_stat *ls, uint64_t us)
+{
+    ls->count++;
+    ls->sum += us;
+    if (us > ls->max) ls->max = us;
+    ls->hist[_us2idx(us)]++;
+}
+
+void latency_merge(struct latency_stat *dst, struct latency_stat *src)
+{
+    int i;
+
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->max > dst->max) dst->max = src->max;
+    for (i=0;i<LATENCY_NBUCKETS;++i){
+        dst->hist[i] += src->hist[i];
+    }
+}
+
+// dst -= src, where src is an earlier copy of dst (i.e., stats of a window).
+// max is approximated by the upper bound of the highest non-empty bucket.
+void latency_sub(struct latency_stat *dst, struct latency_stat *src)
+{
+    int i;
+    uint64_t max = 0;
+
+    dst->count = 0;
+    dst->sum = (dst->sum > src->sum)?(dst->sum - src->sum):(0);
+    for (i=0;i<LATENCY_NBUCKETS;++i){
+        dst->hist[i] = (dst->hist[i] > src->hist[i])?(dst->hist[i] - src->hist[i]):(0);
+        dst->count += dst->hist[i];
+        if (dst->hist[i]) max = _idx2us(i);
+    }
+    if (max < dst->max) dst->max = max;
+}
+
+double latency_avg(struct latency_stat *ls)
+{
+    if (ls->count == 0) return 0;
+    return (double)ls->sum / ls->count;
+}
+
+uint64_t latency_percentile(struct latency_stat *ls, double percent)
+{
+    int i;
+    uint64_t cum, target;
+
+    if (ls->count == 0) return 0;
+
+    target = (uint64_t)(ls->count * percent / 100.0);
+    if (target >= ls->count) target = ls->count - 1;
+
+    cum = 0;
+    for (i=0;i<LATENCY_NBUCKETS;++i){
+        cum += ls->hist[i];
+        if (cum > target) {
+            uint64_t us = _idx2us(i);
+            return (us < ls->max)?(us):(ls->max);
+        }
+    }
+    return ls->max;
+}
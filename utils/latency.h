@@ -0,0 +1,32 @@
+#ifndef _JSAHN_LATENCY_H
+#define _JSAHN_LATENCY_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 8 sub-buckets per power of 2 (up to 2^40 us), about 12% precision
+#define LATENCY_SUBBITS (3)
+#define LATENCY_NBUCKETS ((40 - LATENCY_SUBBITS + 1) * (1 << LATENCY_SUBBITS))
+
+struct latency_stat {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t hist[LATENCY_NBUCKETS];
+};
+
+void latency_init(struct latency_stat *ls);
+void latency_add(struct latency_stat *ls, uint64_t us);
+void latency_merge(struct latency_stat *dst, struct latency_stat *src);
+void latency_sub(struct latency_stat *dst, struct latency_stat *src);
+double latency_avg(struct latency_stat *ls);
+uint64_t latency_percentile(struct latency_stat *ls, double percent);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -74,19 +74,42 @@ void zipf_rnd_init(struct zipf_rnd *zipf, uint64_t n, double s, uint32_t resolut
     }
 }
 
-uint32_t zipf_rnd_get(struct zipf_rnd *zipf)
+void zipf_rnd_cursor_init(struct zipf_rnd_cursor *cur,
+                          struct zipf_rnd *zipf, uint64_t seed)
+{
+    if (seed == 0) seed = 88172645463325252ULL; // all-zero state never changes
+    BDR_RNG_VARS_SET(seed);
+    (void)rngt; // declared by the macro, used by BDR_RNG_NEXT only
+    (void)rngz2;
+
+    cur->zipf = zipf;
+    cur->turn = zipf->turn;
+    cur->rngx = rngx;
+    cur->rngy = rngy;
+    cur->rngz = rngz;
+}
+
+uint32_t zipf_rnd_get(struct zipf_rnd_cursor *cur)
 {
     uint32_t idx, r;
-    r = rand()  % zipf->resolution;
-    idx = (zipf->map[r] + zipf->turn) % zipf->n;
+    uint64_t rngx = cur->rngx, rngy = cur->rngy, rngz = cur->rngz, rngt;
+    struct zipf_rnd *zipf = cur->zipf;
+
+    BDR_RNG_NEXT;
+    cur->rngx = rngx;
+    cur->rngy = rngy;
+    cur->rngz = rngz;
+
+    r = rngz % zipf->resolution;
+    idx = (zipf->map[r] + cur->turn) % zipf->n;
 
     return zipf->table[idx];
 }
 
-void zipf_rnd_shift(struct zipf_rnd *zipf, uint32_t shift)
+void zipf_rnd_shift(struct zipf_rnd_cursor *cur, uint32_t shift)
 {
-    zipf->turn += shift;
-    zipf->turn = zipf->turn % zipf->n;
+    cur->turn += shift;
+    cur->turn = cur->turn % cur->zipf->n;
 }
 
 void zipf_rnd_free(struct zipf_rnd *zipf)
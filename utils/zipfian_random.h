@@ -18,11 +18,22 @@ struct zipf_rnd{
     double sum;
 };
 
+// per-thread sampling state over the shared (read-only) tables
+struct zipf_rnd_cursor{
+    struct zipf_rnd *zipf;
+    uint64_t turn;
+    // xorshift state (same generator as BDR_RNG)
+    uint64_t rngx, rngy, rngz;
+};
+
 void zipf_rnd_init(struct zipf_rnd *zipf, uint64_t n, double s, uint32_t resolution);
-uint32_t zipf_rnd_get(struct zipf_rnd *zipf);
-void zipf_rnd_shift(struct zipf_rnd *zipf, uint32_t shift);
 void zipf_rnd_free(struct zipf_rnd *zipf);
 
+void zipf_rnd_cursor_init(struct zipf_rnd_cursor *cur,
+                          struct zipf_rnd *zipf, uint64_t seed);
+uint32_t zipf_rnd_get(struct zipf_rnd_cursor *cur);
+void zipf_rnd_shift(struct zipf_rnd_cursor *cur, uint32_t shift);
+
 #ifdef __cplusplus
 }
 #endif
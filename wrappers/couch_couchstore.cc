@@ -0,0 +1,40 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "couch_db.h"
+#include "couch_engine.h"
+
+// Couchstore: the API is implemented by libcouchstore itself,
+// only the functions it does not have are added here.
+
+// a couchstore handle does not see commits made after it was opened,
+// so another read-only handle on the same file is a snapshot by itself
+couchstore_error_t couchstore_open_snapshot(Db *db, Db **snapshot)
+{
+    DbInfo info;
+
+    couchstore_db_info(db, &info);
+    return couchstore_open_db(info.filename, COUCHSTORE_OPEN_FLAG_RDONLY, snapshot);
+}
+
+couchstore_error_t couchstore_close_snapshot(Db *snapshot)
+{
+    return couchstore_close_db(snapshot);
+}
+
+struct couch_engine * couch_engine_get(void)
+{
+    static struct couch_engine e;
+
+    memset(&e, 0, sizeof(e));
+    e.name = "couchstore";
+    e.desc = "Couchstore";
+    e.flags = ENGINE_COMPACTION | ENGINE_COMPACT_EXCLUSIVE;
+    couch_engine_set_core(&e);
+    // couchstore iterates the by-id index only; snapshot scans read the body
+    e.open_doc_with_docinfo = couchstore_open_doc_with_docinfo;
+
+    return &e;
+}
@@ -2,10 +2,13 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <stddef.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "libforestdb/forestdb.h"
 #include "couch_db.h"
+#include "couch_engine.h"
 /*
 #include "configuration.h"
 #include "debug.h"
@@ -25,6 +28,8 @@
 struct _db {
     fdb_handle *fdb;
     char *filename;
+    int kv_ins; // fdb is a KV instance of the namespace file
+    int sync; // opened with the sync flag (0x10)
 };
 
 static uint64_t config_flags = 0x0;
@@ -32,6 +37,7 @@ static uint64_t cache_size = 0;
 static int c_auto = 1;
 static size_t c_threshold = 30;
 static size_t wal_size = 4096;
+static uint64_t nsyncs = 0;
 couchstore_error_t couchstore_set_flags(uint64_t flags) {
     config_flags = flags;
     return COUCHSTORE_SUCCESS;
@@ -50,11 +56,112 @@ couchstore_error_t couchstore_set_wal_size(size_t size) {
     wal_size = size;
     return COUCHSTORE_SUCCESS;
 }
+// commits of handles opened with the sync flag
+uint64_t couchstore_sync_count() {
+    return nsyncs;
+}
+
+// namespace mode: all files are KV instances of one DB file (open_conn()),
+// sharing its WAL, buffer cache and commits
+static int ns_mode = 0;
+static char *ns_path = NULL;
+static fdb_handle *ns_super = NULL;
+static pthread_mutex_t ns_lock = PTHREAD_MUTEX_INITIALIZER;
+couchstore_error_t couchstore_set_namespace(int on) {
+    ns_mode = on;
+    return COUCHSTORE_SUCCESS;
+}
+// the DB file itself is opened by the first couchstore_open_db()
+couchstore_error_t couchstore_open_conn(const char *filename) {
+    if (ns_mode) {
+        ns_path = (char*)malloc(strlen(filename)+1);
+        strcpy(ns_path, filename);
+    }
+    return COUCHSTORE_SUCCESS;
+}
 couchstore_error_t couchstore_close_conn() {
+    if (ns_super) {
+        fdb_close(ns_super);
+        ns_super = NULL;
+    }
+    free(ns_path);
+    ns_path = NULL;
     fdb_shutdown();
     return COUCHSTORE_SUCCESS;
 }
 
+// fdb_config fields that can be set from [forestdb] in bench_config.ini
+struct fdb_option {
+    const char *name;
+    size_t offset;
+    size_t size;
+};
+#define FDB_OPTION(field) \
+    {#field, offsetof(fdb_config, field), sizeof(((fdb_config*)0)->field)}
+static struct fdb_option fdb_options[] = {
+    FDB_OPTION(chunksize),
+    FDB_OPTION(blocksize),
+    FDB_OPTION(buffercache_size),
+    FDB_OPTION(wal_threshold),
+    FDB_OPTION(wal_flush_before_commit),
+    FDB_OPTION(purging_interval),
+    FDB_OPTION(seqtree_opt),
+    FDB_OPTION(durability_opt),
+    FDB_OPTION(flags),
+    FDB_OPTION(compaction_buf_maxsize),
+    FDB_OPTION(cleanup_cache_onclose),
+    FDB_OPTION(compress_document_body),
+    FDB_OPTION(compaction_mode),
+    FDB_OPTION(compaction_threshold),
+    FDB_OPTION(compaction_minimum_filesize),
+    FDB_OPTION(compactor_sleep_duration),
+};
+#define FDB_NOPTIONS (sizeof(fdb_options) / sizeof(struct fdb_option))
+
+// set options override what the benchmark configures
+static int option_set[FDB_NOPTIONS];
+static uint64_t option_val[FDB_NOPTIONS];
+
+couchstore_error_t couchstore_set_option(const char *key, const char *value)
+{
+    size_t i;
+    char *end;
+
+    for (i=0;i<FDB_NOPTIONS;++i){
+        if (strcmp(fdb_options[i].name, key)) continue;
+        if (!strcmp(value, "true") || !strcmp(value, "on")) {
+            option_val[i] = 1;
+        } else if (!strcmp(value, "false") || !strcmp(value, "off")) {
+            option_val[i] = 0;
+        } else {
+            option_val[i] = strtoull(value, &end, 0);
+            if (end == value || *end) {
+                return COUCHSTORE_ERROR_INVALID_ARGUMENTS;
+            }
+        }
+        option_set[i] = 1;
+        return COUCHSTORE_SUCCESS;
+    }
+    return COUCHSTORE_ERROR_INVALID_ARGUMENTS;
+}
+
+static void _apply_options(fdb_config *config)
+{
+    size_t i;
+    uint8_t *field;
+
+    for (i=0;i<FDB_NOPTIONS;++i){
+        if (!option_set[i]) continue;
+        field = (uint8_t*)config + fdb_options[i].offset;
+        switch (fdb_options[i].size) {
+        case 1: *(uint8_t*)field = option_val[i]; break;
+        case 2: *(uint16_t*)field = option_val[i]; break;
+        case 4: *(uint32_t*)field = option_val[i]; break;
+        case 8: *(uint64_t*)field = option_val[i]; break;
+        }
+    }
+}
+
 void logCallbackFunc(int err_code,
                      const char *err_msg,
                      void *pCtxData) {
@@ -62,25 +169,9 @@ void logCallbackFunc(int err_code,
             (char *) pCtxData, err_code, err_msg);
 }
 
-LIBCOUCHSTORE_API
-couchstore_error_t couchstore_open_db(const char *filename,
-                                      couchstore_open_flags flags,
-                                      Db **pDb)
-{
-    return couchstore_open_db_ex(filename, flags,
-                                 NULL, pDb);
-}
-
-LIBCOUCHSTORE_API
-couchstore_error_t couchstore_open_db_ex(const char *filename,
-                                         couchstore_open_flags flags,
-                                         const couch_file_ops *ops,
-                                         Db **pDb)
+static fdb_config _get_config(couchstore_open_flags flags)
 {
     fdb_config config;
-    fdb_status status;
-    fdb_handle *fdb;
-    char *fname = (char *)filename;
 
     memset(&config, 0, sizeof(fdb_config));
     config = fdb_get_default_config();
@@ -93,7 +184,12 @@ couchstore_error_t couchstore_open_db_ex(const char *filename,
     config.chunksize = sizeof(uint64_t);
     config.buffercache_size = (uint64_t)cache_size;
     config.wal_threshold = wal_size;
-    config.seqtree_opt = FDB_SEQTREE_NOT_USE;
+    if (config_flags & 0x2) {
+        // snapshots need the sequence tree
+        config.seqtree_opt = FDB_SEQTREE_USE;
+    } else {
+        config.seqtree_opt = FDB_SEQTREE_NOT_USE;
+    }
     if (flags & 0x10) {
         config.durability_opt = FDB_DRB_NONE;
     } else {
@@ -103,16 +199,65 @@ couchstore_error_t couchstore_open_db_ex(const char *filename,
     if (config_flags & 0x1) {
         config.wal_flush_before_commit = true;
     }
+    _apply_options(&config);
+
+    return config;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_open_db(const char *filename,
+                                      couchstore_open_flags flags,
+                                      Db **pDb)
+{
+    return couchstore_open_db_ex(filename, flags,
+                                 NULL, pDb);
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_open_db_ex(const char *filename,
+                                         couchstore_open_flags flags,
+                                         const couch_file_ops *ops,
+                                         Db **pDb)
+{
+    fdb_status status;
+    fdb_handle *fdb;
+    char *fname = (char *)filename;
+    const char *kv_name;
+    fdb_config config;
 
     *pDb = (Db*)malloc(sizeof(Db));
     //(*pDb)->seqnum = 0;
     (*pDb)->filename = (char *)malloc(strlen(filename)+1);
     strcpy((*pDb)->filename, filename);
-
-    status = fdb_open(&fdb, fname, &config);
+    (*pDb)->kv_ins = 0;
+    (*pDb)->sync = (flags & 0x10)?(1):(0);
+
+    if (ns_path) {
+        kv_name = strrchr(filename, '/');
+        kv_name = (kv_name)?(kv_name+1):(filename);
+        pthread_mutex_lock(&ns_lock);
+        status = FDB_RESULT_SUCCESS;
+        if (!ns_super) {
+            config = _get_config(flags);
+            config.multi_kv_instances = true;
+            status = fdb_open(&ns_super, ns_path, &config);
+        }
+        if (status == FDB_RESULT_SUCCESS) {
+            // fails if the instance already exists
+            fdb_kv_ins_create(ns_super, kv_name);
+            status = fdb_kv_ins_open(ns_super, kv_name, &fdb);
+            (*pDb)->kv_ins = 1;
+        }
+        pthread_mutex_unlock(&ns_lock);
+    } else {
+        config = _get_config(flags);
+        status = fdb_open(&fdb, fname, &config);
+    }
     (*pDb)->fdb = fdb;
 
-    status = fdb_set_log_callback(fdb, logCallbackFunc, (void*)"worker");
+    if (status == FDB_RESULT_SUCCESS) {
+        status = fdb_set_log_callback(fdb, logCallbackFunc, (void*)"worker");
+    }
 
     if (status == FDB_RESULT_SUCCESS) {
         return COUCHSTORE_SUCCESS;
@@ -123,10 +268,48 @@ couchstore_error_t couchstore_open_db_ex(const char *filename,
     }
 }
 
+// point-in-time view of the last commit; requires sequence tree (flag 0x2)
+// not available in namespace mode: the snapshot of a KV instance handle
+// would be closed as a separate DB file handle
+couchstore_error_t couchstore_open_snapshot(Db *db, Db **snapshot)
+{
+    fdb_info info;
+    fdb_status status;
+    fdb_handle *fdb;
+
+    if (db->kv_ins) {
+        return COUCHSTORE_ERROR_INVALID_ARGUMENTS;
+    }
+
+    fdb_get_dbinfo(db->fdb, &info);
+    status = fdb_snapshot_open(db->fdb, &fdb, info.last_seqnum);
+    if (status != FDB_RESULT_SUCCESS) {
+        return COUCHSTORE_ERROR_OPEN_FILE;
+    }
+
+    *snapshot = (Db*)malloc(sizeof(Db));
+    (*snapshot)->kv_ins = 0;
+    (*snapshot)->sync = 0;
+    (*snapshot)->filename = (char *)malloc(strlen(db->filename)+1);
+    strcpy((*snapshot)->filename, db->filename);
+    (*snapshot)->fdb = fdb;
+
+    return COUCHSTORE_SUCCESS;
+}
+
+couchstore_error_t couchstore_close_snapshot(Db *snapshot)
+{
+    return couchstore_close_db(snapshot);
+}
+
 LIBCOUCHSTORE_API
 couchstore_error_t couchstore_close_db(Db *db)
 {
-    fdb_close(db->fdb);
+    if (db->kv_ins) {
+        fdb_kv_ins_close(db->fdb);
+    } else {
+        fdb_close(db->fdb);
+    }
     free(db->filename);
     free(db);
 
@@ -136,21 +319,43 @@ couchstore_error_t couchstore_close_db(Db *db)
 LIBCOUCHSTORE_API
 couchstore_error_t couchstore_db_info(Db *db, DbInfo* info)
 {
-    char **file, **new_file;
-    size_t offset;
+    fdb_info fdbinfo;
 
+    if (fdb_get_dbinfo(db->fdb, &fdbinfo) != FDB_RESULT_SUCCESS) {
+        return COUCHSTORE_ERROR_READ;
+    }
     info->space_used = fdb_estimate_space_used(db->fdb);
+    info->doc_count = fdbinfo.doc_count;
+    info->last_sequence = fdbinfo.last_seqnum;
+    info->deleted_count = 0;
+    info->header_position = 0;
+    // the file being written to (the new one during compaction)
+    if (fdbinfo.new_filename) {
+        info->filename = fdbinfo.new_filename;
+    } else {
+        info->filename = fdbinfo.filename;
+    }
+
+    return COUCHSTORE_SUCCESS;
+}
 
-    // hack the DB handle to get internal filename
-    offset = sizeof(void*)*3;
-    file = *(char***)((uint8_t*)db->fdb + offset);
-    offset = sizeof(void*)*4;
-    new_file = *(char***)((uint8_t*)db->fdb + offset);
+// KV instances share their file, whose info is then counted only once
+couchstore_error_t couchstore_get_stats(Db *dbs[], int ndbs,
+                                        struct couch_engine_stats *stats)
+{
+    int i;
+    fdb_info info;
 
-    if (new_file) {
-        info->filename = *new_file;
-    } else {
-        info->filename = *file;
+    for (i=0;i<ndbs;++i){
+        if (fdb_get_dbinfo(dbs[i]->fdb, &info) != FDB_RESULT_SUCCESS) {
+            continue;
+        }
+        couch_engine_stat_add(&stats->doc_count, info.doc_count);
+        if (dbs[i]->kv_ins && i > 0) {
+            continue;
+        }
+        couch_engine_stat_add(&stats->space_used, info.space_used);
+        couch_engine_stat_add(&stats->file_size, info.file_size);
     }
 
     return COUCHSTORE_SUCCESS;
@@ -374,6 +579,62 @@ couchstore_error_t couchstore_docinfos_by_sequence(Db *db,
     return COUCHSTORE_SUCCESS;
 }
 
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_all_docs(Db *db,
+                                       const sized_buf* startKeyPtr,
+                                       couchstore_docinfos_options options,
+                                       couchstore_changes_callback_fn callback,
+                                       void *ctx)
+{
+    int ret = 0;
+    fdb_doc *_doc;
+    fdb_status status;
+    fdb_iterator *iterator;
+    DocInfo *docinfo;
+    size_t rev_meta_size, max_meta_size = 256;
+    size_t meta_offset;
+
+    meta_offset = sizeof(uint64_t)*1 + sizeof(int) + sizeof(couchstore_content_meta_flags);
+
+    status = fdb_iterator_init(db->fdb, &iterator,
+                               (startKeyPtr)?(startKeyPtr->buf):(NULL),
+                               (startKeyPtr)?(startKeyPtr->size):(0),
+                               NULL, 0, FDB_ITR_NO_DELETES);
+    if (status != FDB_RESULT_SUCCESS) {
+        return COUCHSTORE_ERROR_READ;
+    }
+
+    docinfo = (DocInfo*)malloc(sizeof(DocInfo) + max_meta_size);
+
+    while (ret >= 0) {
+        _doc = NULL;
+        status = fdb_iterator_next(iterator, &_doc);
+        if (status != FDB_RESULT_SUCCESS) break;
+
+        memcpy(&rev_meta_size, (uint8_t*)_doc->meta + meta_offset, sizeof(size_t));
+        if (rev_meta_size > max_meta_size) {
+            max_meta_size = rev_meta_size;
+            docinfo = (DocInfo*)realloc(docinfo, sizeof(DocInfo) + max_meta_size);
+        }
+
+        memset(docinfo, 0, sizeof(DocInfo));
+        docinfo->id.buf = (char *)_doc->key;
+        docinfo->id.size = _doc->keylen;
+        docinfo->size = _doc->bodylen;
+        docinfo->bp = _doc->offset;
+        docinfo->db_seq = _doc->seqnum;
+        _buf_to_docinfo(_doc->meta, _doc->metalen, docinfo);
+
+        ret = callback(db, docinfo, ctx);
+        fdb_doc_free(_doc);
+    }
+
+    free(docinfo);
+    fdb_iterator_close(iterator);
+
+    return (ret < 0)?(COUCHSTORE_ERROR_CANCEL):(COUCHSTORE_SUCCESS);
+}
+
 LIBCOUCHSTORE_API
 couchstore_error_t couchstore_open_document(Db *db,
                                             const void *id,
@@ -396,10 +657,9 @@ couchstore_error_t couchstore_open_document(Db *db,
 
     status = fdb_get(db->fdb, &_doc);
     if (status != FDB_RESULT_SUCCESS) {
-        printf("\nget error %.*s\n", (int)idlen, (char*)id);
-        ret = COUCHSTORE_ERROR_DOC_NOT_FOUND;
+        *pDoc = NULL;
+        return COUCHSTORE_ERROR_DOC_NOT_FOUND;
     }
-    //assert(status == FDB_RESULT_SUCCESS);
 
     *pDoc = (Doc *)malloc(sizeof(Doc));
     (*pDoc)->id.buf = (char*)_doc.key;
@@ -412,7 +672,6 @@ couchstore_error_t couchstore_open_document(Db *db,
     return ret;
 }
 
-
 LIBCOUCHSTORE_API
 void couchstore_free_document(Doc *doc)
 {
@@ -432,6 +691,9 @@ LIBCOUCHSTORE_API
 couchstore_error_t couchstore_commit(Db *db)
 {
     fdb_commit(db->fdb, FDB_COMMIT_NORMAL);
+    if (db->sync) {
+        __sync_fetch_and_add(&nsyncs, 1);
+    }
     return COUCHSTORE_SUCCESS;
 }
 
@@ -452,3 +714,25 @@ couchstore_error_t couchstore_compact_db(Db* source, const char* target_filename
     return couchstore_compact_db_ex(source, target_filename, 0x0, NULL);
 }
 
+struct couch_engine * couch_engine_get(void)
+{
+    static struct couch_engine e;
+
+    memset(&e, 0, sizeof(e));
+    e.name = "forestdb";
+    e.desc = "ForestDB";
+    e.flags = ENGINE_COMPACTION | ENGINE_INFO_HANDLE;
+    couch_engine_set_core(&e);
+    e.set_flags = couchstore_set_flags;
+    e.set_cache = couchstore_set_cache;
+    e.set_compaction = couchstore_set_compaction;
+    e.set_wal_size = couchstore_set_wal_size;
+    e.set_namespace = couchstore_set_namespace;
+    e.open_conn = couchstore_open_conn;
+    e.close_conn = couchstore_close_conn;
+    e.get_stats = couchstore_get_stats;
+    e.sync_count = couchstore_sync_count;
+    e.set_option = couchstore_set_option;
+
+    return &e;
+}
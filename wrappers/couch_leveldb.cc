@@ -4,9 +4,11 @@
 #include <string.h>
 #include <assert.h>
 #include <sys/stat.h>
+#include <pthread.h>
 
 #include "leveldb/c.h"
 #include "couch_db.h"
+#include "couch_engine.h"
 
 #define METABUF_MAXLEN (256)
 
@@ -15,11 +17,15 @@ struct _db {
     leveldb_options_t *options;
     leveldb_readoptions_t *read_options;
     leveldb_writeoptions_t *write_options;
+    int sync; // write_options has sync on
+    const leveldb_snapshot_t *snapshot;
     char *filename;
 };
 
 static uint64_t cache_size = 0;
 static uint64_t wbs_size = 4*1024*1024;
+static uint64_t nsyncs = 0;
+static int raw_body = 0;
 couchstore_error_t couchstore_set_cache(uint64_t size)
 {
     cache_size = size;
@@ -29,6 +35,91 @@ couchstore_error_t couchstore_set_wbs_size(uint64_t size) {
     wbs_size = size;
     return COUCHSTORE_SUCCESS;
 }
+// values are stored as they are, without the docinfo header
+couchstore_error_t couchstore_set_raw_body(int raw) {
+    raw_body = raw;
+    return COUCHSTORE_SUCCESS;
+}
+
+// options that can be set from [leveldb] in bench_config.ini
+// (LevelDB has no options string, each one has its own setter)
+enum {
+    OPT_WRITE_BUFFER_SIZE,
+    OPT_MAX_OPEN_FILES,
+    OPT_BLOCK_SIZE,
+    OPT_BLOCK_RESTART_INTERVAL,
+    OPT_MAX_FILE_SIZE,
+    OPT_COMPRESSION,
+    OPT_PARANOID_CHECKS,
+    OPT_BLOOM_BITS_PER_KEY,
+    NOPTIONS
+};
+static const char *option_names[NOPTIONS] = {
+    "write_buffer_size",
+    "max_open_files",
+    "block_size",
+    "block_restart_interval",
+    "max_file_size",
+    "compression", // 0: none, 1: snappy
+    "paranoid_checks",
+    "bloom_bits_per_key",
+};
+static int option_set[NOPTIONS];
+static uint64_t option_val[NOPTIONS];
+static leveldb_filterpolicy_t *bloom = NULL;
+
+couchstore_error_t couchstore_set_option(const char *key, const char *value)
+{
+    int i;
+    char *end;
+
+    for (i=0;i<NOPTIONS;++i){
+        if (strcmp(option_names[i], key)) continue;
+        option_val[i] = strtoull(value, &end, 0);
+        if (end == value || *end) {
+            return COUCHSTORE_ERROR_INVALID_ARGUMENTS;
+        }
+        option_set[i] = 1;
+        return COUCHSTORE_SUCCESS;
+    }
+    return COUCHSTORE_ERROR_INVALID_ARGUMENTS;
+}
+
+// on top of what the benchmark configures
+static void _apply_options(leveldb_options_t *options)
+{
+    if (option_set[OPT_WRITE_BUFFER_SIZE]) {
+        leveldb_options_set_write_buffer_size(options,
+                                              option_val[OPT_WRITE_BUFFER_SIZE]);
+    }
+    if (option_set[OPT_MAX_OPEN_FILES]) {
+        leveldb_options_set_max_open_files(options, option_val[OPT_MAX_OPEN_FILES]);
+    }
+    if (option_set[OPT_BLOCK_SIZE]) {
+        leveldb_options_set_block_size(options, option_val[OPT_BLOCK_SIZE]);
+    }
+    if (option_set[OPT_BLOCK_RESTART_INTERVAL]) {
+        leveldb_options_set_block_restart_interval(
+            options, option_val[OPT_BLOCK_RESTART_INTERVAL]);
+    }
+    if (option_set[OPT_MAX_FILE_SIZE]) {
+        leveldb_options_set_max_file_size(options, option_val[OPT_MAX_FILE_SIZE]);
+    }
+    if (option_set[OPT_COMPRESSION]) {
+        leveldb_options_set_compression(options, option_val[OPT_COMPRESSION]);
+    }
+    if (option_set[OPT_PARANOID_CHECKS]) {
+        leveldb_options_set_paranoid_checks(options, option_val[OPT_PARANOID_CHECKS]);
+    }
+    if (option_set[OPT_BLOOM_BITS_PER_KEY]) {
+        // shared by all DBs, must outlive them
+        if (!bloom) {
+            bloom = leveldb_filterpolicy_create_bloom(
+                        option_val[OPT_BLOOM_BITS_PER_KEY]);
+        }
+        leveldb_options_set_filter_policy(options, bloom);
+    }
+}
 
 LIBCOUCHSTORE_API
 couchstore_error_t couchstore_open_db(const char *filename,
@@ -65,11 +156,14 @@ couchstore_error_t couchstore_open_db_ex(const char *filename,
     }
 
     leveldb_options_set_max_open_files(ppdb->options, 1000);
+    _apply_options(ppdb->options);
     ppdb->db = leveldb_open(ppdb->options, ppdb->filename, &err);
 
+    ppdb->snapshot = NULL;
     ppdb->read_options = leveldb_readoptions_create();
     ppdb->write_options = leveldb_writeoptions_create();
     leveldb_writeoptions_set_sync(ppdb->write_options, 1);
+    ppdb->sync = 1;
 
     return COUCHSTORE_SUCCESS;
 }
@@ -77,6 +171,44 @@ couchstore_error_t couchstore_open_db_ex(const char *filename,
 couchstore_error_t couchstore_set_sync(Db *db, int sync)
 {
     leveldb_writeoptions_set_sync(db->write_options, sync);
+    db->sync = sync;
+    return COUCHSTORE_SUCCESS;
+}
+
+// synced write batches (one WAL sync each)
+uint64_t couchstore_sync_count()
+{
+    return nsyncs;
+}
+
+// shares the DB instance; only the read options are bound to the snapshot
+couchstore_error_t couchstore_open_snapshot(Db *db, Db **snapshot)
+{
+    Db *ppdb;
+
+    *snapshot = (Db*)malloc(sizeof(Db));
+    ppdb = *snapshot;
+    *ppdb = *db;
+
+    ppdb->filename = (char*)malloc(strlen(db->filename)+1);
+    strcpy(ppdb->filename, db->filename);
+
+    ppdb->snapshot = leveldb_create_snapshot(db->db);
+    ppdb->read_options = leveldb_readoptions_create();
+    leveldb_readoptions_set_snapshot(ppdb->read_options, ppdb->snapshot);
+    // long scans should not evict the working set of point reads
+    leveldb_readoptions_set_fill_cache(ppdb->read_options, 0);
+
+    return COUCHSTORE_SUCCESS;
+}
+
+couchstore_error_t couchstore_close_snapshot(Db *snapshot)
+{
+    leveldb_release_snapshot(snapshot->db, snapshot->snapshot);
+    leveldb_readoptions_destroy(snapshot->read_options);
+    free(snapshot->filename);
+    free(snapshot);
+
     return COUCHSTORE_SUCCESS;
 }
 
@@ -107,6 +239,53 @@ couchstore_error_t couchstore_db_info(Db *db, DbInfo* info)
     return COUCHSTORE_SUCCESS;
 }
 
+// level sizes from the "leveldb.stats" table:
+// Level  Files Size(MB) Time(sec) Read(MB) Write(MB)
+// --------------------------------------------------
+//   0        2        4         0        0         4
+static void _add_level_sizes(const char *str, struct couch_engine_stats *stats)
+{
+    int level, nfiles;
+    double size_mb;
+
+    str = (str)?(strstr(str, "---\n")):(NULL);
+    if (!str) return;
+    str += 4;
+    while (sscanf(str, "%d %d %lf", &level, &nfiles, &size_mb) == 3) {
+        if (level >= 0 && level < ENGINE_STATS_MAX_LEVELS) {
+            couch_engine_stat_add(&stats->level_bytes[level],
+                                  (uint64_t)(size_mb * 1024 * 1024));
+            if (level >= stats->nlevels) {
+                stats->nlevels = level + 1;
+            }
+        }
+        str = strchr(str, '\n');
+        if (!str) break;
+        str++;
+    }
+}
+
+// LevelDB has no cache counters; the table files are all it reports
+couchstore_error_t couchstore_get_stats(Db *dbs[], int ndbs,
+                                        struct couch_engine_stats *stats)
+{
+    int i, level;
+    char *str;
+
+    for (i=0;i<ndbs;++i){
+        str = leveldb_property_value(dbs[i]->db, "leveldb.stats");
+        _add_level_sizes(str, stats);
+        leveldb_free(str);
+    }
+    for (level=0;level<stats->nlevels;++level){
+        if (stats->level_bytes[level] != ENGINE_STAT_NONE) {
+            couch_engine_stat_add(&stats->file_size, stats->level_bytes[level]);
+        }
+    }
+
+    return COUCHSTORE_SUCCESS;
+}
+
 size_t _docinfo_to_buf(DocInfo *docinfo, void *buf)
 {
     // [db_seq,] rev_seq, deleted, content_meta, rev_meta (size), rev_meta (buf)
@@ -134,38 +313,94 @@ size_t _docinfo_to_buf(DocInfo *docinfo, void *buf)
     return offset;
 }
 
+// the DB instance is shared by all threads, so the encoding buffer and the
+// write batch are kept per thread (thread-specific data, freed when the
+// thread exits) and reused by every call
+struct _enc_ctx {
+    uint8_t *buf;
+    size_t size;
+    leveldb_writebatch_t *wb;
+};
+
+static pthread_key_t enc_key;
+static pthread_once_t enc_key_once = PTHREAD_ONCE_INIT;
+
+static void _enc_ctx_free(void *voidctx)
+{
+    struct _enc_ctx *ctx = (struct _enc_ctx *)voidctx;
+    free(ctx->buf);
+    leveldb_writebatch_destroy(ctx->wb);
+    free(ctx);
+}
+
+static void _enc_key_create(void)
+{
+    pthread_key_create(&enc_key, _enc_ctx_free);
+}
+
+static struct _enc_ctx * _enc_ctx_get(void)
+{
+    struct _enc_ctx *ctx;
+
+    pthread_once(&enc_key_once, _enc_key_create);
+    ctx = (struct _enc_ctx *)pthread_getspecific(enc_key);
+    if (!ctx) {
+        ctx = (struct _enc_ctx *)calloc(1, sizeof(struct _enc_ctx));
+        ctx->wb = leveldb_writebatch_create();
+        pthread_setspecific(enc_key, ctx);
+    }
+    return ctx;
+}
+
+static uint8_t * _enc_buf_reserve(struct _enc_ctx *ctx, size_t size)
+{
+    if (size > ctx->size) {
+        ctx->size = (size > ctx->size * 2)?(size):(ctx->size * 2);
+        ctx->buf = (uint8_t*)realloc(ctx->buf, ctx->size);
+    }
+    return ctx->buf;
+}
+
 LIBCOUCHSTORE_API
 couchstore_error_t couchstore_save_documents(Db *db, Doc* const docs[], DocInfo *infos[],
         unsigned numdocs, couchstore_save_options options)
 {
     unsigned i;
     uint16_t metalen;
-    uint8_t metabuf[METABUF_MAXLEN];
     uint8_t *buf;
+    size_t len;
     char *err = NULL;
-    leveldb_writebatch_t *wb;
+    struct _enc_ctx *ctx = _enc_ctx_get();
 
-    wb = leveldb_writebatch_create();
+    leveldb_writebatch_clear(ctx->wb);
 
     for (i=0;i<numdocs;++i){
-        metalen = _docinfo_to_buf(infos[i], metabuf);
-        buf = (uint8_t*)malloc(sizeof(metalen) + metalen + docs[i]->data.size);
-        memcpy(buf + sizeof(metalen), metabuf, metalen);
-        memcpy(buf, &metalen, sizeof(metalen));
-        memcpy(buf + sizeof(metalen) + metalen, docs[i]->data.buf, docs[i]->data.size);
-
-        leveldb_writebatch_put(wb, docs[i]->id.buf, docs[i]->id.size, (char*)buf,
-                               sizeof(metalen) + metalen + docs[i]->data.size);
-
+        if (raw_body) {
+            leveldb_writebatch_put(ctx->wb, docs[i]->id.buf, docs[i]->id.size,
+                                   docs[i]->data.buf, docs[i]->data.size);
+        } else {
+            // [metalen][meta][body], encoded in place
+            buf = _enc_buf_reserve(ctx, sizeof(metalen) + METABUF_MAXLEN +
+                                        docs[i]->data.size);
+            metalen = _docinfo_to_buf(infos[i], buf + sizeof(metalen));
+            memcpy(buf, &metalen, sizeof(metalen));
+            len = sizeof(metalen) + metalen;
+            memcpy(buf + len, docs[i]->data.buf, docs[i]->data.size);
+            len += docs[i]->data.size;
+
+            leveldb_writebatch_put(ctx->wb, docs[i]->id.buf, docs[i]->id.size,
+                                   (char*)buf, len);
+        }
         infos[i]->db_seq = 0;
-        free(buf);
     }
-    leveldb_write(db->db, db->write_options, wb, &err);
+    leveldb_write(db->db, db->write_options, ctx->wb, &err);
     if (err) {
         printf("ERR %s\n", err);
     }
     assert(err == NULL);
-    leveldb_writebatch_destroy(wb);
+    if (db->sync) {
+        __sync_fetch_and_add(&nsyncs, 1);
+    }
 
     return COUCHSTORE_SUCCESS;
 }
@@ -181,6 +416,16 @@ void _buf_to_docinfo(void *buf, size_t size, DocInfo *docinfo)
 {
     size_t offset = 0;
 
+    if (raw_body) {
+        // there is no header to decode
+        docinfo->rev_seq = 0;
+        docinfo->deleted = 0;
+        docinfo->content_meta = 0;
+        docinfo->rev_meta.buf = NULL;
+        docinfo->rev_meta.size = 0;
+        return;
+    }
+
     memcpy(&docinfo->rev_seq, (uint8_t*)buf + offset, sizeof(docinfo->rev_seq));
     offset += sizeof(docinfo->rev_seq);
 
@@ -217,8 +462,12 @@ couchstore_error_t couchstore_docinfo_by_id(Db *db, const void *id, size_t idlen
     value = leveldb_get(db->db, db->read_options, (char*)id, idlen, &valuelen, &err);
 
     meta_offset = sizeof(uint64_t)*1 + sizeof(int) + sizeof(couchstore_content_meta_flags);
-    memcpy(&rev_meta_size, (uint8_t*)value + sizeof(uint16_t) + meta_offset,
-           sizeof(size_t));
+    if (raw_body) {
+        rev_meta_size = 0;
+    } else {
+        memcpy(&rev_meta_size, (uint8_t*)value + sizeof(uint16_t) + meta_offset,
+               sizeof(size_t));
+    }
 
     *pInfo = (DocInfo *)malloc(sizeof(DocInfo) + rev_meta_size);
     (*pInfo)->id.buf = (char *)id;
@@ -254,8 +503,12 @@ couchstore_error_t couchstore_docinfos_by_id(Db *db, const sized_buf ids[], unsi
                             ids[i].buf, ids[i].size,
                             &valuelen, &err);
 
-        memcpy(&rev_meta_size, (uint8_t*)value + sizeof(uint16_t) + meta_offset,
-               sizeof(size_t));
+        if (raw_body) {
+            rev_meta_size = 0;
+        } else {
+            memcpy(&rev_meta_size, (uint8_t*)value + sizeof(uint16_t) + meta_offset,
+                   sizeof(size_t));
+        }
         if (rev_meta_size > max_meta_size) {
             max_meta_size = rev_meta_size;
             docinfo = (DocInfo*)realloc(docinfo, sizeof(DocInfo) + max_meta_size);
@@ -291,6 +544,65 @@ couchstore_error_t couchstore_docinfos_by_sequence(Db *db,
     return COUCHSTORE_SUCCESS;
 }
 
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_all_docs(Db *db,
+                                       const sized_buf* startKeyPtr,
+                                       couchstore_docinfos_options options,
+                                       couchstore_changes_callback_fn callback,
+                                       void *ctx)
+{
+    int ret = 0;
+    const char *key, *value;
+    size_t keylen, valuelen;
+    DocInfo *docinfo;
+    size_t rev_meta_size, max_meta_size = 256;
+    size_t meta_offset;
+    leveldb_iterator_t *iterator;
+
+    meta_offset = sizeof(uint64_t)*1 + sizeof(int) +
+                  sizeof(couchstore_content_meta_flags);
+    docinfo = (DocInfo*)malloc(sizeof(DocInfo) + max_meta_size);
+
+    iterator = leveldb_create_iterator(db->db, db->read_options);
+    if (startKeyPtr) {
+        leveldb_iter_seek(iterator, startKeyPtr->buf, startKeyPtr->size);
+    } else {
+        leveldb_iter_seek_to_first(iterator);
+    }
+
+    while (ret >= 0 && leveldb_iter_valid(iterator)) {
+        key = leveldb_iter_key(iterator, &keylen);
+        value = leveldb_iter_value(iterator, &valuelen);
+
+        if (raw_body) {
+            rev_meta_size = 0;
+        } else {
+            memcpy(&rev_meta_size, (uint8_t*)value + sizeof(uint16_t) + meta_offset,
+                   sizeof(size_t));
+        }
+        if (rev_meta_size > max_meta_size) {
+            max_meta_size = rev_meta_size;
+            docinfo = (DocInfo*)realloc(docinfo, sizeof(DocInfo) + max_meta_size);
+        }
+
+        memset(docinfo, 0, sizeof(DocInfo));
+        docinfo->id.buf = (char *)key;
+        docinfo->id.size = keylen;
+        docinfo->size = keylen + valuelen;
+        docinfo->bp = 0;
+        docinfo->db_seq = 0;
+        _buf_to_docinfo((uint8_t*)value + sizeof(uint16_t), valuelen, docinfo);
+
+        ret = callback(db, docinfo, ctx);
+        leveldb_iter_next(iterator);
+    }
+
+    leveldb_iter_destroy(iterator);
+    free(docinfo);
+
+    return (ret < 0)?(COUCHSTORE_ERROR_CANCEL):(COUCHSTORE_SUCCESS);
+}
+
 LIBCOUCHSTORE_API
 couchstore_error_t couchstore_open_document(Db *db,
                                             const void *id,
@@ -309,6 +621,10 @@ couchstore_error_t couchstore_open_document(Db *db,
         printf("ERR %s\n", err);
     }
     assert(err == NULL);
+    if (value == NULL) {
+        *pDoc = NULL;
+        return COUCHSTORE_ERROR_DOC_NOT_FOUND;
+    }
 
     meta_offset = sizeof(uint64_t)*1 + sizeof(int) +
                   sizeof(couchstore_content_meta_flags);
@@ -359,3 +675,23 @@ couchstore_error_t couchstore_compact_db(Db* source, const char* target_filename
     return couchstore_compact_db_ex(source, target_filename, 0x0, NULL);
 }
 
+struct couch_engine * couch_engine_get(void)
+{
+    static struct couch_engine e;
+
+    memset(&e, 0, sizeof(e));
+    e.name = "leveldb";
+    e.desc = "LevelDB";
+    e.flags = ENGINE_THREAD_SAFE | ENGINE_SINGLE_OPEN |
+              ENGINE_SYNC_OPTION | ENGINE_BG_COMPACTION;
+    couch_engine_set_core(&e);
+    e.set_sync = couchstore_set_sync;
+    e.set_cache = couchstore_set_cache;
+    e.set_wbs_size = couchstore_set_wbs_size;
+    e.set_raw_body = couchstore_set_raw_body;
+    e.get_stats = couchstore_get_stats;
+    e.sync_count = couchstore_sync_count;
+    e.set_option = couchstore_set_option;
+
+    return &e;
+}
@@ -0,0 +1,554 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "lmdb.h"
+#include "couch_db.h"
+#include "couch_engine.h"
+
+#define METABUF_MAXLEN (256)
+// upper limit of the environment (address space only, not allocated)
+#define LMDB_MAP_SIZE ((size_t)1 << 40)
+#define LMDB_MAX_DBS (1024)
+
+// Each DB file is a named sub-database of a single environment, which is
+// opened by couchstore_open_conn(). A write batch is one write transaction
+// (LMDB serializes writers). Reads run in a read-only transaction and
+// return pointers into the map; the transaction is kept until the document
+// is freed.
+struct _db {
+    MDB_dbi dbi;
+    char *filename;
+    // reusable read-only transaction (reset while not in use)
+    MDB_txn *rtxn;
+    int rtxn_busy;
+    // snapshot handles only: transaction pinning the snapshot
+    MDB_txn *snapshot;
+};
+
+// document returned by couchstore_open_document()
+struct _lmdb_doc {
+    Doc doc;
+    Db *db;
+    MDB_txn *txn;
+};
+
+static MDB_env *env = NULL;
+static int env_sync = 0; // MDB_NOSYNC is off
+static uint64_t nsyncs = 0;
+
+couchstore_error_t couchstore_set_cache(uint64_t size)
+{
+    // do nothing (the OS page cache holds the map)
+    return COUCHSTORE_SUCCESS;
+}
+
+couchstore_error_t couchstore_open_conn(const char *filename)
+{
+    int fd;
+    int ret;
+
+    // create directory if not exist
+    fd = open(filename, O_RDONLY, 0666);
+    if (fd == -1) {
+        // create
+        char cmd[256];
+
+        sprintf(cmd, "mkdir -p %s\n", filename);
+        ret = system(cmd);
+    } else {
+        close(fd);
+    }
+
+    mdb_env_create(&env);
+    mdb_env_set_mapsize(env, LMDB_MAP_SIZE);
+    mdb_env_set_maxdbs(env, LMDB_MAX_DBS);
+    mdb_env_set_maxreaders(env, 4096);
+    // MDB_NOTLS: read transactions are bound to handles, not to threads
+    // MDB_NOSYNC: no sync until a file is opened with the sync flag
+    ret = mdb_env_open(env, filename,
+                       MDB_NOTLS | MDB_NORDAHEAD | MDB_NOSYNC, 0664);
+    if (ret != MDB_SUCCESS) {
+        printf("ERR %s\n", mdb_strerror(ret));
+        return COUCHSTORE_ERROR_OPEN_FILE;
+    }
+    env_sync = 0;
+
+    return COUCHSTORE_SUCCESS;
+}
+
+couchstore_error_t couchstore_close_conn()
+{
+    mdb_env_close(env);
+    env = NULL;
+    return COUCHSTORE_SUCCESS;
+}
+
+// MDB_NOSYNC is a property of the environment, i.e. of all files
+couchstore_error_t couchstore_set_sync(Db *db, int sync)
+{
+    mdb_env_set_flags(env, MDB_NOSYNC, (sync)?(0):(1));
+    env_sync = sync;
+    return COUCHSTORE_SUCCESS;
+}
+
+// write transactions committed while sync is on
+uint64_t couchstore_sync_count()
+{
+    return nsyncs;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_open_db(const char *filename,
+                                      couchstore_open_flags flags,
+                                      Db **pDb)
+{
+    return couchstore_open_db_ex(filename, flags,
+                                 NULL, pDb);
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_open_db_ex(const char *filename,
+                                         couchstore_open_flags flags,
+                                         const couch_file_ops *ops,
+                                         Db **pDb)
+{
+    int i, len, ret;
+    Db *ppdb;
+    char fileonly[256];
+    MDB_txn *txn;
+
+    assert(env);
+
+    *pDb = (Db*)malloc(sizeof(Db));
+    ppdb = *pDb;
+
+    ppdb->filename = (char*)malloc(strlen(filename)+1);
+    strcpy(ppdb->filename, filename);
+
+    // take filename only (discard directory path)
+    len = strlen(filename);
+    for (i=len-1; i>=0; --i) {
+        if (filename[i] == '/') {
+            strcpy(fileonly, filename + (i+1));
+            break;
+        }
+        if (i == 0) { // there is no directory path, filename only
+            strcpy(fileonly, filename);
+        }
+    }
+
+    // opening a sub-database needs a write transaction
+    // (which also keeps concurrent opens apart)
+    mdb_txn_begin(env, NULL, 0, &txn);
+    ret = mdb_dbi_open(txn, fileonly, MDB_CREATE, &ppdb->dbi);
+    if (ret != MDB_SUCCESS) {
+        printf("ERR %s\n", mdb_strerror(ret));
+        mdb_txn_abort(txn);
+        free(ppdb->filename);
+        free(ppdb);
+        *pDb = NULL;
+        return COUCHSTORE_ERROR_OPEN_FILE;
+    }
+    mdb_txn_commit(txn);
+
+    // sync flag (0x10), same as the ForestDB wrapper; since the flag is
+    // environment-wide, opening without it (e.g., reopening a handle)
+    // never turns sync back off
+    if (flags & 0x10) {
+        couchstore_set_sync(ppdb, 1);
+    }
+
+    mdb_txn_begin(env, NULL, MDB_RDONLY, &ppdb->rtxn);
+    mdb_txn_reset(ppdb->rtxn);
+    ppdb->rtxn_busy = 0;
+    ppdb->snapshot = NULL;
+
+    return COUCHSTORE_SUCCESS;
+}
+
+// a read-only transaction is a snapshot
+couchstore_error_t couchstore_open_snapshot(Db *db, Db **snapshot)
+{
+    int ret;
+    Db *ppdb;
+
+    *snapshot = (Db*)malloc(sizeof(Db));
+    ppdb = *snapshot;
+    *ppdb = *db;
+
+    ppdb->filename = (char*)malloc(strlen(db->filename)+1);
+    strcpy(ppdb->filename, db->filename);
+    ppdb->rtxn = NULL;
+    ppdb->rtxn_busy = 0;
+
+    ret = mdb_txn_begin(env, NULL, MDB_RDONLY, &ppdb->snapshot);
+    if (ret != MDB_SUCCESS) {
+        free(ppdb->filename);
+        free(ppdb);
+        return COUCHSTORE_ERROR_OPEN_FILE;
+    }
+
+    return COUCHSTORE_SUCCESS;
+}
+
+couchstore_error_t couchstore_close_snapshot(Db *snapshot)
+{
+    mdb_txn_abort(snapshot->snapshot);
+    free(snapshot->filename);
+    free(snapshot);
+
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_close_db(Db *db)
+{
+    // sub-database handles stay open for the environment
+    if (db->rtxn) mdb_txn_abort(db->rtxn);
+    free(db->filename);
+    free(db);
+
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_db_info(Db *db, DbInfo* info)
+{
+    MDB_envinfo envinfo;
+    MDB_stat stat;
+
+    info->filename = db->filename;
+    info->doc_count = 0;
+    info->deleted_count = 0;
+    info->header_position = 0;
+    info->last_sequence = 0;
+
+    // pages in use by the whole environment
+    mdb_env_info(env, &envinfo);
+    mdb_env_stat(env, &stat);
+    info->space_used = (uint64_t)(envinfo.me_last_pgno + 1) * stat.ms_psize;
+
+    return COUCHSTORE_SUCCESS;
+}
+
+size_t _docinfo_to_buf(DocInfo *docinfo, void *buf)
+{
+    // [db_seq,] rev_seq, deleted, content_meta, rev_meta (size), rev_meta (buf)
+    size_t offset = 0;
+
+    memcpy((uint8_t*)buf + offset, &docinfo->rev_seq, sizeof(docinfo->rev_seq));
+    offset += sizeof(docinfo->rev_seq);
+
+    memcpy((uint8_t*)buf + offset, &docinfo->deleted, sizeof(docinfo->deleted));
+    offset += sizeof(docinfo->deleted);
+
+    memcpy((uint8_t*)buf + offset, &docinfo->content_meta,
+           sizeof(docinfo->content_meta));
+    offset += sizeof(docinfo->content_meta);
+
+    memcpy((uint8_t*)buf + offset, &docinfo->rev_meta.size,
+           sizeof(docinfo->rev_meta.size));
+    offset += sizeof(docinfo->rev_meta.size);
+
+    if (docinfo->rev_meta.size > 0) {
+        memcpy((uint8_t*)buf + offset, docinfo->rev_meta.buf, docinfo->rev_meta.size);
+        offset += docinfo->rev_meta.size;
+    }
+
+    return offset;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_save_documents(Db *db, Doc* const docs[], DocInfo *infos[],
+        unsigned numdocs, couchstore_save_options options)
+{
+    int ret;
+    unsigned i;
+    uint16_t metalen;
+    uint8_t metabuf[METABUF_MAXLEN];
+    MDB_txn *txn;
+    MDB_val key, value;
+
+    ret = mdb_txn_begin(env, NULL, 0, &txn);
+    assert(ret == MDB_SUCCESS);
+
+    for (i=0;i<numdocs;++i){
+        key.mv_data = docs[i]->id.buf;
+        key.mv_size = docs[i]->id.size;
+
+        // build the value in place (metalen, meta, body)
+        metalen = _docinfo_to_buf(infos[i], metabuf);
+        value.mv_data = NULL;
+        value.mv_size = sizeof(metalen) + metalen + docs[i]->data.size;
+        ret = mdb_put(txn, db->dbi, &key, &value, MDB_RESERVE);
+        if (ret != MDB_SUCCESS) {
+            printf("ERR %s\n", mdb_strerror(ret));
+            continue;
+        }
+        memcpy(value.mv_data, &metalen, sizeof(metalen));
+        memcpy((uint8_t*)value.mv_data + sizeof(metalen), metabuf, metalen);
+        memcpy((uint8_t*)value.mv_data + sizeof(metalen) + metalen,
+               docs[i]->data.buf, docs[i]->data.size);
+
+        infos[i]->db_seq = 0;
+    }
+
+    ret = mdb_txn_commit(txn);
+    assert(ret == MDB_SUCCESS);
+    if (env_sync) {
+        __sync_fetch_and_add(&nsyncs, 1);
+    }
+
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_save_document(Db *db, const Doc *doc, DocInfo *info,
+        couchstore_save_options options)
+{
+    return couchstore_save_documents(db, (Doc**)&doc, (DocInfo**)&info, 1, options);
+}
+
+void _buf_to_docinfo(void *buf, size_t size, DocInfo *docinfo)
+{
+    size_t offset = 0;
+
+    memcpy(&docinfo->rev_seq, (uint8_t*)buf + offset, sizeof(docinfo->rev_seq));
+    offset += sizeof(docinfo->rev_seq);
+
+    memcpy(&docinfo->deleted, (uint8_t*)buf + offset, sizeof(docinfo->deleted));
+    offset += sizeof(docinfo->deleted);
+
+    memcpy(&docinfo->content_meta, (uint8_t*)buf + offset,
+           sizeof(docinfo->content_meta));
+    offset += sizeof(docinfo->content_meta);
+
+    memcpy(&docinfo->rev_meta.size, (uint8_t*)buf + offset,
+           sizeof(docinfo->rev_meta.size));
+    offset += sizeof(docinfo->rev_meta.size);
+
+    if (docinfo->rev_meta.size > 0) {
+        docinfo->rev_meta.buf = ((char *)docinfo) + sizeof(DocInfo);
+        memcpy(docinfo->rev_meta.buf, (uint8_t*)buf + offset, docinfo->rev_meta.size);
+        offset += docinfo->rev_meta.size;
+    }else{
+        docinfo->rev_meta.buf = NULL;
+    }
+}
+
+// read-only transaction for a lookup: the handle's own one if it is free
+static MDB_txn * _begin_read(Db *db)
+{
+    MDB_txn *txn;
+
+    if (db->snapshot) return db->snapshot;
+    if (!db->rtxn_busy) {
+        db->rtxn_busy = 1;
+        mdb_txn_renew(db->rtxn);
+        return db->rtxn;
+    }
+    mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+    return txn;
+}
+
+static void _end_read(Db *db, MDB_txn *txn)
+{
+    if (txn == db->snapshot) return;
+    if (txn == db->rtxn) {
+        mdb_txn_reset(db->rtxn);
+        db->rtxn_busy = 0;
+    } else {
+        mdb_txn_abort(txn);
+    }
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_all_docs(Db *db,
+                                       const sized_buf* startKeyPtr,
+                                       couchstore_docinfos_options options,
+                                       couchstore_changes_callback_fn callback,
+                                       void *ctx)
+{
+    int ret = 0, r;
+    DocInfo *docinfo;
+    size_t rev_meta_size, max_meta_size = 256;
+    size_t meta_offset;
+    MDB_txn *txn;
+    MDB_cursor *cursor;
+    MDB_val key, value;
+
+    meta_offset = sizeof(uint64_t)*1 + sizeof(int) +
+                  sizeof(couchstore_content_meta_flags);
+    docinfo = (DocInfo*)malloc(sizeof(DocInfo) + max_meta_size);
+
+    txn = _begin_read(db);
+    mdb_cursor_open(txn, db->dbi, &cursor);
+    if (startKeyPtr) {
+        key.mv_data = startKeyPtr->buf;
+        key.mv_size = startKeyPtr->size;
+        r = mdb_cursor_get(cursor, &key, &value, MDB_SET_RANGE);
+    } else {
+        r = mdb_cursor_get(cursor, &key, &value, MDB_FIRST);
+    }
+
+    while (ret >= 0 && r == MDB_SUCCESS) {
+        memcpy(&rev_meta_size, (uint8_t*)value.mv_data + sizeof(uint16_t) + meta_offset,
+               sizeof(size_t));
+        if (rev_meta_size > max_meta_size) {
+            max_meta_size = rev_meta_size;
+            docinfo = (DocInfo*)realloc(docinfo, sizeof(DocInfo) + max_meta_size);
+        }
+
+        memset(docinfo, 0, sizeof(DocInfo));
+        docinfo->id.buf = (char *)key.mv_data;
+        docinfo->id.size = key.mv_size;
+        docinfo->size = key.mv_size + value.mv_size;
+        _buf_to_docinfo((uint8_t*)value.mv_data + sizeof(uint16_t),
+                        value.mv_size, docinfo);
+
+        ret = callback(db, docinfo, ctx);
+        r = mdb_cursor_get(cursor, &key, &value, MDB_NEXT);
+    }
+
+    mdb_cursor_close(cursor);
+    _end_read(db, txn);
+    free(docinfo);
+
+    return (ret < 0)?(COUCHSTORE_ERROR_CANCEL):(COUCHSTORE_SUCCESS);
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_open_document(Db *db,
+                                            const void *id,
+                                            size_t idlen,
+                                            Doc **pDoc,
+                                            couchstore_open_options options)
+{
+    int ret;
+    struct _lmdb_doc *ldoc;
+    MDB_txn *txn;
+    MDB_val key, value;
+
+    txn = _begin_read(db);
+    key.mv_data = (void *)id;
+    key.mv_size = idlen;
+    ret = mdb_get(txn, db->dbi, &key, &value);
+    if (ret != MDB_SUCCESS) {
+        _end_read(db, txn);
+        *pDoc = NULL;
+        if (ret == MDB_NOTFOUND) {
+            return COUCHSTORE_ERROR_DOC_NOT_FOUND;
+        }
+        printf("ERR %s\n", mdb_strerror(ret));
+        return COUCHSTORE_ERROR_READ;
+    }
+
+    // no copy: the body stays valid until the document is freed
+    ldoc = (struct _lmdb_doc *)malloc(sizeof(struct _lmdb_doc));
+    ldoc->db = db;
+    ldoc->txn = txn;
+    ldoc->doc.id.buf = (char*)id;
+    ldoc->doc.id.size = idlen;
+    ldoc->doc.data.buf = (char*)value.mv_data;
+    ldoc->doc.data.size = value.mv_size;
+    *pDoc = &ldoc->doc;
+
+    return COUCHSTORE_SUCCESS;
+}
+
+// the value is in the memory map, valid while the read txn is open
+couchstore_error_t couchstore_open_document_ref(Db *db,
+                                                const void *id,
+                                                size_t idlen,
+                                                couchstore_doc_ref_fn callback,
+                                                void *ctx)
+{
+    int ret;
+    MDB_txn *txn;
+    MDB_val key, value;
+    Doc doc;
+
+    txn = _begin_read(db);
+    key.mv_data = (void *)id;
+    key.mv_size = idlen;
+    ret = mdb_get(txn, db->dbi, &key, &value);
+    if (ret != MDB_SUCCESS) {
+        _end_read(db, txn);
+        if (ret == MDB_NOTFOUND) {
+            return COUCHSTORE_ERROR_DOC_NOT_FOUND;
+        }
+        printf("ERR %s\n", mdb_strerror(ret));
+        return COUCHSTORE_ERROR_READ;
+    }
+
+    doc.id.buf = (char*)id;
+    doc.id.size = idlen;
+    doc.data.buf = (char*)value.mv_data;
+    doc.data.size = value.mv_size;
+    callback(db, &doc, ctx);
+    _end_read(db, txn);
+
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+void couchstore_free_document(Doc *doc)
+{
+    struct _lmdb_doc *ldoc = (struct _lmdb_doc *)doc;
+
+    _end_read(ldoc->db, ldoc->txn);
+    if (doc->id.buf) free(doc->id.buf);
+    free(ldoc);
+}
+
+LIBCOUCHSTORE_API
+void couchstore_free_docinfo(DocInfo *docinfo)
+{
+    free(docinfo);
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_commit(Db *db)
+{
+    // do nothing (each write batch is a transaction)
+
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_compact_db_ex(Db* source, const char* target_filename,
+        uint64_t flags, const couch_file_ops *ops)
+{
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_compact_db(Db* source, const char* target_filename)
+{
+    return couchstore_compact_db_ex(source, target_filename, 0x0, NULL);
+}
+
+struct couch_engine * couch_engine_get(void)
+{
+    static struct couch_engine e;
+
+    memset(&e, 0, sizeof(e));
+    e.name = "lmdb";
+    e.desc = "LMDB";
+    e.flags = ENGINE_CONN;
+    couch_engine_set_core(&e);
+    e.open_document_ref = couchstore_open_document_ref;
+    e.set_sync = couchstore_set_sync;
+    e.sync_count = couchstore_sync_count;
+    e.set_cache = couchstore_set_cache;
+    e.open_conn = couchstore_open_conn;
+    e.close_conn = couchstore_close_conn;
+
+    return &e;
+}
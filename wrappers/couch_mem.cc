@@ -0,0 +1,652 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "couch_db.h"
+#include "couch_engine.h"
+
+// In-memory reference engine: one lock-free skiplist per DB name, kept
+// for the lifetime of the process (closing the last handle does not drop
+// the data, so the benchmark can reopen what it populated). Nothing is
+// ever written to disk and commit is a no-op, which gives an upper bound
+// for the real engines on the same workload.
+//
+// Documents are never deleted by the benchmark, so nodes are only
+// inserted (CAS on each level, bottom-up) and never unlinked. A value is
+// replaced under a tiny per-node lock; readers copy it under the same lock,
+// so the old value can be freed right away.
+
+#define METABUF_MAXLEN (256)
+#define MEM_MAX_HEIGHT (24)
+
+struct mem_node {
+    char *key;
+    size_t keylen;
+    volatile int lock;
+    void *value;
+    size_t valuelen;
+    int height;
+    struct mem_node * volatile next[1]; // [height]
+};
+
+struct mem_index {
+    char *filename;
+    struct mem_node *head;
+    volatile uint64_t seq; // for node heights
+    volatile uint64_t ndocs;
+    volatile uint64_t space_used;
+    struct mem_index *next;
+};
+
+struct _db {
+    struct mem_index *idx;
+    char *filename;
+};
+
+static struct mem_index *indexes = NULL;
+static pthread_mutex_t indexes_lock = PTHREAD_MUTEX_INITIALIZER;
+
+couchstore_error_t couchstore_set_cache(uint64_t size)
+{
+    // do nothing (everything is in memory)
+    return COUCHSTORE_SUCCESS;
+}
+
+couchstore_error_t couchstore_set_sync(Db *db, int sync)
+{
+    // do nothing (nothing to synchronize)
+    return COUCHSTORE_SUCCESS;
+}
+
+static void _node_lock(struct mem_node *node)
+{
+    while (__sync_lock_test_and_set(&node->lock, 1)) {
+        while (node->lock);
+    }
+}
+
+static void _node_unlock(struct mem_node *node)
+{
+    __sync_lock_release(&node->lock);
+}
+
+static struct mem_node * _node_alloc(const void *key, size_t keylen, int height)
+{
+    struct mem_node *node;
+
+    node = (struct mem_node *)malloc(sizeof(struct mem_node) +
+                                     sizeof(struct mem_node *) * (height-1));
+    node->key = (char *)malloc(keylen);
+    memcpy(node->key, key, keylen);
+    node->keylen = keylen;
+    node->lock = 0;
+    node->value = NULL;
+    node->valuelen = 0;
+    node->height = height;
+    memset((void *)node->next, 0, sizeof(struct mem_node *) * height);
+    return node;
+}
+
+static int _keycmp(const void *key1, size_t len1, const void *key2, size_t len2)
+{
+    int cmp = memcmp(key1, key2, (len1 < len2)?(len1):(len2));
+    if (cmp) return cmp;
+    return (len1 < len2)?(-1):((len1 > len2)?(1):(0));
+}
+
+// geometric distribution (p = 1/2) from a mixed sequence number
+static int _random_height(struct mem_index *idx)
+{
+    int height = 1;
+    uint64_t r = __sync_fetch_and_add(&idx->seq, 1);
+
+    r += 0x9e3779b97f4a7c15ULL;
+    r = (r ^ (r >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    r = (r ^ (r >> 27)) * 0x94d049bb133111ebULL;
+    r ^= (r >> 31);
+    while ((r & 0x1) && height < MEM_MAX_HEIGHT) {
+        height++;
+        r >>= 1;
+    }
+    return height;
+}
+
+// fills the last node < key and its successor at each level
+static void _find(struct mem_index *idx, const void *key, size_t keylen,
+                  struct mem_node **preds, struct mem_node **succs)
+{
+    int level;
+    struct mem_node *pred = idx->head, *cur;
+
+    for (level = MEM_MAX_HEIGHT-1; level >= 0; --level) {
+        cur = pred->next[level];
+        while (cur && _keycmp(cur->key, cur->keylen, key, keylen) < 0) {
+            pred = cur;
+            cur = pred->next[level];
+        }
+        preds[level] = pred;
+        succs[level] = cur;
+    }
+}
+
+static struct mem_node * _search(struct mem_index *idx, const void *key, size_t keylen)
+{
+    int level, cmp;
+    struct mem_node *pred = idx->head, *cur;
+
+    for (level = MEM_MAX_HEIGHT-1; level >= 0; --level) {
+        cur = pred->next[level];
+        while (cur) {
+            cmp = _keycmp(cur->key, cur->keylen, key, keylen);
+            if (cmp == 0) return cur;
+            if (cmp > 0) break;
+            pred = cur;
+            cur = pred->next[level];
+        }
+    }
+    return NULL;
+}
+
+// first node >= key
+static struct mem_node * _lower_bound(struct mem_index *idx,
+                                      const void *key, size_t keylen)
+{
+    struct mem_node *preds[MEM_MAX_HEIGHT], *succs[MEM_MAX_HEIGHT];
+
+    _find(idx, key, keylen, preds, succs);
+    return succs[0];
+}
+
+// takes ownership of 'value'
+static void _set(struct mem_index *idx, const void *key, size_t keylen,
+                 void *value, size_t valuelen)
+{
+    int level, height;
+    void *old;
+    size_t oldlen;
+    struct mem_node *preds[MEM_MAX_HEIGHT], *succs[MEM_MAX_HEIGHT];
+    struct mem_node *node = NULL;
+
+    while (1) {
+        _find(idx, key, keylen, preds, succs);
+        if (succs[0] &&
+            !_keycmp(succs[0]->key, succs[0]->keylen, key, keylen)) {
+            // update in place
+            _node_lock(succs[0]);
+            old = succs[0]->value;
+            oldlen = succs[0]->valuelen;
+            succs[0]->value = value;
+            succs[0]->valuelen = valuelen;
+            _node_unlock(succs[0]);
+
+            free(old);
+            __sync_fetch_and_add(&idx->space_used, valuelen - oldlen);
+            if (node) {
+                // lost the race to insert the same key
+                free(node->key);
+                free(node);
+            }
+            return;
+        }
+
+        if (!node) {
+            node = _node_alloc(key, keylen, _random_height(idx));
+            node->value = value;
+            node->valuelen = valuelen;
+        }
+        node->next[0] = succs[0];
+        if (__sync_bool_compare_and_swap(&preds[0]->next[0], succs[0], node)) {
+            break;
+        }
+    }
+
+    // the node is visible from now on; link the upper levels
+    height = node->height;
+    for (level = 1; level < height; ++level) {
+        while (1) {
+            node->next[level] = succs[level];
+            if (__sync_bool_compare_and_swap(&preds[level]->next[level],
+                                             succs[level], node)) {
+                break;
+            }
+            _find(idx, key, keylen, preds, succs);
+        }
+    }
+
+    __sync_fetch_and_add(&idx->ndocs, 1);
+    __sync_fetch_and_add(&idx->space_used,
+                         sizeof(struct mem_node) +
+                         sizeof(struct mem_node *) * (height-1) +
+                         keylen + valuelen);
+}
+
+// returns a copy of the value (or NULL)
+static void * _get(struct mem_node *node, size_t *valuelen)
+{
+    void *value = NULL;
+
+    _node_lock(node);
+    if (node->value) {
+        value = malloc(node->valuelen);
+        memcpy(value, node->value, node->valuelen);
+        *valuelen = node->valuelen;
+    }
+    _node_unlock(node);
+    return value;
+}
+
+static struct mem_index * _get_index(const char *filename, int create)
+{
+    struct mem_index *idx;
+
+    pthread_mutex_lock(&indexes_lock);
+    for (idx = indexes; idx; idx = idx->next) {
+        if (!strcmp(idx->filename, filename)) break;
+    }
+    if (!idx && create) {
+        idx = (struct mem_index *)malloc(sizeof(struct mem_index));
+        idx->filename = (char *)malloc(strlen(filename)+1);
+        strcpy(idx->filename, filename);
+        idx->head = _node_alloc("", 0, MEM_MAX_HEIGHT);
+        idx->seq = 0;
+        idx->ndocs = 0;
+        idx->space_used = 0;
+        idx->next = indexes;
+        indexes = idx;
+    }
+    pthread_mutex_unlock(&indexes_lock);
+
+    return idx;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_open_db(const char *filename,
+                                      couchstore_open_flags flags,
+                                      Db **pDb)
+{
+    return couchstore_open_db_ex(filename, flags,
+                                 NULL, pDb);
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_open_db_ex(const char *filename,
+                                         couchstore_open_flags flags,
+                                         const couch_file_ops *ops,
+                                         Db **pDb)
+{
+    Db *ppdb;
+    struct mem_index *idx;
+
+    // handles to the same name share the index
+    idx = _get_index(filename, 1);
+
+    *pDb = (Db*)malloc(sizeof(Db));
+    ppdb = *pDb;
+    ppdb->idx = idx;
+    ppdb->filename = (char*)malloc(strlen(filename)+1);
+    strcpy(ppdb->filename, filename);
+
+    return COUCHSTORE_SUCCESS;
+}
+
+// no isolation: a snapshot is another handle to the live index
+couchstore_error_t couchstore_open_snapshot(Db *db, Db **snapshot)
+{
+    return couchstore_open_db(db->filename, 0x0, snapshot);
+}
+
+couchstore_error_t couchstore_close_snapshot(Db *snapshot)
+{
+    return couchstore_close_db(snapshot);
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_close_db(Db *db)
+{
+    free(db->filename);
+    free(db);
+
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_db_info(Db *db, DbInfo* info)
+{
+    info->filename = db->filename;
+    info->doc_count = db->idx->ndocs;
+    info->deleted_count = 0;
+    info->header_position = 0;
+    info->last_sequence = 0;
+    info->space_used = db->idx->space_used;
+
+    return COUCHSTORE_SUCCESS;
+}
+
+// everything is in memory: the keys and values held are all there is
+couchstore_error_t couchstore_get_stats(Db *dbs[], int ndbs,
+                                        struct couch_engine_stats *stats)
+{
+    int i;
+
+    for (i=0;i<ndbs;++i){
+        couch_engine_stat_add(&stats->doc_count, dbs[i]->idx->ndocs);
+        couch_engine_stat_add(&stats->space_used, dbs[i]->idx->space_used);
+        couch_engine_stat_add(&stats->mem_bytes, dbs[i]->idx->space_used);
+    }
+
+    return COUCHSTORE_SUCCESS;
+}
+
+size_t _docinfo_to_buf(DocInfo *docinfo, void *buf)
+{
+    // rev_seq, deleted, content_meta, rev_meta (size), rev_meta (buf)
+    size_t offset = 0;
+
+    memcpy((uint8_t*)buf + offset, &docinfo->rev_seq, sizeof(docinfo->rev_seq));
+    offset += sizeof(docinfo->rev_seq);
+
+    memcpy((uint8_t*)buf + offset, &docinfo->deleted, sizeof(docinfo->deleted));
+    offset += sizeof(docinfo->deleted);
+
+    memcpy((uint8_t*)buf + offset, &docinfo->content_meta,
+           sizeof(docinfo->content_meta));
+    offset += sizeof(docinfo->content_meta);
+
+    memcpy((uint8_t*)buf + offset, &docinfo->rev_meta.size,
+           sizeof(docinfo->rev_meta.size));
+    offset += sizeof(docinfo->rev_meta.size);
+
+    if (docinfo->rev_meta.size > 0) {
+        memcpy((uint8_t*)buf + offset, docinfo->rev_meta.buf, docinfo->rev_meta.size);
+        offset += docinfo->rev_meta.size;
+    }
+
+    return offset;
+}
+
+void _buf_to_docinfo(void *buf, size_t size, DocInfo *docinfo)
+{
+    size_t offset = 0;
+
+    memcpy(&docinfo->rev_seq, (uint8_t*)buf + offset, sizeof(docinfo->rev_seq));
+    offset += sizeof(docinfo->rev_seq);
+
+    memcpy(&docinfo->deleted, (uint8_t*)buf + offset, sizeof(docinfo->deleted));
+    offset += sizeof(docinfo->deleted);
+
+    memcpy(&docinfo->content_meta, (uint8_t*)buf + offset,
+           sizeof(docinfo->content_meta));
+    offset += sizeof(docinfo->content_meta);
+
+    memcpy(&docinfo->rev_meta.size, (uint8_t*)buf + offset,
+           sizeof(docinfo->rev_meta.size));
+    offset += sizeof(docinfo->rev_meta.size);
+
+    if (docinfo->rev_meta.size > 0) {
+        docinfo->rev_meta.buf = ((char *)docinfo) + sizeof(DocInfo);
+        memcpy(docinfo->rev_meta.buf, (uint8_t*)buf + offset, docinfo->rev_meta.size);
+        offset += docinfo->rev_meta.size;
+    }else{
+        docinfo->rev_meta.buf = NULL;
+    }
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_save_documents(Db *db, Doc* const docs[], DocInfo *infos[],
+        unsigned numdocs, couchstore_save_options options)
+{
+    unsigned i;
+    uint16_t metalen;
+    uint8_t metabuf[METABUF_MAXLEN];
+    uint8_t *buf;
+
+    for (i=0;i<numdocs;++i){
+        // value: metalen (2 bytes), meta, body
+        metalen = _docinfo_to_buf(infos[i], metabuf);
+        buf = (uint8_t*)malloc(sizeof(metalen) + metalen + docs[i]->data.size);
+        memcpy(buf, &metalen, sizeof(metalen));
+        memcpy(buf + sizeof(metalen), metabuf, metalen);
+        memcpy(buf + sizeof(metalen) + metalen, docs[i]->data.buf, docs[i]->data.size);
+
+        _set(db->idx, docs[i]->id.buf, docs[i]->id.size, buf,
+             sizeof(metalen) + metalen + docs[i]->data.size);
+
+        infos[i]->db_seq = 0;
+    }
+
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_save_document(Db *db, const Doc *doc, DocInfo *info,
+        couchstore_save_options options)
+{
+    return couchstore_save_documents(db, (Doc**)&doc, (DocInfo**)&info, 1, options);
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_docinfo_by_id(Db *db, const void *id, size_t idlen, DocInfo **pInfo)
+{
+    void *value;
+    size_t valuelen, rev_meta_size, meta_offset;
+    struct mem_node *node;
+
+    node = _search(db->idx, id, idlen);
+    value = (node)?(_get(node, &valuelen)):(NULL);
+    if (!value) {
+        *pInfo = NULL;
+        return COUCHSTORE_ERROR_DOC_NOT_FOUND;
+    }
+
+    meta_offset = sizeof(uint64_t)*1 + sizeof(int) + sizeof(couchstore_content_meta_flags);
+    memcpy(&rev_meta_size, (uint8_t*)value + sizeof(uint16_t) + meta_offset,
+           sizeof(size_t));
+
+    *pInfo = (DocInfo *)malloc(sizeof(DocInfo) + rev_meta_size);
+    (*pInfo)->id.buf = (char *)id;
+    (*pInfo)->id.size = idlen;
+    (*pInfo)->size = idlen + valuelen;
+    (*pInfo)->bp = 0;
+    (*pInfo)->db_seq = 0;
+    _buf_to_docinfo((uint8_t*)value + sizeof(uint16_t), valuelen, (*pInfo));
+
+    free(value);
+
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_docinfos_by_id(Db *db, const sized_buf ids[], unsigned numDocs,
+        couchstore_docinfos_options options, couchstore_changes_callback_fn callback, void *ctx)
+{
+    unsigned i;
+    DocInfo *docinfo;
+
+    for (i=0;i<numDocs;++i){
+        if (couchstore_docinfo_by_id(db, ids[i].buf, ids[i].size, &docinfo) ==
+            COUCHSTORE_SUCCESS) {
+            callback(db, docinfo, ctx);
+            free(docinfo);
+        }
+    }
+
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_docinfos_by_sequence(Db *db,
+                                                   const uint64_t sequence[],
+                                                   unsigned numDocs,
+                                                   couchstore_docinfos_options options,
+                                                   couchstore_changes_callback_fn callback,
+                                                   void *ctx)
+{
+    // do nothing (no sequence index)
+
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_all_docs(Db *db,
+                                       const sized_buf* startKeyPtr,
+                                       couchstore_docinfos_options options,
+                                       couchstore_changes_callback_fn callback,
+                                       void *ctx)
+{
+    int ret = 0;
+    void *value;
+    size_t valuelen;
+    DocInfo *docinfo;
+    size_t rev_meta_size, max_meta_size = 256;
+    size_t meta_offset;
+    struct mem_node *node;
+
+    meta_offset = sizeof(uint64_t)*1 + sizeof(int) +
+                  sizeof(couchstore_content_meta_flags);
+    docinfo = (DocInfo*)malloc(sizeof(DocInfo) + max_meta_size);
+
+    if (startKeyPtr) {
+        node = _lower_bound(db->idx, startKeyPtr->buf, startKeyPtr->size);
+    } else {
+        node = db->idx->head->next[0];
+    }
+
+    for (; ret >= 0 && node; node = node->next[0]) {
+        value = _get(node, &valuelen);
+        if (!value) continue;
+
+        memcpy(&rev_meta_size, (uint8_t*)value + sizeof(uint16_t) + meta_offset,
+               sizeof(size_t));
+        if (rev_meta_size > max_meta_size) {
+            max_meta_size = rev_meta_size;
+            docinfo = (DocInfo*)realloc(docinfo, sizeof(DocInfo) + max_meta_size);
+        }
+
+        memset(docinfo, 0, sizeof(DocInfo));
+        docinfo->id.buf = node->key;
+        docinfo->id.size = node->keylen;
+        docinfo->size = node->keylen + valuelen;
+        docinfo->bp = 0;
+        docinfo->db_seq = 0;
+        _buf_to_docinfo((uint8_t*)value + sizeof(uint16_t), valuelen, docinfo);
+        free(value);
+
+        ret = callback(db, docinfo, ctx);
+    }
+
+    free(docinfo);
+
+    return (ret < 0)?(COUCHSTORE_ERROR_CANCEL):(COUCHSTORE_SUCCESS);
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_open_document(Db *db,
+                                            const void *id,
+                                            size_t idlen,
+                                            Doc **pDoc,
+                                            couchstore_open_options options)
+{
+    void *value;
+    size_t valuelen;
+    struct mem_node *node;
+
+    node = _search(db->idx, id, idlen);
+    value = (node)?(_get(node, &valuelen)):(NULL);
+    if (value == NULL) {
+        *pDoc = NULL;
+        return COUCHSTORE_ERROR_DOC_NOT_FOUND;
+    }
+
+    *pDoc = (Doc *)malloc(sizeof(Doc));
+    (*pDoc)->id.buf = (char*)id;
+    (*pDoc)->id.size = idlen;
+    (*pDoc)->data.buf = (char*)value;
+    (*pDoc)->data.size = valuelen;
+
+    return COUCHSTORE_SUCCESS;
+}
+
+// the value is read under the node lock, so an update of the same key
+// waits until the callback returns
+couchstore_error_t couchstore_open_document_ref(Db *db,
+                                                const void *id,
+                                                size_t idlen,
+                                                couchstore_doc_ref_fn callback,
+                                                void *ctx)
+{
+    struct mem_node *node;
+    Doc doc;
+
+    node = _search(db->idx, id, idlen);
+    if (!node) {
+        return COUCHSTORE_ERROR_DOC_NOT_FOUND;
+    }
+
+    _node_lock(node);
+    if (!node->value) {
+        _node_unlock(node);
+        return COUCHSTORE_ERROR_DOC_NOT_FOUND;
+    }
+    doc.id.buf = (char*)id;
+    doc.id.size = idlen;
+    doc.data.buf = (char*)node->value;
+    doc.data.size = node->valuelen;
+    callback(db, &doc, ctx);
+    _node_unlock(node);
+
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+void couchstore_free_document(Doc *doc)
+{
+    if (doc->id.buf) free(doc->id.buf);
+    if (doc->data.buf) free(doc->data.buf);
+    free(doc);
+}
+
+LIBCOUCHSTORE_API
+void couchstore_free_docinfo(DocInfo *docinfo)
+{
+    free(docinfo);
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_commit(Db *db)
+{
+    // do nothing (updates are visible immediately)
+
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_compact_db_ex(Db* source, const char* target_filename,
+        uint64_t flags, const couch_file_ops *ops)
+{
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_compact_db(Db* source, const char* target_filename)
+{
+    return couchstore_compact_db_ex(source, target_filename, 0x0, NULL);
+}
+
+struct couch_engine * couch_engine_get(void)
+{
+    static struct couch_engine e;
+
+    memset(&e, 0, sizeof(e));
+    e.name = "mem";
+    e.desc = "in-memory (reference)";
+    e.flags = ENGINE_THREAD_SAFE | ENGINE_VOLATILE;
+    couch_engine_set_core(&e);
+    e.open_document_ref = couchstore_open_document_ref;
+    e.set_sync = couchstore_set_sync;
+    e.set_cache = couchstore_set_cache;
+    e.get_stats = couchstore_get_stats;
+
+    return &e;
+}
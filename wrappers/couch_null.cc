@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "couch_db.h"
+#include "couch_engine.h"
+
+// Null engine: every operation succeeds without doing anything, and every
+// lookup finds an empty document. The benchmark then measures only its
+// own overhead (key/body generation, pacing, latency accounting, locks),
+// i.e. the maximum rate the harness can drive.
+
+struct _db {
+    char *filename;
+};
+
+couchstore_error_t couchstore_set_cache(uint64_t size)
+{
+    return COUCHSTORE_SUCCESS;
+}
+
+couchstore_error_t couchstore_set_sync(Db *db, int sync)
+{
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_open_db(const char *filename,
+                                      couchstore_open_flags flags,
+                                      Db **pDb)
+{
+    return couchstore_open_db_ex(filename, flags,
+                                 NULL, pDb);
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_open_db_ex(const char *filename,
+                                         couchstore_open_flags flags,
+                                         const couch_file_ops *ops,
+                                         Db **pDb)
+{
+    *pDb = (Db*)malloc(sizeof(Db));
+    (*pDb)->filename = (char*)malloc(strlen(filename)+1);
+    strcpy((*pDb)->filename, filename);
+
+    return COUCHSTORE_SUCCESS;
+}
+
+couchstore_error_t couchstore_open_snapshot(Db *db, Db **snapshot)
+{
+    return couchstore_open_db(db->filename, 0x0, snapshot);
+}
+
+couchstore_error_t couchstore_close_snapshot(Db *snapshot)
+{
+    return couchstore_close_db(snapshot);
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_close_db(Db *db)
+{
+    free(db->filename);
+    free(db);
+
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_db_info(Db *db, DbInfo* info)
+{
+    memset(info, 0, sizeof(DbInfo));
+    info->filename = db->filename;
+
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_save_documents(Db *db, Doc* const docs[], DocInfo *infos[],
+        unsigned numdocs, couchstore_save_options options)
+{
+    unsigned i;
+
+    for (i=0;i<numdocs;++i){
+        infos[i]->db_seq = 0;
+    }
+
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_save_document(Db *db, const Doc *doc, DocInfo *info,
+        couchstore_save_options options)
+{
+    return couchstore_save_documents(db, (Doc**)&doc, (DocInfo**)&info, 1, options);
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_docinfo_by_id(Db *db, const void *id, size_t idlen, DocInfo **pInfo)
+{
+    *pInfo = (DocInfo *)malloc(sizeof(DocInfo));
+    memset(*pInfo, 0, sizeof(DocInfo));
+    (*pInfo)->id.buf = (char *)id;
+    (*pInfo)->id.size = idlen;
+    (*pInfo)->size = idlen;
+
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_docinfos_by_id(Db *db, const sized_buf ids[], unsigned numDocs,
+        couchstore_docinfos_options options, couchstore_changes_callback_fn callback, void *ctx)
+{
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_docinfos_by_sequence(Db *db,
+                                                   const uint64_t sequence[],
+                                                   unsigned numDocs,
+                                                   couchstore_docinfos_options options,
+                                                   couchstore_changes_callback_fn callback,
+                                                   void *ctx)
+{
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_all_docs(Db *db,
+                                       const sized_buf* startKeyPtr,
+                                       couchstore_docinfos_options options,
+                                       couchstore_changes_callback_fn callback,
+                                       void *ctx)
+{
+    // nothing to iterate
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_open_document(Db *db,
+                                            const void *id,
+                                            size_t idlen,
+                                            Doc **pDoc,
+                                            couchstore_open_options options)
+{
+    *pDoc = (Doc *)malloc(sizeof(Doc));
+    (*pDoc)->id.buf = (char*)id;
+    (*pDoc)->id.size = idlen;
+    (*pDoc)->data.buf = NULL;
+    (*pDoc)->data.size = 0;
+
+    return COUCHSTORE_SUCCESS;
+}
+
+couchstore_error_t couchstore_open_document_ref(Db *db,
+                                                const void *id,
+                                                size_t idlen,
+                                                couchstore_doc_ref_fn callback,
+                                                void *ctx)
+{
+    Doc doc;
+
+    doc.id.buf = (char*)id;
+    doc.id.size = idlen;
+    doc.data.buf = NULL;
+    doc.data.size = 0;
+    callback(db, &doc, ctx);
+
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+void couchstore_free_document(Doc *doc)
+{
+    if (doc->id.buf) free(doc->id.buf);
+    if (doc->data.buf) free(doc->data.buf);
+    free(doc);
+}
+
+LIBCOUCHSTORE_API
+void couchstore_free_docinfo(DocInfo *docinfo)
+{
+    free(docinfo);
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_commit(Db *db)
+{
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_compact_db_ex(Db* source, const char* target_filename,
+        uint64_t flags, const couch_file_ops *ops)
+{
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_compact_db(Db* source, const char* target_filename)
+{
+    return couchstore_compact_db_ex(source, target_filename, 0x0, NULL);
+}
+
+struct couch_engine * couch_engine_get(void)
+{
+    static struct couch_engine e;
+
+    memset(&e, 0, sizeof(e));
+    e.name = "null";
+    e.desc = "null (harness only)";
+    e.flags = ENGINE_THREAD_SAFE | ENGINE_VOLATILE;
+    couch_engine_set_core(&e);
+    e.open_document_ref = couchstore_open_document_ref;
+    e.set_sync = couchstore_set_sync;
+    e.set_cache = couchstore_set_cache;
+
+    return &e;
+}
@@ -4,9 +4,11 @@
 #include <string.h>
 #include <assert.h>
 #include <sys/stat.h>
+#include <pthread.h>
 
 #include "rocksdb/c.h"
 #include "couch_db.h"
+#include "couch_engine.h"
 
 #define METABUF_MAXLEN (256)
 
@@ -15,11 +17,18 @@ struct _db {
     rocksdb_options_t *options;
     rocksdb_readoptions_t *read_options;
     rocksdb_writeoptions_t *write_options;
+    int sync; // write_options has sync on
+    const rocksdb_snapshot_t *snapshot;
+    rocksdb_column_family_handle_t *cf; // namespace mode only
     char *filename;
 };
 
 static uint64_t cache_size = 0;
 static uint64_t wbs_size = 4*1024*1024;
+static uint64_t nsyncs = 0;
+static int raw_body = 0;
+static int stats_on = 0;
+static char *native_options = NULL; // "key=value;..." from [rocksdb]
 couchstore_error_t couchstore_set_cache(uint64_t size)
 {
     cache_size = size;
@@ -29,6 +38,229 @@ couchstore_error_t couchstore_set_wbs_size(uint64_t size) {
     wbs_size = size;
     return COUCHSTORE_SUCCESS;
 }
+// values are stored as they are, without the docinfo header
+couchstore_error_t couchstore_set_raw_body(int raw) {
+    raw_body = raw;
+    return COUCHSTORE_SUCCESS;
+}
+
+// namespace mode: open_conn() opens one instance, and each file is
+// a column family in it (shared memtable flushes, WAL and block cache)
+static int ns_mode = 0;
+static rocksdb_t *ns_db = NULL;
+static rocksdb_options_t *ns_options = NULL;
+static char *ns_path = NULL;
+static size_t ns_ncf = 0;
+static char **ns_cf_names = NULL;
+static rocksdb_column_family_handle_t **ns_cf = NULL;
+static pthread_mutex_t ns_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// statistics (block cache hits) are collected by files opened afterwards
+couchstore_error_t couchstore_set_stats(int on) {
+    stats_on = on;
+    return COUCHSTORE_SUCCESS;
+}
+
+// any option the RocksDB options string understands, e.g.
+// block_based_table_factory = {filter_policy=bloomfilter:10:false}
+couchstore_error_t couchstore_set_option(const char *key, const char *value)
+{
+    size_t len;
+    char *opt, *err = NULL;
+    rocksdb_options_t *base, *test;
+
+    opt = (char*)malloc(strlen(key) + strlen(value) + 2);
+    sprintf(opt, "%s=%s", key, value);
+    base = rocksdb_options_create();
+    test = rocksdb_options_create();
+    rocksdb_get_options_from_string(base, opt, test, &err);
+    rocksdb_options_destroy(base);
+    rocksdb_options_destroy(test);
+    if (err) {
+        printf("ERR %s\n", err);
+        free(err);
+        free(opt);
+        return COUCHSTORE_ERROR_INVALID_ARGUMENTS;
+    }
+
+    len = (native_options)?(strlen(native_options)):(0);
+    native_options = (char*)realloc(native_options, len + strlen(opt) + 2);
+    sprintf(native_options + len, "%s%s", (len)?(";"):(""), opt);
+    free(opt);
+
+    return COUCHSTORE_SUCCESS;
+}
+
+couchstore_error_t couchstore_set_namespace(int on) {
+    ns_mode = on;
+    return COUCHSTORE_SUCCESS;
+}
+
+static rocksdb_options_t * _get_options()
+{
+    rocksdb_options_t *options, *tuned;
+    char *err = NULL;
+
+    options = rocksdb_options_create();
+    rocksdb_options_set_create_if_missing(options, 1);
+    rocksdb_options_set_compression(options, 0);
+
+    rocksdb_options_set_max_background_compactions(options, 8);
+    rocksdb_options_set_max_background_flushes(options, 8);
+    rocksdb_options_set_max_write_buffer_number(options, 8);
+    //rocksdb_options_set_min_write_buffer_number_to_merge(options, 8);
+    rocksdb_options_set_write_buffer_size(options, wbs_size);
+
+    if (cache_size) {
+        rocksdb_options_set_cache(options,
+                                  rocksdb_cache_create_lru((uint64_t)cache_size));
+    }
+
+    rocksdb_options_set_max_open_files(options, 1000);
+    if (stats_on) {
+        rocksdb_options_enable_statistics(options);
+    }
+    if (native_options) {
+        // on top of the settings above
+        tuned = rocksdb_options_create();
+        rocksdb_get_options_from_string(options, native_options, tuned, &err);
+        if (err) {
+            printf("ERR %s\n", err);
+            free(err);
+            rocksdb_options_destroy(tuned);
+        } else {
+            rocksdb_options_destroy(options);
+            options = tuned;
+        }
+    }
+    return options;
+}
+
+static void _ns_add_cf(const char *name, rocksdb_column_family_handle_t *cf)
+{
+    ns_cf_names = (char**)realloc(ns_cf_names, sizeof(char*) * (ns_ncf+1));
+    ns_cf = (rocksdb_column_family_handle_t**)
+            realloc(ns_cf, sizeof(rocksdb_column_family_handle_t*) * (ns_ncf+1));
+    ns_cf_names[ns_ncf] = (char*)malloc(strlen(name)+1);
+    strcpy(ns_cf_names[ns_ncf], name);
+    ns_cf[ns_ncf] = cf;
+    ns_ncf++;
+}
+
+// column family of a file: its name without the directory path
+static rocksdb_column_family_handle_t * _ns_get_cf(const char *filename)
+{
+    size_t i;
+    char *err = NULL;
+    const char *name = strrchr(filename, '/');
+    rocksdb_column_family_handle_t *cf = NULL;
+
+    name = (name)?(name+1):(filename);
+    pthread_mutex_lock(&ns_lock);
+    for (i=0;i<ns_ncf;++i){
+        if (!strcmp(ns_cf_names[i], name)) {
+            cf = ns_cf[i];
+            break;
+        }
+    }
+    if (!cf) {
+        cf = rocksdb_create_column_family(ns_db, ns_options, name, &err);
+        if (err) {
+            printf("ERR %s\n", err);
+            free(err);
+            cf = NULL;
+        } else {
+            _ns_add_cf(name, cf);
+        }
+    }
+    pthread_mutex_unlock(&ns_lock);
+
+    return cf;
+}
+
+couchstore_error_t couchstore_open_conn(const char *filename)
+{
+    size_t i, ncf = 0;
+    char **names;
+    const char *default_name = "default";
+    const rocksdb_options_t **cf_options;
+    rocksdb_column_family_handle_t **handles;
+    char *err = NULL;
+
+    if (!ns_mode) {
+        return COUCHSTORE_SUCCESS;
+    }
+
+    ns_path = (char*)malloc(strlen(filename)+1);
+    strcpy(ns_path, filename);
+    ns_options = _get_options();
+    rocksdb_options_set_create_missing_column_families(ns_options, 1);
+
+    // every existing column family has to be opened along with the DB
+    names = rocksdb_list_column_families(ns_options, filename, &ncf, &err);
+    if (err) {
+        // new DB
+        free(err);
+        err = NULL;
+        names = NULL;
+        ncf = 0;
+    }
+
+    cf_options = (const rocksdb_options_t**)
+                 malloc(sizeof(rocksdb_options_t*) * ((ncf)?(ncf):(1)));
+    handles = (rocksdb_column_family_handle_t**)
+              malloc(sizeof(rocksdb_column_family_handle_t*) * ((ncf)?(ncf):(1)));
+    for (i=0;i<((ncf)?(ncf):(1));++i){
+        cf_options[i] = ns_options;
+    }
+    ns_db = rocksdb_open_column_families(ns_options, filename, (ncf)?(ncf):(1),
+                                         (ncf)?((const char**)names):(&default_name),
+                                         cf_options, handles, &err);
+    if (err) {
+        printf("ERR %s\n", err);
+        free(err);
+        ns_db = NULL;
+    } else {
+        for (i=0;i<((ncf)?(ncf):(1));++i){
+            _ns_add_cf((ncf)?(names[i]):(default_name), handles[i]);
+        }
+    }
+
+    if (names) {
+        rocksdb_list_column_families_destroy(names, ncf);
+    }
+    free(cf_options);
+    free(handles);
+
+    return (ns_db)?(COUCHSTORE_SUCCESS):(COUCHSTORE_ERROR_OPEN_FILE);
+}
+
+couchstore_error_t couchstore_close_conn()
+{
+    size_t i;
+
+    if (!ns_db) {
+        return COUCHSTORE_SUCCESS;
+    }
+    for (i=0;i<ns_ncf;++i){
+        rocksdb_column_family_handle_destroy(ns_cf[i]);
+        free(ns_cf_names[i]);
+    }
+    free(ns_cf);
+    free(ns_cf_names);
+    ns_cf = NULL;
+    ns_cf_names = NULL;
+    ns_ncf = 0;
+
+    rocksdb_close(ns_db);
+    rocksdb_options_destroy(ns_options);
+    free(ns_path);
+    ns_db = NULL;
+    ns_options = NULL;
+    ns_path = NULL;
+
+    return COUCHSTORE_SUCCESS;
+}
 
 LIBCOUCHSTORE_API
 couchstore_error_t couchstore_open_db(const char *filename,
@@ -54,27 +286,27 @@ couchstore_error_t couchstore_open_db_ex(const char *filename,
     ppdb->filename = (char*)malloc(strlen(filename)+1);
     strcpy(ppdb->filename, filename);
 
-    ppdb->options = rocksdb_options_create();
-    rocksdb_options_set_create_if_missing(ppdb->options, 1);
-    rocksdb_options_set_compression(ppdb->options, 0);
-
-    rocksdb_options_set_max_background_compactions(ppdb->options, 8);
-    rocksdb_options_set_max_background_flushes(ppdb->options, 8);
-    rocksdb_options_set_max_write_buffer_number(ppdb->options, 8);
-    //rocksdb_options_set_min_write_buffer_number_to_merge(ppdb->options, 8);
-    rocksdb_options_set_write_buffer_size(ppdb->options, wbs_size);
-
-    if (cache_size) {
-        rocksdb_options_set_cache(ppdb->options,
-                                  rocksdb_cache_create_lru((uint64_t)cache_size));
+    if (ns_db) {
+        // the instance (and its options) belongs to open_conn()
+        ppdb->options = NULL;
+        ppdb->db = ns_db;
+        ppdb->cf = _ns_get_cf(filename);
+        if (!ppdb->cf) {
+            free(ppdb->filename);
+            free(ppdb);
+            return COUCHSTORE_ERROR_OPEN_FILE;
+        }
+    } else {
+        ppdb->options = _get_options();
+        ppdb->cf = NULL;
+        ppdb->db = rocksdb_open(ppdb->options, ppdb->filename, &err);
     }
 
-    rocksdb_options_set_max_open_files(ppdb->options, 1000);
-    ppdb->db = rocksdb_open(ppdb->options, ppdb->filename, &err);
-
+    ppdb->snapshot = NULL;
     ppdb->read_options = rocksdb_readoptions_create();
     ppdb->write_options = rocksdb_writeoptions_create();
     rocksdb_writeoptions_set_sync(ppdb->write_options, 1);
+    ppdb->sync = 1;
     //rocksdb_writeoptions_set_sync(ppdb->write_options, 0);
 
     return COUCHSTORE_SUCCESS;
@@ -83,9 +315,16 @@ couchstore_error_t couchstore_open_db_ex(const char *filename,
 couchstore_error_t couchstore_set_sync(Db *db, int sync)
 {
     rocksdb_writeoptions_set_sync(db->write_options, sync);
+    db->sync = sync;
     return COUCHSTORE_SUCCESS;
 }
 
+// synced write batches (one WAL sync each)
+uint64_t couchstore_sync_count()
+{
+    return nsyncs;
+}
+
 couchstore_error_t couchstore_disable_auto_compaction(Db *db, int cpt)
 {
     char *err = NULL;
@@ -96,10 +335,43 @@ couchstore_error_t couchstore_disable_auto_compaction(Db *db, int cpt)
     return COUCHSTORE_SUCCESS;
 }
 
+// shares the DB instance; only the read options are bound to the snapshot
+couchstore_error_t couchstore_open_snapshot(Db *db, Db **snapshot)
+{
+    Db *ppdb;
+
+    *snapshot = (Db*)malloc(sizeof(Db));
+    ppdb = *snapshot;
+    *ppdb = *db;
+
+    ppdb->filename = (char*)malloc(strlen(db->filename)+1);
+    strcpy(ppdb->filename, db->filename);
+
+    ppdb->snapshot = rocksdb_create_snapshot(db->db);
+    ppdb->read_options = rocksdb_readoptions_create();
+    rocksdb_readoptions_set_snapshot(ppdb->read_options, ppdb->snapshot);
+    // long scans should not evict the working set of point reads
+    rocksdb_readoptions_set_fill_cache(ppdb->read_options, 0);
+
+    return COUCHSTORE_SUCCESS;
+}
+
+couchstore_error_t couchstore_close_snapshot(Db *snapshot)
+{
+    rocksdb_release_snapshot(snapshot->db, snapshot->snapshot);
+    rocksdb_readoptions_destroy(snapshot->read_options);
+    free(snapshot->filename);
+    free(snapshot);
+
+    return COUCHSTORE_SUCCESS;
+}
+
 LIBCOUCHSTORE_API
 couchstore_error_t couchstore_close_db(Db *db)
 {
-    rocksdb_close(db->db);
+    if (!db->cf) {
+        rocksdb_close(db->db);
+    }
     free(db->filename);
     free(db);
 
@@ -117,12 +389,102 @@ couchstore_error_t couchstore_db_info(Db *db, DbInfo* info)
     info->header_position = 0;
     info->last_sequence = 0;
 
-    stat(db->filename, &filestat);
+    stat((db->cf)?(ns_path):(db->filename), &filestat);
     info->space_used = filestat.st_size;
 
     return COUCHSTORE_SUCCESS;
 }
 
+// level sizes from the "rocksdb.levelstats" table:
+// Level Files Size(MB)
+// --------------------
+//   0        2        4
+static void _add_level_sizes(const char *str, struct couch_engine_stats *stats)
+{
+    int level, nfiles;
+    double size_mb;
+
+    str = (str)?(strstr(str, "---\n")):(NULL);
+    if (!str) return;
+    str += 4;
+    while (sscanf(str, "%d %d %lf", &level, &nfiles, &size_mb) == 3) {
+        if (level >= 0 && level < ENGINE_STATS_MAX_LEVELS) {
+            couch_engine_stat_add(&stats->level_bytes[level],
+                                  (uint64_t)(size_mb * 1024 * 1024));
+            if (level >= stats->nlevels) {
+                stats->nlevels = level + 1;
+            }
+        }
+        str = strchr(str, '\n');
+        if (!str) break;
+        str++;
+    }
+}
+
+static void _add_property(Db *db, const char *name, uint64_t *stat)
+{
+    uint64_t val;
+    int ret;
+
+    if (db->cf) {
+        ret = rocksdb_property_int_cf(db->db, db->cf, name, &val);
+    } else {
+        ret = rocksdb_property_int(db->db, name, &val);
+    }
+    if (ret == 0) {
+        couch_engine_stat_add(stat, val);
+    }
+}
+
+// "<ticker> COUNT : <n>" line of the statistics dump
+static void _add_ticker(const char *str, const char *name, uint64_t *stat)
+{
+    unsigned long long val;
+
+    str = (str)?(strstr(str, name)):(NULL);
+    if (str && sscanf(str + strlen(name), " COUNT : %llu", &val) == 1) {
+        couch_engine_stat_add(stat, val);
+    }
+}
+
+couchstore_error_t couchstore_get_stats(Db *dbs[], int ndbs,
+                                        struct couch_engine_stats *stats)
+{
+    int i;
+    char *str;
+
+    for (i=0;i<ndbs;++i){
+        _add_property(dbs[i], "rocksdb.estimate-num-keys", &stats->doc_count);
+        _add_property(dbs[i], "rocksdb.estimate-live-data-size",
+                      &stats->space_used);
+        _add_property(dbs[i], "rocksdb.total-sst-files-size", &stats->file_size);
+        _add_property(dbs[i], "rocksdb.cur-size-all-mem-tables",
+                      &stats->mem_bytes);
+        _add_property(dbs[i], "rocksdb.estimate-pending-compaction-bytes",
+                      &stats->compaction_pending);
+
+        if (dbs[i]->cf) {
+            str = rocksdb_property_value_cf(dbs[i]->db, dbs[i]->cf,
+                                            "rocksdb.levelstats");
+        } else {
+            str = rocksdb_property_value(dbs[i]->db, "rocksdb.levelstats");
+        }
+        _add_level_sizes(str, stats);
+        free(str);
+
+        // the column families of a namespace instance share one cache
+        if (stats_on && (!dbs[i]->cf || i == 0)) {
+            str = rocksdb_options_statistics_get_string(
+                      (dbs[i]->cf)?(ns_options):(dbs[i]->options));
+            _add_ticker(str, "rocksdb.block.cache.hit", &stats->cache_hits);
+            _add_ticker(str, "rocksdb.block.cache.miss", &stats->cache_misses);
+            free(str);
+        }
+    }
+
+    return COUCHSTORE_SUCCESS;
+}
+
 size_t _docinfo_to_buf(DocInfo *docinfo, void *buf)
 {
     // [db_seq,] rev_seq, deleted, content_meta, rev_meta (size), rev_meta (buf)
@@ -150,6 +512,35 @@ size_t _docinfo_to_buf(DocInfo *docinfo, void *buf)
     return offset;
 }
 
+// the DB instance is shared by all threads, so the write batch is kept
+// per thread (thread-specific data, destroyed when the thread exits) and
+// reused by every call
+static pthread_key_t enc_key;
+static pthread_once_t enc_key_once = PTHREAD_ONCE_INIT;
+
+static void _enc_wb_free(void *wb)
+{
+    rocksdb_writebatch_destroy((rocksdb_writebatch_t *)wb);
+}
+
+static void _enc_key_create(void)
+{
+    pthread_key_create(&enc_key, _enc_wb_free);
+}
+
+static rocksdb_writebatch_t * _enc_wb_get(void)
+{
+    rocksdb_writebatch_t *wb;
+
+    pthread_once(&enc_key_once, _enc_key_create);
+    wb = (rocksdb_writebatch_t *)pthread_getspecific(enc_key);
+    if (!wb) {
+        wb = rocksdb_writebatch_create();
+        pthread_setspecific(enc_key, wb);
+    }
+    return wb;
+}
+
 LIBCOUCHSTORE_API
 couchstore_error_t couchstore_save_documents(Db *db, Doc* const docs[], DocInfo *infos[],
         unsigned numdocs, couchstore_save_options options)
@@ -157,31 +548,52 @@ couchstore_error_t couchstore_save_documents(Db *db, Doc* const docs[], DocInfo
     unsigned i;
     uint16_t metalen;
     uint8_t metabuf[METABUF_MAXLEN];
-    uint8_t *buf;
-        char *err = NULL;
-    rocksdb_writebatch_t *wb;
+    const char *parts[3];
+    size_t part_sizes[3];
+    char *err = NULL;
+    rocksdb_writebatch_t *enc_wb = _enc_wb_get();
 
-    wb = rocksdb_writebatch_create();
+    rocksdb_writebatch_clear(enc_wb);
 
     for (i=0;i<numdocs;++i){
-        metalen = _docinfo_to_buf(infos[i], metabuf);
-        buf = (uint8_t*)malloc(sizeof(metalen) + metalen + docs[i]->data.size);
-        memcpy(buf + sizeof(metalen), metabuf, metalen);
-        memcpy(buf, &metalen, sizeof(metalen));
-        memcpy(buf + sizeof(metalen) + metalen, docs[i]->data.buf, docs[i]->data.size);
-
-        rocksdb_writebatch_put(wb, docs[i]->id.buf, docs[i]->id.size, (char*)buf,
-                               sizeof(metalen) + metalen + docs[i]->data.size);
-
+        if (raw_body) {
+            if (db->cf) {
+                rocksdb_writebatch_put_cf(enc_wb, db->cf,
+                                          docs[i]->id.buf, docs[i]->id.size,
+                                          docs[i]->data.buf, docs[i]->data.size);
+            } else {
+                rocksdb_writebatch_put(enc_wb, docs[i]->id.buf, docs[i]->id.size,
+                                       docs[i]->data.buf, docs[i]->data.size);
+            }
+        } else {
+            // [metalen][meta][body] gathered by the batch itself (SliceParts)
+            metalen = _docinfo_to_buf(infos[i], metabuf);
+            parts[0] = (char*)&metalen;
+            part_sizes[0] = sizeof(metalen);
+            parts[1] = (char*)metabuf;
+            part_sizes[1] = metalen;
+            parts[2] = docs[i]->data.buf;
+            part_sizes[2] = docs[i]->data.size;
+
+            if (db->cf) {
+                rocksdb_writebatch_putv_cf(enc_wb, db->cf,
+                                           1, (const char**)&docs[i]->id.buf,
+                                           &docs[i]->id.size, 3, parts, part_sizes);
+            } else {
+                rocksdb_writebatch_putv(enc_wb, 1, (const char**)&docs[i]->id.buf,
+                                        &docs[i]->id.size, 3, parts, part_sizes);
+            }
+        }
         infos[i]->db_seq = 0;
-        free(buf);
     }
-    rocksdb_write(db->db, db->write_options, wb, &err);
+    rocksdb_write(db->db, db->write_options, enc_wb, &err);
     if (err) {
         printf("ERR %s\n", err);
     }
     assert(err == NULL);
-    rocksdb_writebatch_destroy(wb);
+    if (db->sync) {
+        __sync_fetch_and_add(&nsyncs, 1);
+    }
 
     return COUCHSTORE_SUCCESS;
 }
@@ -193,10 +605,30 @@ couchstore_error_t couchstore_save_document(Db *db, const Doc *doc, DocInfo *inf
     return couchstore_save_documents(db, (Doc**)&doc, (DocInfo**)&info, 1, options);
 }
 
+static char * _get(Db *db, const char *key, size_t keylen,
+                   size_t *valuelen, char **err)
+{
+    if (db->cf) {
+        return rocksdb_get_cf(db->db, db->read_options, db->cf,
+                              key, keylen, valuelen, err);
+    }
+    return rocksdb_get(db->db, db->read_options, key, keylen, valuelen, err);
+}
+
 void _buf_to_docinfo(void *buf, size_t size, DocInfo *docinfo)
 {
     size_t offset = 0;
 
+    if (raw_body) {
+        // there is no header to decode
+        docinfo->rev_seq = 0;
+        docinfo->deleted = 0;
+        docinfo->content_meta = 0;
+        docinfo->rev_meta.buf = NULL;
+        docinfo->rev_meta.size = 0;
+        return;
+    }
+
     memcpy(&docinfo->rev_seq, (uint8_t*)buf + offset, sizeof(docinfo->rev_seq));
     offset += sizeof(docinfo->rev_seq);
 
@@ -230,12 +662,16 @@ couchstore_error_t couchstore_docinfo_by_id(Db *db, const void *id, size_t idlen
     size_t rev_meta_size;
     size_t meta_offset;
 
-    value = rocksdb_get(db->db, db->read_options, (char*)id, idlen, &valuelen, &err);
+    value = _get(db, (char*)id, idlen, &valuelen, &err);
 
     meta_offset = sizeof(uint64_t)*1 + sizeof(int) +
                   sizeof(couchstore_content_meta_flags);
-    memcpy(&rev_meta_size, (uint8_t*)value + sizeof(uint16_t) + meta_offset,
-           sizeof(size_t));
+    if (raw_body) {
+        rev_meta_size = 0;
+    } else {
+        memcpy(&rev_meta_size, (uint8_t*)value + sizeof(uint16_t) + meta_offset,
+               sizeof(size_t));
+    }
 
     *pInfo = (DocInfo *)malloc(sizeof(DocInfo) + rev_meta_size);
     (*pInfo)->id.buf = (char *)id;
@@ -266,10 +702,14 @@ couchstore_error_t couchstore_docinfos_by_id(Db *db, const sized_buf ids[], unsi
     docinfo = (DocInfo*)malloc(sizeof(DocInfo) + max_meta_size);
 
     for (i=0;i<numDocs;++i){
-        value = rocksdb_get(db->db, db->read_options, ids[i].buf, ids[i].size, &valuelen, &err);
+        value = _get(db, ids[i].buf, ids[i].size, &valuelen, &err);
 
-        memcpy(&rev_meta_size, (uint8_t*)value + sizeof(uint16_t) + meta_offset,
-               sizeof(size_t));
+        if (raw_body) {
+            rev_meta_size = 0;
+        } else {
+            memcpy(&rev_meta_size, (uint8_t*)value + sizeof(uint16_t) + meta_offset,
+                   sizeof(size_t));
+        }
         if (rev_meta_size > max_meta_size) {
             max_meta_size = rev_meta_size;
             docinfo = (DocInfo*)realloc(docinfo, sizeof(DocInfo) + max_meta_size);
@@ -305,6 +745,69 @@ couchstore_error_t couchstore_docinfos_by_sequence(Db *db,
     return COUCHSTORE_SUCCESS;
 }
 
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_all_docs(Db *db,
+                                       const sized_buf* startKeyPtr,
+                                       couchstore_docinfos_options options,
+                                       couchstore_changes_callback_fn callback,
+                                       void *ctx)
+{
+    int ret = 0;
+    const char *key, *value;
+    size_t keylen, valuelen;
+    DocInfo *docinfo;
+    size_t rev_meta_size, max_meta_size = 256;
+    size_t meta_offset;
+    rocksdb_iterator_t *iterator;
+
+    meta_offset = sizeof(uint64_t)*1 + sizeof(int) +
+                  sizeof(couchstore_content_meta_flags);
+    docinfo = (DocInfo*)malloc(sizeof(DocInfo) + max_meta_size);
+
+    if (db->cf) {
+        iterator = rocksdb_create_iterator_cf(db->db, db->read_options, db->cf);
+    } else {
+        iterator = rocksdb_create_iterator(db->db, db->read_options);
+    }
+    if (startKeyPtr) {
+        rocksdb_iter_seek(iterator, startKeyPtr->buf, startKeyPtr->size);
+    } else {
+        rocksdb_iter_seek_to_first(iterator);
+    }
+
+    while (ret >= 0 && rocksdb_iter_valid(iterator)) {
+        key = rocksdb_iter_key(iterator, &keylen);
+        value = rocksdb_iter_value(iterator, &valuelen);
+
+        if (raw_body) {
+            rev_meta_size = 0;
+        } else {
+            memcpy(&rev_meta_size, (uint8_t*)value + sizeof(uint16_t) + meta_offset,
+                   sizeof(size_t));
+        }
+        if (rev_meta_size > max_meta_size) {
+            max_meta_size = rev_meta_size;
+            docinfo = (DocInfo*)realloc(docinfo, sizeof(DocInfo) + max_meta_size);
+        }
+
+        memset(docinfo, 0, sizeof(DocInfo));
+        docinfo->id.buf = (char *)key;
+        docinfo->id.size = keylen;
+        docinfo->size = keylen + valuelen;
+        docinfo->bp = 0;
+        docinfo->db_seq = 0;
+        _buf_to_docinfo((uint8_t*)value + sizeof(uint16_t), valuelen, docinfo);
+
+        ret = callback(db, docinfo, ctx);
+        rocksdb_iter_next(iterator);
+    }
+
+    rocksdb_iter_destroy(iterator);
+    free(docinfo);
+
+    return (ret < 0)?(COUCHSTORE_ERROR_CANCEL):(COUCHSTORE_SUCCESS);
+}
+
 LIBCOUCHSTORE_API
 couchstore_error_t couchstore_open_document(Db *db,
                                             const void *id,
@@ -318,11 +821,15 @@ couchstore_error_t couchstore_open_document(Db *db,
     size_t rev_meta_size;
     size_t meta_offset;
 
-    value = rocksdb_get(db->db, db->read_options, (char*)id, idlen, &valuelen, &err);
+    value = _get(db, (char*)id, idlen, &valuelen, &err);
     if (err) {
         printf("ERR %s\n", err);
     }
     assert(err == NULL);
+    if (value == NULL) {
+        *pDoc = NULL;
+        return COUCHSTORE_ERROR_DOC_NOT_FOUND;
+    }
 
     meta_offset = sizeof(uint64_t)*1 + sizeof(int) +
                   sizeof(couchstore_content_meta_flags);
@@ -336,6 +843,42 @@ couchstore_error_t couchstore_open_document(Db *db,
     return COUCHSTORE_SUCCESS;
 }
 
+// the value stays pinned in the block cache (or memtable) during the callback
+couchstore_error_t couchstore_open_document_ref(Db *db,
+                                                const void *id,
+                                                size_t idlen,
+                                                couchstore_doc_ref_fn callback,
+                                                void *ctx)
+{
+    char *err = NULL;
+    rocksdb_pinnableslice_t *value;
+    size_t valuelen;
+    Doc doc;
+
+    if (db->cf) {
+        value = rocksdb_get_pinned_cf(db->db, db->read_options, db->cf,
+                                      (char*)id, idlen, &err);
+    } else {
+        value = rocksdb_get_pinned(db->db, db->read_options, (char*)id, idlen, &err);
+    }
+    if (err) {
+        printf("ERR %s\n", err);
+    }
+    assert(err == NULL);
+    if (value == NULL) {
+        return COUCHSTORE_ERROR_DOC_NOT_FOUND;
+    }
+
+    doc.id.buf = (char*)id;
+    doc.id.size = idlen;
+    doc.data.buf = (char*)rocksdb_pinnableslice_value(value, &valuelen);
+    doc.data.size = valuelen;
+    callback(db, &doc, ctx);
+    rocksdb_pinnableslice_destroy(value);
+
+    return COUCHSTORE_SUCCESS;
+}
+
 LIBCOUCHSTORE_API
 void couchstore_free_document(Doc *doc)
 {
@@ -373,3 +916,28 @@ couchstore_error_t couchstore_compact_db(Db* source, const char* target_filename
     return couchstore_compact_db_ex(source, target_filename, 0x0, NULL);
 }
 
+struct couch_engine * couch_engine_get(void)
+{
+    static struct couch_engine e;
+
+    memset(&e, 0, sizeof(e));
+    e.name = "rocksdb";
+    e.desc = "RocksDB";
+    e.flags = ENGINE_THREAD_SAFE | ENGINE_SINGLE_OPEN |
+              ENGINE_SYNC_OPTION | ENGINE_BG_COMPACTION;
+    couch_engine_set_core(&e);
+    e.open_document_ref = couchstore_open_document_ref;
+    e.set_sync = couchstore_set_sync;
+    e.set_cache = couchstore_set_cache;
+    e.set_wbs_size = couchstore_set_wbs_size;
+    e.set_raw_body = couchstore_set_raw_body;
+    e.set_namespace = couchstore_set_namespace;
+    e.open_conn = couchstore_open_conn;
+    e.close_conn = couchstore_close_conn;
+    e.set_stats = couchstore_set_stats;
+    e.get_stats = couchstore_get_stats;
+    e.sync_count = couchstore_sync_count;
+    e.set_option = couchstore_set_option;
+
+    return &e;
+}
@@ -8,6 +8,7 @@
 
 #include "wiredtiger.h"
 #include "couch_db.h"
+#include "couch_engine.h"
 
 #define METABUF_MAXLEN (256)
 
@@ -16,32 +17,102 @@ struct _db {
     WT_SESSION *session;
     char *filename;
     int sync;
+    // reused for encoding values (a handle belongs to one thread)
+    uint8_t *buf;
+    size_t bufsize;
 };
 
 static WT_CONNECTION *conn = NULL;
 static uint64_t cache_size = 0;
 static int indexing_type = 0;
+static int raw_body = 0;
+static int stats_on = 0;
+static uint64_t nsyncs = 0;
+// appended to the built-in configuration strings, from [wiredtiger]
+static char *conn_options = NULL;
+static char *table_options = NULL;
+// checkpoint policy of the connection (ENGINE_CKPT_*)
+static int ckpt_policy = ENGINE_CKPT_DEFAULT;
+static uint64_t ckpt_value = 0;
+static WT_SESSION *ckpt_session = NULL;
 
 couchstore_error_t couchstore_set_cache(uint64_t size) {
     cache_size = size;
     return COUCHSTORE_SUCCESS;
 }
+// values are stored as they are, without the docinfo header
+couchstore_error_t couchstore_set_raw_body(int raw) {
+    raw_body = raw;
+    return COUCHSTORE_SUCCESS;
+}
+// statistics are enabled when the connection is opened
+couchstore_error_t couchstore_set_stats(int on) {
+    stats_on = on;
+    return COUCHSTORE_SUCCESS;
+}
 couchstore_error_t couchstore_set_idx_type(int type) {
     indexing_type = type;
     return COUCHSTORE_SUCCESS;
 }
 
+// time and log size based checkpoints are scheduled by WiredTiger itself
+// (checkpoint=(wait,log_size)); manual ones run only through checkpoint()
+couchstore_error_t couchstore_set_checkpoint(int policy, uint64_t value)
+{
+    ckpt_policy = policy;
+    ckpt_value = value;
+    return COUCHSTORE_SUCCESS;
+}
+
+// 'conn_config' goes to wiredtiger_open(), 'table_config' to
+// session->create(); later settings override the built-in ones
+couchstore_error_t couchstore_set_option(const char *key, const char *value)
+{
+    size_t len;
+    char **opt;
+
+    if (!strcmp(key, "conn_config")) {
+        opt = &conn_options;
+    } else if (!strcmp(key, "table_config")) {
+        opt = &table_options;
+    } else {
+        return COUCHSTORE_ERROR_INVALID_ARGUMENTS;
+    }
+
+    len = (*opt)?(strlen(*opt)):(0);
+    *opt = (char*)realloc(*opt, len + strlen(value) + 2);
+    sprintf(*opt + len, ",%s", value);
+
+    return COUCHSTORE_SUCCESS;
+}
+
 couchstore_error_t couchstore_open_conn(const char *filename)
 {
     int fd;
     int ret;
-    char config[256];
+    char *config;
+
+    config = (char*)malloc(256 + ((conn_options)?(strlen(conn_options)):(0)));
 
 #ifdef PRIu64
     sprintf(config, "create,log=(enabled),cache_size=%"PRIu64, cache_size);
 #else
     sprintf(config, "create,log=(enabled),cache_size=%llu", cache_size);
 #endif
+    if (stats_on || ckpt_policy == ENGINE_CKPT_TIME ||
+        ckpt_policy == ENGINE_CKPT_LOG_SIZE) {
+        // checkpoint_running() reads the statistics
+        strcat(config, ",statistics=(fast)");
+    }
+    if (ckpt_policy == ENGINE_CKPT_TIME) {
+        sprintf(config + strlen(config), ",checkpoint=(wait=%d)", (int)ckpt_value);
+    } else if (ckpt_policy == ENGINE_CKPT_LOG_SIZE) {
+        sprintf(config + strlen(config), ",checkpoint=(log_size=%llu)",
+                (unsigned long long)ckpt_value);
+    }
+    if (conn_options) {
+        strcat(config, conn_options);
+    }
     // create directory if not exist
     fd = open(filename, O_RDONLY, 0666);
     if (fd == -1) {
@@ -53,6 +124,7 @@ couchstore_error_t couchstore_open_conn(const char *filename)
     }
 
     wiredtiger_open(filename, NULL, config, &conn);
+    free(config);
 
     return COUCHSTORE_SUCCESS;
 }
@@ -60,6 +132,8 @@ couchstore_error_t couchstore_open_conn(const char *filename)
 couchstore_error_t couchstore_close_conn()
 {
     conn->close(conn, NULL);
+    // closed along with the connection
+    ckpt_session = NULL;
     return COUCHSTORE_SUCCESS;
 }
 
@@ -82,7 +156,7 @@ couchstore_error_t couchstore_open_db_ex(const char *filename,
     Db *ppdb;
     char fileonly[256];
     char table_name[256];
-    char table_config[256];
+    char *table_config;
     char *err;
 
     assert(conn);
@@ -106,6 +180,8 @@ couchstore_error_t couchstore_open_db_ex(const char *filename,
     }
 
     sprintf(table_name, "table:%s", fileonly);
+    table_config = (char*)malloc(256 +
+                   ((table_options)?(strlen(table_options)):(0)));
     if (indexing_type == 1) {
         // lsm-tree
         sprintf(table_config,
@@ -117,11 +193,17 @@ couchstore_error_t couchstore_open_db_ex(const char *filename,
         sprintf(table_config,
                 "split_pct=100,leaf_item_max=1KB,"
                 "internal_page_max=4KB,leaf_page_max=4KB");
+    if (table_options) {
+        strcat(table_config, table_options);
+    }
 
     conn->open_session(conn, NULL, NULL, &ppdb->session);
     ppdb->session->create(ppdb->session, table_name, table_config);
+    free(table_config);
     ppdb->session->open_cursor(ppdb->session, table_name, NULL, NULL, &ppdb->cursor);
     ppdb->sync = 1;
+    ppdb->buf = NULL;
+    ppdb->bufsize = 0;
 
     return COUCHSTORE_SUCCESS;
 }
@@ -132,11 +214,52 @@ couchstore_error_t couchstore_set_sync(Db *db, int sync)
     return COUCHSTORE_SUCCESS;
 }
 
+// transactions committed with "sync"
+uint64_t couchstore_sync_count()
+{
+    return nsyncs;
+}
+
+// separate session whose snapshot-isolation transaction pins the current view
+couchstore_error_t couchstore_open_snapshot(Db *db, Db **snapshot)
+{
+    int ret;
+    Db *ppdb;
+
+    *snapshot = (Db*)malloc(sizeof(Db));
+    ppdb = *snapshot;
+
+    ppdb->filename = (char*)malloc(strlen(db->filename)+1);
+    strcpy(ppdb->filename, db->filename);
+    ppdb->sync = db->sync;
+    ppdb->buf = NULL;
+    ppdb->bufsize = 0;
+
+    conn->open_session(conn, NULL, NULL, &ppdb->session);
+    ppdb->session->open_cursor(ppdb->session, db->cursor->uri, NULL, NULL,
+                               &ppdb->cursor);
+    ret = ppdb->session->begin_transaction(ppdb->session, "isolation=snapshot");
+    if (ret != 0) {
+        couchstore_close_db(ppdb);
+        return COUCHSTORE_ERROR_OPEN_FILE;
+    }
+
+    return COUCHSTORE_SUCCESS;
+}
+
+couchstore_error_t couchstore_close_snapshot(Db *snapshot)
+{
+    // read-only transaction: nothing to commit
+    snapshot->session->rollback_transaction(snapshot->session, NULL);
+    return couchstore_close_db(snapshot);
+}
+
 LIBCOUCHSTORE_API
 couchstore_error_t couchstore_close_db(Db *db)
 {
     db->cursor->close(db->cursor);
     db->session->close(db->session, NULL);
+    free(db->buf);
     free(db->filename);
     free(db);
 
@@ -160,6 +283,102 @@ couchstore_error_t couchstore_db_info(Db *db, DbInfo* info)
     return COUCHSTORE_SUCCESS;
 }
 
+static int _get_stat(WT_CURSOR *cursor, int key, uint64_t *val)
+{
+    int ret;
+    const char *desc, *pvalue;
+    int64_t value;
+
+    cursor->set_key(cursor, key);
+    ret = cursor->search(cursor);
+    if (ret == 0) {
+        ret = cursor->get_value(cursor, &desc, &pvalue, &value);
+        *val = value;
+    }
+    return ret;
+}
+
+// sampled on a session of its own, as the handles belong to bench threads;
+// the cache is shared by all tables, the block size is per table
+couchstore_error_t couchstore_get_stats(Db *dbs[], int ndbs,
+                                        struct couch_engine_stats *stats)
+{
+    int i;
+    uint64_t requested, read, val;
+    char uri[256];
+    WT_SESSION *session;
+    WT_CURSOR *cursor;
+
+    if (!stats_on || conn->open_session(conn, NULL, NULL, &session) != 0) {
+        return COUCHSTORE_ERROR_READ;
+    }
+
+    if (session->open_cursor(session, "statistics:", NULL, NULL, &cursor) == 0) {
+        if (_get_stat(cursor, WT_STAT_CONN_CACHE_PAGES_REQUESTED, &requested) == 0 &&
+            _get_stat(cursor, WT_STAT_CONN_CACHE_READ, &read) == 0) {
+            stats->cache_hits = (requested > read)?(requested - read):(0);
+            stats->cache_misses = read;
+        }
+        if (_get_stat(cursor, WT_STAT_CONN_CACHE_BYTES_DIRTY, &val) == 0) {
+            stats->mem_bytes = val;
+        }
+        cursor->close(cursor);
+    }
+
+    for (i=0;i<ndbs;++i){
+        sprintf(uri, "statistics:%s", dbs[i]->cursor->uri);
+        if (session->open_cursor(session, uri, NULL, "statistics=(fast)",
+                                 &cursor) == 0) {
+            if (_get_stat(cursor, WT_STAT_DSRC_BLOCK_SIZE, &val) == 0) {
+                couch_engine_stat_add(&stats->file_size, val);
+            }
+            cursor->close(cursor);
+        }
+    }
+
+    session->close(session, NULL);
+
+    return COUCHSTORE_SUCCESS;
+}
+
+// checkpoint() and checkpoint_running() are called by one benchmark
+// thread, which gets a session of its own
+static WT_SESSION * _ckpt_session()
+{
+    if (!ckpt_session &&
+        conn->open_session(conn, NULL, NULL, &ckpt_session) != 0) {
+        ckpt_session = NULL;
+    }
+    return ckpt_session;
+}
+
+couchstore_error_t couchstore_checkpoint()
+{
+    WT_SESSION *session = _ckpt_session();
+
+    if (!session || session->checkpoint(session, NULL) != 0) {
+        return COUCHSTORE_ERROR_WRITE;
+    }
+    return COUCHSTORE_SUCCESS;
+}
+
+int couchstore_checkpoint_running()
+{
+    int running = 0;
+    uint64_t val;
+    WT_SESSION *session = _ckpt_session();
+    WT_CURSOR *cursor;
+
+    if (session &&
+        session->open_cursor(session, "statistics:", NULL, NULL, &cursor) == 0) {
+        if (_get_stat(cursor, WT_STAT_CONN_TXN_CHECKPOINT_RUNNING, &val) == 0) {
+            running = (val != 0);
+        }
+        cursor->close(cursor);
+    }
+    return running;
+}
+
 size_t _docinfo_to_buf(DocInfo *docinfo, void *buf)
 {
     // [db_seq,] rev_seq, deleted, content_meta, rev_meta (size), rev_meta (buf)
@@ -194,8 +413,7 @@ couchstore_error_t couchstore_save_documents(Db *db, Doc* const docs[], DocInfo
     int ret;
     unsigned i;
     uint16_t metalen;
-    uint8_t metabuf[METABUF_MAXLEN];
-    uint8_t *buf;
+    size_t len;
     char *err = NULL;
     WT_ITEM item;
 
@@ -207,14 +425,24 @@ couchstore_error_t couchstore_save_documents(Db *db, Doc* const docs[], DocInfo
         item.size = docs[i]->id.size;
         db->cursor->set_key(db->cursor, &item);
 
-        metalen = _docinfo_to_buf(infos[i], metabuf);
-        buf = (uint8_t*)malloc(sizeof(metalen) + metalen + docs[i]->data.size);
-        memcpy(buf + sizeof(metalen), metabuf, metalen);
-        memcpy(buf, &metalen, sizeof(metalen));
-        memcpy(buf + sizeof(metalen) + metalen, docs[i]->data.buf, docs[i]->data.size);
-
-        item.data = buf;
-        item.size = sizeof(metalen) + metalen + docs[i]->data.size;
+        if (raw_body) {
+            item.data = docs[i]->data.buf;
+            item.size = docs[i]->data.size;
+        } else {
+            // [metalen][meta][body], encoded in place; insert() copies it
+            len = sizeof(metalen) + METABUF_MAXLEN + docs[i]->data.size;
+            if (len > db->bufsize) {
+                db->bufsize = (len > db->bufsize * 2)?(len):(db->bufsize * 2);
+                db->buf = (uint8_t*)realloc(db->buf, db->bufsize);
+            }
+            metalen = _docinfo_to_buf(infos[i], db->buf + sizeof(metalen));
+            memcpy(db->buf, &metalen, sizeof(metalen));
+            len = sizeof(metalen) + metalen;
+            memcpy(db->buf + len, docs[i]->data.buf, docs[i]->data.size);
+
+            item.data = db->buf;
+            item.size = len + docs[i]->data.size;
+        }
         db->cursor->set_value(db->cursor, &item);
 
         ret = db->cursor->insert(db->cursor);
@@ -223,11 +451,13 @@ couchstore_error_t couchstore_save_documents(Db *db, Doc* const docs[], DocInfo
         }
 
         infos[i]->db_seq = 0;
-        free(buf);
     }
 
     ret = db->session->commit_transaction( db->session, db->sync ? "sync" : NULL );
     assert(ret == 0);
+    if (db->sync) {
+        __sync_fetch_and_add(&nsyncs, 1);
+    }
 
     return COUCHSTORE_SUCCESS;
 }
@@ -243,6 +473,16 @@ void _buf_to_docinfo(void *buf, size_t size, DocInfo *docinfo)
 {
     size_t offset = 0;
 
+    if (raw_body) {
+        // there is no header to decode
+        docinfo->rev_seq = 0;
+        docinfo->deleted = 0;
+        docinfo->content_meta = 0;
+        docinfo->rev_meta.buf = NULL;
+        docinfo->rev_meta.size = 0;
+        return;
+    }
+
     memcpy(&docinfo->rev_seq, (uint8_t*)buf + offset, sizeof(docinfo->rev_seq));
     offset += sizeof(docinfo->rev_seq);
 
@@ -267,6 +507,67 @@ void _buf_to_docinfo(void *buf, size_t size, DocInfo *docinfo)
     }
 }
 
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_all_docs(Db *db,
+                                       const sized_buf* startKeyPtr,
+                                       couchstore_docinfos_options options,
+                                       couchstore_changes_callback_fn callback,
+                                       void *ctx)
+{
+    int ret = 0, r, exact;
+    DocInfo *docinfo;
+    size_t rev_meta_size, max_meta_size = 256;
+    size_t meta_offset;
+    WT_ITEM key, value;
+
+    meta_offset = sizeof(uint64_t)*1 + sizeof(int) +
+                  sizeof(couchstore_content_meta_flags);
+    docinfo = (DocInfo*)malloc(sizeof(DocInfo) + max_meta_size);
+
+    db->cursor->reset(db->cursor);
+    if (startKeyPtr) {
+        key.data = startKeyPtr->buf;
+        key.size = startKeyPtr->size;
+        db->cursor->set_key(db->cursor, &key);
+        r = db->cursor->search_near(db->cursor, &exact);
+        if (r == 0 && exact < 0) {
+            r = db->cursor->next(db->cursor);
+        }
+    } else {
+        r = db->cursor->next(db->cursor);
+    }
+
+    while (ret >= 0 && r == 0) {
+        db->cursor->get_key(db->cursor, &key);
+        db->cursor->get_value(db->cursor, &value);
+
+        if (raw_body) {
+            rev_meta_size = 0;
+        } else {
+            memcpy(&rev_meta_size, (uint8_t*)value.data + sizeof(uint16_t) + meta_offset,
+                   sizeof(size_t));
+        }
+        if (rev_meta_size > max_meta_size) {
+            max_meta_size = rev_meta_size;
+            docinfo = (DocInfo*)realloc(docinfo, sizeof(DocInfo) + max_meta_size);
+        }
+
+        memset(docinfo, 0, sizeof(DocInfo));
+        docinfo->id.buf = (char *)key.data;
+        docinfo->id.size = key.size;
+        docinfo->size = key.size + value.size;
+        _buf_to_docinfo((uint8_t*)value.data + sizeof(uint16_t), value.size, docinfo);
+
+        ret = callback(db, docinfo, ctx);
+        r = db->cursor->next(db->cursor);
+    }
+
+    db->cursor->reset(db->cursor);
+    free(docinfo);
+
+    return (ret < 0)?(COUCHSTORE_ERROR_CANCEL):(COUCHSTORE_SUCCESS);
+}
+
 LIBCOUCHSTORE_API
 couchstore_error_t couchstore_open_document(Db *db,
                                             const void *id,
@@ -286,6 +587,10 @@ couchstore_error_t couchstore_open_document(Db *db,
     item.size = idlen;
     db->cursor->set_key(db->cursor, &item);
     ret = db->cursor->search(db->cursor);
+    if (ret == WT_NOTFOUND) {
+        *pDoc = NULL;
+        return COUCHSTORE_ERROR_DOC_NOT_FOUND;
+    }
     assert(ret == 0);
 
     meta_offset = sizeof(uint64_t)*1 + sizeof(int) +
@@ -303,6 +608,38 @@ couchstore_error_t couchstore_open_document(Db *db,
     return COUCHSTORE_SUCCESS;
 }
 
+// the value is read from the cursor's buffer, valid until the cursor is reset
+couchstore_error_t couchstore_open_document_ref(Db *db,
+                                                const void *id,
+                                                size_t idlen,
+                                                couchstore_doc_ref_fn callback,
+                                                void *ctx)
+{
+    int ret;
+    WT_ITEM item;
+    Doc doc;
+
+    item.data = id;
+    item.size = idlen;
+    db->cursor->set_key(db->cursor, &item);
+    ret = db->cursor->search(db->cursor);
+    if (ret == WT_NOTFOUND) {
+        return COUCHSTORE_ERROR_DOC_NOT_FOUND;
+    }
+    assert(ret == 0);
+
+    db->cursor->get_value(db->cursor, &item);
+
+    doc.id.buf = (char*)id;
+    doc.id.size = idlen;
+    doc.data.buf = (char*)item.data;
+    doc.data.size = item.size;
+    callback(db, &doc, ctx);
+    db->cursor->reset(db->cursor);
+
+    return COUCHSTORE_SUCCESS;
+}
+
 LIBCOUCHSTORE_API
 void couchstore_free_document(Doc *doc)
 {
@@ -338,3 +675,29 @@ couchstore_error_t couchstore_compact_db(Db* source, const char* target_filename
     return couchstore_compact_db_ex(source, target_filename, 0x0, NULL);
 }
 
+struct couch_engine * couch_engine_get(void)
+{
+    static struct couch_engine e;
+
+    memset(&e, 0, sizeof(e));
+    e.name = "wiredtiger";
+    e.desc = "WiredTiger";
+    e.flags = ENGINE_CONN;
+    couch_engine_set_core(&e);
+    e.open_document_ref = couchstore_open_document_ref;
+    e.set_sync = couchstore_set_sync;
+    e.set_cache = couchstore_set_cache;
+    e.set_idx_type = couchstore_set_idx_type;
+    e.set_raw_body = couchstore_set_raw_body;
+    e.set_stats = couchstore_set_stats;
+    e.get_stats = couchstore_get_stats;
+    e.sync_count = couchstore_sync_count;
+    e.set_option = couchstore_set_option;
+    e.set_checkpoint = couchstore_set_checkpoint;
+    e.checkpoint = couchstore_checkpoint;
+    e.checkpoint_running = couchstore_checkpoint_running;
+    e.open_conn = couchstore_open_conn;
+    e.close_conn = couchstore_close_conn;
+
+    return &e;
+}